@@ -0,0 +1,181 @@
+/*
+ * @Author: agent
+ * @Date: 2026-10-19 15:26:49
+ * @Last Modified by: agent
+ * @Last Modified time: 2026-10-19 15:26:49
+ * @Description: 协程版业务处理函数 挂起时不占业务线程
+ */
+
+#ifndef __NGX_C_COROUTINE_H__
+#define __NGX_C_COROUTINE_H__
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <atomic>
+#include <coroutine>
+#include <deque>
+#include <exception>
+#include <map>
+#include <vector>
+
+class CSocket;
+
+#define NGX_CO_IO_PREAD 0     /* pread */
+#define NGX_CO_IO_PWRITE 1    /* pwrite */
+#define NGX_CO_IO_FDATASYNC 2 /* fdatasync */
+
+/*
+ * 协程版处理函数的返回类型，处理函数里用 co_await 等定时器、发送、文件IO
+ *   创建后先挂起，由 Start() 填好连接下标再开始跑，跑到第一个 co_await 返回
+ *   等的事情完成后由业务线程池恢复，跑完自己销毁协程帧
+ */
+class CCoTask {
+ public:
+  struct promise_type {
+    int iSlot = -1; /* 连接在连接池中的下标，affine 模式恢复到同一线程 */
+
+    CCoTask get_return_object() {
+      return CCoTask(std::coroutine_handle<promise_type>::from_promise(*this));
+    }
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    std::suspend_never final_suspend() noexcept { return {}; }
+    void return_value(bool) {}
+    void unhandled_exception() { std::terminate(); }
+  };
+  typedef std::coroutine_handle<promise_type> handle_t;
+
+  CCoTask(CCoTask &&other) noexcept : m_handle(other.m_handle) {
+    other.m_handle = nullptr;
+  }
+  CCoTask(const CCoTask &) = delete;
+  CCoTask &operator=(const CCoTask &) = delete;
+  ~CCoTask() {
+    if (m_handle) m_handle.destroy(); /* 没启动过 */
+  }
+
+  /*
+   * @ Description: 开始执行，之后协程帧归协程自己管
+   * @ Parameter: int iSlot(连接在连接池中的下标)
+   * @ Return: void
+   */
+  void Start(int iSlot) {
+    handle_t h = m_handle;
+    m_handle = nullptr;
+    h.promise().iSlot = iSlot;
+    h.resume();
+  }
+
+ private:
+  explicit CCoTask(handle_t h) : m_handle(h) {}
+  handle_t m_handle;
+};
+
+/* co_await ngx_co_sleep(ms) 定时器到了再恢复 */
+struct CCoSleepAwaiter {
+  uint64_t iDeadlineUs; /* 到期时间 微秒 */
+
+  bool await_ready() const noexcept { return false; }
+  void await_suspend(CCoTask::handle_t h);
+  void await_resume() const noexcept {}
+};
+
+/* co_await ngx_co_pread(...) 等 IO 线程替协程做阻塞的文件操作 */
+struct CCoIoAwaiter {
+  int iOp;           /* NGX_CO_IO_* */
+  int fd;            /* 文件描述符 */
+  void *pBuf;        /* 读写缓冲区 */
+  size_t iLen;       /* 读写长度 */
+  off_t iOffset;     /* 文件偏移 */
+  ssize_t iResult;   /* 返回值 */
+  int iErrno;        /* 失败时的 errno */
+  CCoTask::handle_t hWaiter; /* 等结果的协程 */
+
+  bool await_ready() const noexcept { return false; }
+  void await_suspend(CCoTask::handle_t h);
+  ssize_t await_resume() const noexcept;
+};
+
+/* co_await coSend(pSendbuf) 发送线程写完或者丢弃后恢复 */
+struct CCoSendAwaiter {
+  CSocket *pSocket; /* 发送用的socket对象 */
+  char *pSendbuf;   /* 消息头+包头+包体 */
+  int iPrio;        /* 发送优先级 */
+
+  bool await_ready() const noexcept { return false; }
+  void await_suspend(CCoTask::handle_t h);
+  void await_resume() const noexcept {}
+};
+
+CCoSleepAwaiter ngx_co_sleep(int iMs);
+CCoIoAwaiter ngx_co_pread(int fd, void *pBuf, size_t iLen, off_t iOffset);
+CCoIoAwaiter ngx_co_pwrite(int fd, const void *pBuf, size_t iLen,
+                           off_t iOffset);
+CCoIoAwaiter ngx_co_fdatasync(int fd);
+
+/*
+ * 协程调度器：一个定时器线程，几个 IO 线程
+ *   定时器到期、IO 做完都把协程交给业务线程池恢复，自己不跑业务代码
+ *   线程在第一次有协程等定时器/等IO时才创建，没人用就不占线程
+ */
+class CCoScheduler {
+ private:
+  CCoScheduler();
+
+  static CCoScheduler *m_instance;
+
+  class GC_CCoScheduler {
+   public:
+    ~GC_CCoScheduler() {
+      delete CCoScheduler::m_instance;
+      CCoScheduler::m_instance = nullptr;
+    }
+  };
+
+ public:
+  ~CCoScheduler();
+
+  static CCoScheduler *GetInstance() {
+    if (m_instance == nullptr) {
+      m_instance = new CCoScheduler();
+      static GC_CCoScheduler gc;
+    }
+    return m_instance;
+  }
+
+  bool Start(int iIoThreadNum); /* 记下IO线程数，线程用到时才创建 */
+  void Stop();                  /* 停止线程 */
+
+  void AddTimer(uint64_t iDeadlineUs,
+                CCoTask::handle_t h);   /* 协程等定时器 */
+  void AddIo(CCoIoAwaiter *pIo);        /* 协程等文件IO */
+  static void Resume(CCoTask::handle_t h); /* 交给业务线程池恢复 停了就销毁 */
+
+  int getTimerCount() { return m_iTimerCount; } /* 等定时器的协程数 */
+  int getIoCount() { return m_iIoCount; }       /* 等IO的协程数 */
+
+ private:
+  static void *TimerThread(void *threadData); /* 定时器线程 */
+  static void *IoThread(void *threadData);    /* IO线程 */
+  static void ResumeTask(void *pArg);         /* 业务线程里恢复协程 */
+
+  std::atomic<bool> m_shutdown; /* 线程退出，之后要恢复的协程直接销毁 */
+  int m_iIoThreadNum;           /* IO线程数 */
+
+  bool m_bTimerStarted;         /* 定时器线程已创建，m_timerMutex 保护 */
+  pthread_t m_timerThread;      /* 定时器线程 */
+  pthread_mutex_t m_timerMutex; /* 保护 m_timers */
+  pthread_cond_t m_timerCond;   /* 有更早的定时器加进来 */
+  std::multimap<uint64_t, void *> m_timers; /* 到期时间 -> 协程 */
+  std::atomic<int> m_iTimerCount;           /* 等定时器的协程数 */
+
+  std::vector<pthread_t> m_ioThreads;   /* IO线程，m_ioMutex 保护 */
+  pthread_mutex_t m_ioMutex;            /* 保护 m_ioQueue */
+  pthread_cond_t m_ioCond;               /* 有IO要做 */
+  std::deque<CCoIoAwaiter *> m_ioQueue;  /* 待做的IO */
+  std::atomic<int> m_iIoCount;           /* 等IO的协程数 */
+};
+
+#endif
@@ -11,6 +11,12 @@
 
 #include <stddef.h>  //NULL
 
+// 包头 crc32 字段的校验方式，每个连接单独协商
+#define NGX_CSUM_CRC32 0  /* 软件 CRC-32 多项式 0x04C11DB7 默认 */
+#define NGX_CSUM_CRC32C 1 /* CRC32C 有 SSE4.2 时用 crc32 指令 */
+#define NGX_CSUM_NONE 2   /* 不校验 字段填0 只给可信的内部端口用 */
+#define NGX_CSUM_N 3      /* 方式数目 */
+
 class CCRC32 {
  private:
   CCRC32();
@@ -46,12 +52,38 @@ class CCRC32 {
   };
 
  public:
+  typedef unsigned int (*ngx_crc_fold_pt)(unsigned int crc,
+                                          const unsigned char* buffer,
+                                          unsigned int dwSize);
+
   void Init_CRC32_Table();
   unsigned int Reflect(unsigned int ref, char ch);
   int Get_CRC(unsigned char* buffer, unsigned int dwSize);
+  unsigned int Update_CRC(unsigned int crc, const unsigned char* buffer,
+                          unsigned int dwSize); /* 接着上一段继续算 */
+  unsigned int Copy_CRC(unsigned int crc, unsigned char* dst,
+                        const unsigned char* src, unsigned int dwSize,
+                        int iMode = NGX_CSUM_CRC32); /* 边拷贝边算 */
+  unsigned int Update_CRC32C(unsigned int crc, const unsigned char* buffer,
+                             unsigned int dwSize); /* CRC32C 接着算 */
+  unsigned int Update_Csum(int iMode, unsigned int crc,
+                           const unsigned char* buffer,
+                           unsigned int dwSize); /* 按校验方式接着算 */
+
+  const char* getImpl() const { return m_pImpl; } /* 当前用的实现 */
+
+ private:
+  unsigned int Slice_CRC(unsigned int crc, const unsigned char* buffer,
+                         unsigned int dwSize); /* 查表 一次16字节 */
 
  public:
-  unsigned int crc32_table[256];  // Lookup table arrays
+  unsigned int crc32_table[16][256];  // Lookup table arrays 第k张是再移k字节
+  unsigned int crc32c_table[256]; /* 没有 crc32 指令时 CRC32C 查表用 */
+
+ private:
+  ngx_crc_fold_pt m_pFold;   /* 无进位乘法折叠 CPU不支持为空 */
+  ngx_crc_fold_pt m_pCrc32c; /* crc32 指令 CPU不支持为空 */
+  const char* m_pImpl;     /* 实现名 打日志用 */
 };
 
 #endif
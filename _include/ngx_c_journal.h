@@ -0,0 +1,130 @@
+/*
+ * @Author: agent
+ * @Date: 2026-10-19 15:47:25
+ * @Last Modified by: agent
+ * @Last Modified time: 2026-10-19 15:47:25
+ * @Description: 注册日志 只追加，攒一批一起落盘，启动时 mmap 恢复用户表
+ */
+
+#ifndef __NGX_C_JOURNAL_H__
+#define __NGX_C_JOURNAL_H__
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include <atomic>
+
+#include "ngx_c_coroutine.h"
+#include "ngx_c_ringbuffer.h"
+#include "ngx_c_userregistry.h"
+
+#define NGX_JOURNAL_MAGIC 0x324a474e /* "NGJ2" 老的明文记录当坏记录 */
+
+// 注册回包前等到哪一步 JournalSync
+#define NGX_JOURNAL_SYNC_NONE 0  /* 不等 进了暂存队列就回 */
+#define NGX_JOURNAL_SYNC_WRITE 1 /* 等 write 进页缓存 进程崩了不丢 */
+#define NGX_JOURNAL_SYNC_DATA 2  /* 等 fdatasync 机器掉电也不丢 */
+
+/* 日志记录 定长128字节，本机字节序，只给本机重启用 */
+typedef struct ngx_journal_rec_s {
+  uint32_t iMagic;  /* NGX_JOURNAL_MAGIC */
+  uint32_t iCrc;    /* 后面所有字节的 CRC32C 断电写了一半的记录靠它认出来 */
+  uint32_t iUserId; /* 用户编号 */
+  int32_t iType;    /* 注册类型 */
+  char username[NGX_USER_NAME_LEN];
+  ngx_user_cred_t cred; /* 密码摘要 不落明文 */
+  char pad[4];
+} ngx_journal_rec_t, *lpngx_journal_rec_t;
+
+static_assert(sizeof(ngx_journal_rec_t) == 128, "journal record is 128 bytes");
+
+/* co_await Append(...) 按 JournalSync 等记录落到要求的程度 返回是否成功 */
+struct CJournalAwaiter {
+  ngx_journal_rec_t rec;      /* 要追加的记录 */
+  bool bOk;                   /* 刷盘线程填的结果 */
+  CCoTask::handle_t hWaiter;  /* 等结果的协程 */
+
+  bool await_ready() noexcept;
+  void await_suspend(CCoTask::handle_t h) noexcept;
+  bool await_resume() const noexcept { return bOk; }
+};
+
+/*
+ * 注册日志：
+ *   master 在 fork 之前 Open：多线程 mmap 恢复共享用户表，只恢复一次
+ *     O_APPEND 的描述符所有 worker 共用，一批记录一次 write，不同 worker 的
+ *     批次不会交错
+ *   worker 启动时 Start 起刷盘线程
+ *   业务线程把记录放进无锁暂存队列，刷盘线程一次取一批 write + fdatasync，
+ *     然后恢复这一批里等着的协程
+ */
+class CUserJournal {
+ private:
+  CUserJournal();
+
+  static CUserJournal *m_instance;
+
+  class GC_CUserJournal {
+   public:
+    ~GC_CUserJournal() {
+      delete CUserJournal::m_instance;
+      CUserJournal::m_instance = nullptr;
+    }
+  };
+
+ public:
+  ~CUserJournal();
+
+  static CUserJournal *GetInstance() {
+    if (m_instance == nullptr) {
+      m_instance = new CUserJournal();
+      static GC_CUserJournal gc;
+    }
+    return m_instance;
+  }
+
+  bool Open(const char *pFileName,
+            int iRecoverThreads); /* master 打开日志 截尾巴 恢复用户表 */
+  bool Start(int iSyncMode, int iQueueSize); /* worker 起刷盘线程 */
+  void Stop();                     /* 刷完暂存队列 停刷盘线程 */
+
+  CJournalAwaiter Append(uint32_t iUserId, int iType, const char *username,
+                         const ngx_user_cred_t &cred); /* 追加一条注册记录 */
+
+  bool isEnabled() { return m_fd != -1; }
+  int getSyncMode() { return m_iSyncMode; }
+  int getQueueCount() { return (int)m_queue.Size(); }
+  int getWriteCount() { return m_iWriteCount; }
+  int getSyncCount() { return m_iSyncCount; }
+  int getRecordCount() { return m_iRecordCount; }
+
+ private:
+  /* 暂存队列的一项 记录按值放，SYNC_NONE 时没有人等 */
+  struct JournalItem {
+    ngx_journal_rec_t rec;
+    CJournalAwaiter *pWaiter;
+  };
+
+  friend struct CJournalAwaiter;
+  void Push(const ngx_journal_rec_t &rec, CJournalAwaiter *pWaiter);
+  bool Recover(int iThreads);
+  static void *RecoverThread(void *threadData);
+  static void *FlushThread(void *threadData);
+
+  int m_fd;                        /* 日志文件 */
+  int m_iSyncMode;                 /* NGX_JOURNAL_SYNC_* */
+  CRingBuffer<JournalItem> m_queue; /* 暂存队列 */
+
+  pthread_t m_tid;                     /* 刷盘线程 */
+  pthread_mutex_t m_mutex;             /* 配合条件变量 */
+  pthread_cond_t m_cond;               /* 叫醒刷盘线程 */
+  std::atomic<bool> m_bSleeping;       /* 刷盘线程在等 */
+  std::atomic<bool> m_bStop;           /* 停止 */
+  bool m_bStarted;                     /* 刷盘线程起了 */
+
+  std::atomic<int> m_iWriteCount;  /* write 次数 */
+  std::atomic<int> m_iSyncCount;   /* fdatasync 次数 */
+  std::atomic<int> m_iRecordCount; /* 写出的记录数 */
+};
+
+#endif
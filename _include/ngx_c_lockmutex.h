@@ -11,13 +11,16 @@
 
 #include <pthread.h>
 
+// pMutex 为空时什么也不做，调用者不需要加锁时传 nullptr
 class CLock {
  public:
   CLock(pthread_mutex_t *pMutex) : m_pMutex(pMutex) {
-    pthread_mutex_lock(m_pMutex);
+    if (m_pMutex != nullptr) pthread_mutex_lock(m_pMutex);
   }
 
-  ~CLock() { pthread_mutex_unlock(m_pMutex); };
+  ~CLock() {
+    if (m_pMutex != nullptr) pthread_mutex_unlock(m_pMutex);
+  };
 
  private:
   pthread_mutex_t *m_pMutex;
@@ -0,0 +1,57 @@
+/*
+ * @Author: agent
+ * @Date: 2026-10-19 15:32:35
+ * @Last Modified by: agent
+ * @Last Modified time: 2026-10-19 15:38:20
+ * @Description: 回包构造 一次分配，包体直接写进发送缓冲区，边写边算CRC
+ */
+
+#ifndef __NGX_C_MSGBUILDER_H__
+#define __NGX_C_MSGBUILDER_H__
+
+#include "ngx_c_socket.h"
+
+/*
+ * 用法:
+ *   CMsgBuilder reply(pMsgHeader, _CMD_xxx, sizeof(STRUCT_xxx));
+ *   reply.PutInt32(...); reply.PutString(...);
+ *   msgSend(reply.Finish());
+ * 缓冲区布局和 msgSend 要的一样：消息头 + 包头 + 包体
+ * Finish 之前析构会把缓冲区释放掉
+ */
+class CMsgBuilder {
+ public:
+  CMsgBuilder(LPSTRUC_MSG_HEADER pMsgHeader, unsigned short iMsgCode,
+              int iBodyMax);
+  ~CMsgBuilder();
+
+  CMsgBuilder(const CMsgBuilder &) = delete;
+  CMsgBuilder &operator=(const CMsgBuilder &) = delete;
+
+  char *Reserve(int iLen); /* 预留一段包体由调用者直接写，要在下次写之前写好 */
+  template <typename T>
+  T *Reserve() {
+    return (T *)Reserve(sizeof(T));
+  }
+  bool Append(const void *pData, int iLen); /* 拷贝进包体 */
+  bool PutInt16(unsigned short iValue);     /* 网络序写入 */
+  bool PutInt32(unsigned int iValue);       /* 网络序写入 */
+  bool PutString(const char *pStr, int iFieldLen); /* 定长字段 不足补0 */
+  bool PutZero(int iLen);                          /* 补0 */
+
+  int getBodyLen() const { return m_iBodyLen; }
+  char *Finish(); /* 填包长和CRC，交出缓冲区给 msgSend */
+
+ private:
+  void catchUp(); /* 把 Reserve 出去还没算的部分算进CRC */
+
+  char *m_pBuf;            /* 消息头 + 包头 + 包体 */
+  char *m_pBody;           /* 包体开始 */
+  int m_iBodyMax;          /* 包体最大长度 */
+  int m_iBodyLen;          /* 已写的包体长度 */
+  int m_iCrcLen;           /* 已算进CRC的包体长度 */
+  unsigned int m_iCrc;     /* 前 m_iCrcLen 字节的CRC */
+  int m_iCsumMode;         /* 校验方式 NGX_CSUM_* */
+};
+
+#endif
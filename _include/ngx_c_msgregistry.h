@@ -0,0 +1,160 @@
+/*
+ * @Author: agent
+ * @Date: 2026-10-19 15:31:12
+ * @Last Modified by: agent
+ * @Last Modified time: 2026-10-19 15:54:56
+ * @Description: 编译期生成的消息码处理表
+ */
+
+#ifndef __NGX_C_MSGREGISTRY_H__
+#define __NGX_C_MSGREGISTRY_H__
+
+#include <algorithm>
+#include <array>
+#include <type_traits>
+
+#include "ngx_c_coroutine.h"
+#include "ngx_c_socket.h"
+
+/*
+ * 包体解码：网络序转本机序、截断字符串之类，每种包体结构特化一个
+ * 没特化的结构原样交给处理函数
+ */
+template <typename T>
+struct ngx_msg_body {
+  static void Decode(T &) {}
+};
+
+/* 处理函数用完包体(协程版是拷进协程帧)之后清掉里面的明文密码之类
+ * 有要清的字段的结构特化一个 */
+template <typename T>
+struct ngx_msg_wipe {
+  static void Wipe(T &) {}
+};
+
+/* 包体长度不固定的消息 Body 写这个，处理函数自己检查长度 */
+struct ngx_msg_raw {};
+
+/* 包体分块交付的消息 Body 写这个，每块调一次处理函数
+ *   块的偏移、总长、是否最后一块、整包 crc 对不对在消息头 iChunk* 里 */
+struct ngx_msg_chunk {};
+
+/* 处理表项，pThunk 是生成的长度检查 + 解码 + 调用 */
+template <typename C>
+struct ngx_msg_entry_s {
+  int (*pThunk)(C *pThis, lpngx_connection_t pConn,
+                LPSTRUC_MSG_HEADER pMsgHeader, char *pPkgBody,
+                unsigned short iBodyLength);
+  int iClass;   /* 业务线程调度类别 NGX_RECV_CLASS_* */
+  int iQuota;   /* 最多同时几个线程处理 0 不限 */
+  bool bInline; /* 在epoll线程直接处理 只给不阻塞的轻量处理函数用 */
+  bool bChunk;  /* 包体分块交付 */
+};
+
+/* 取成员函数的返回类型 */
+template <typename F>
+struct ngx_handler_traits;
+template <typename C, typename R, typename... A>
+struct ngx_handler_traits<R (C::*)(A...)> {
+  typedef R result_type;
+};
+
+/*
+ * 一个消息码的绑定 Body 是包体结构，没有包体写 void
+ *   普通处理函数 bool (C::*)(lpngx_connection_t, LPSTRUC_MSG_HEADER, Body *)
+ *   协程处理函数 CCoTask (C::*)(lpngx_connection_t, STRUC_MSG_HEADER, Body)
+ *   变长包体 bool (C::*)(lpngx_connection_t, LPSTRUC_MSG_HEADER, char *,
+ *     unsigned short)，Body 写 ngx_msg_raw
+ *   分块包体 处理函数和变长包体一样，每次拿到一块，Body 写 ngx_msg_chunk
+ *   协程第一次挂起后消息内存就释放了，所以协程版消息头和包体按值传
+ */
+template <typename C, unsigned short Code, typename Body, auto F,
+          int Class = NGX_RECV_CLASS_NORMAL, int Quota = 0,
+          bool Inline = false>
+struct ngx_msg_bind {
+  static constexpr unsigned short iCode = Code;
+  static constexpr bool bCoroutine = std::is_same_v<
+      typename ngx_handler_traits<decltype(F)>::result_type, CCoTask>;
+
+  static int Thunk(C *pThis, lpngx_connection_t pConn,
+                   LPSTRUC_MSG_HEADER pMsgHeader, char *pPkgBody,
+                   unsigned short iBodyLength) {
+    if constexpr (std::is_same_v<Body, ngx_msg_chunk>) {
+      static_assert(!bCoroutine && !Inline, "分块包体只支持业务线程普通处理函数");
+      /* 批量包里的子消息不是按块收的 */
+      if ((pMsgHeader->iChunkFlags & NGX_CHUNK_STREAM) == 0)
+        return NGX_MSG_ERR_SIZE;
+      return (pThis->*F)(pConn, pMsgHeader, pPkgBody, iBodyLength)
+                 ? NGX_MSG_OK
+                 : NGX_MSG_ERR_HANDLER;
+    } else if constexpr (std::is_same_v<Body, ngx_msg_raw>) {
+      static_assert(!bCoroutine, "变长包体不支持协程处理函数");
+      return (pThis->*F)(pConn, pMsgHeader, pPkgBody, iBodyLength)
+                 ? NGX_MSG_OK
+                 : NGX_MSG_ERR_HANDLER;
+    } else if constexpr (std::is_void_v<Body>) {
+      if (iBodyLength != 0) return NGX_MSG_ERR_SIZE;
+      if constexpr (bCoroutine) {
+        (pThis->*F)(pConn, *pMsgHeader).Start(pConn->iSlot);
+        return NGX_MSG_OK;
+      } else {
+        return (pThis->*F)(pConn, pMsgHeader) ? NGX_MSG_OK
+                                              : NGX_MSG_ERR_HANDLER;
+      }
+    } else {
+      static_assert(std::is_trivially_copyable_v<Body>,
+                    "包体必须是能直接按字节解释的结构");
+      if (pPkgBody == nullptr || iBodyLength != sizeof(Body))
+        return NGX_MSG_ERR_SIZE;
+      Body *pBody = (Body *)pPkgBody;
+      ngx_msg_body<Body>::Decode(*pBody);
+      if constexpr (bCoroutine) {
+        CCoTask task = (pThis->*F)(pConn, *pMsgHeader, *pBody);
+        ngx_msg_wipe<Body>::Wipe(*pBody);
+        task.Start(pConn->iSlot);
+        return NGX_MSG_OK;
+      } else {
+        bool bOk = (pThis->*F)(pConn, pMsgHeader, pBody);
+        ngx_msg_wipe<Body>::Wipe(*pBody);
+        return bOk ? NGX_MSG_OK : NGX_MSG_ERR_HANDLER;
+      }
+    }
+  }
+
+  static constexpr ngx_msg_entry_s<C> Entry() {
+    return {&Thunk, Class, Quota, Inline,
+            std::is_same_v<Body, ngx_msg_chunk>};
+  }
+};
+
+/*
+ * 把一组绑定生成按消息码下标的稠密处理表，没绑定的位置 pThunk 为空
+ *   消息码重复、超出统计数组都在编译期报错
+ */
+template <typename C, typename... Binds>
+struct ngx_msg_table {
+  static constexpr int N = std::max({(int)Binds::iCode...}) + 1;
+  static_assert(N <= NGX_MAX_MSGCODE, "消息码超出 NGX_MAX_MSGCODE");
+
+  static constexpr bool Unique() {
+    bool seen[N] = {};
+    for (int code : {(int)Binds::iCode...}) {
+      if (seen[code]) return false;
+      seen[code] = true;
+    }
+    return true;
+  }
+  static_assert(Unique(), "消息码重复绑定");
+
+  static constexpr std::array<ngx_msg_entry_s<C>, N> Make() {
+    std::array<ngx_msg_entry_s<C>, N> table = {};
+    for (int i = 0; i < N; ++i)
+      table[i] = {nullptr, NGX_RECV_CLASS_NORMAL, 0, false, false};
+    ((table[Binds::iCode] = Binds::Entry()), ...);
+    return table;
+  }
+
+  static constexpr std::array<ngx_msg_entry_s<C>, N> m_table = Make();
+};
+
+#endif
@@ -0,0 +1,165 @@
+/*
+ * @Author: agent
+ * @Date: 2026-10-19 15:01:54
+ * @Last Modified by: agent
+ * @Last Modified time: 2026-10-19 15:07:36
+ * @Description: 有界无锁多生产者多消费者环形队列
+ */
+
+#ifndef __NGX_C_RINGBUFFER_H__
+#define __NGX_C_RINGBUFFER_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+
+#define NGX_CACHELINE_SIZE 64 /* 缓存行大小 */
+
+/*
+ * 每个格子带一个序号:
+ *   seq == pos       格子空，位置 pos 的生产者可以写
+ *   seq == pos + 1   格子有数据，位置 pos 的消费者可以读
+ * 生产者和消费者各自 CAS 抢位置，抢到后只写自己的格子，不需要锁
+ */
+template <typename T>
+class CRingBuffer {
+ public:
+  CRingBuffer() : m_pCells(nullptr), m_iMask(0), m_iEnqueuePos(0), m_iDequeuePos(0) {}
+  ~CRingBuffer() { delete[] m_pCells; }
+
+  CRingBuffer(const CRingBuffer &) = delete;
+  CRingBuffer &operator=(const CRingBuffer &) = delete;
+
+  /*
+   * @ Description: 分配格子，容量向上取2的幂 只能在使用前调用一次
+   * @ Parameter: size_t capacity
+   * @ Return: bool
+   */
+  bool Init(size_t capacity) {
+    if (m_pCells != nullptr || capacity < 2) return false;
+    size_t size = 2;
+    while (size < capacity) size <<= 1;
+
+    m_pCells = new Cell[size];
+    for (size_t i = 0; i < size; ++i)
+      m_pCells[i].seq.store(i, std::memory_order_relaxed);
+    m_iMask = size - 1;
+    m_iEnqueuePos.store(0, std::memory_order_relaxed);
+    m_iDequeuePos.store(0, std::memory_order_relaxed);
+    return true;
+  }
+
+  /*
+   * @ Description: 入队
+   * @ Parameter: const T &data, size_t *pPos(非空时带回入队位置)
+   * @ Return: bool 队列满返回 false
+   */
+  bool Push(const T &data, size_t *pPos = nullptr) {
+    Cell *cell;
+    size_t pos = m_iEnqueuePos.load(std::memory_order_relaxed);
+    for (;;) {
+      cell = &m_pCells[pos & m_iMask];
+      size_t seq = cell->seq.load(std::memory_order_acquire);
+      intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+      if (diff == 0) { /* 格子空，抢这个位置 */
+        if (m_iEnqueuePos.compare_exchange_weak(pos, pos + 1,
+                                                std::memory_order_relaxed))
+          break;
+      } else if (diff < 0) { /* 满了 */
+        return false;
+      } else { /* 被别人抢了，重新取位置 */
+        pos = m_iEnqueuePos.load(std::memory_order_relaxed);
+      }
+    }
+    cell->data = data;
+    cell->seq.store(pos + 1, std::memory_order_release);
+    if (pPos != nullptr) *pPos = pos;
+    return true;
+  }
+
+  /*
+   * @ Description: 出队
+   * @ Parameter: T &data
+   * @ Return: bool 队列空返回 false
+   */
+  bool Pop(T &data) {
+    Cell *cell;
+    size_t pos = m_iDequeuePos.load(std::memory_order_relaxed);
+    for (;;) {
+      cell = &m_pCells[pos & m_iMask];
+      size_t seq = cell->seq.load(std::memory_order_acquire);
+      intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+      if (diff == 0) { /* 有数据，抢这个位置 */
+        if (m_iDequeuePos.compare_exchange_weak(pos, pos + 1,
+                                                std::memory_order_relaxed))
+          break;
+      } else if (diff < 0) { /* 空了 */
+        return false;
+      } else {
+        pos = m_iDequeuePos.load(std::memory_order_relaxed);
+      }
+    }
+    data = cell->data;
+    cell->seq.store(pos + m_iMask + 1, std::memory_order_release); /* 下一圈 */
+    return true;
+  }
+
+  /*
+   * @ Description: 批量出队 一次 CAS 拿走头部连续的 n 个已写好的格子
+   * @ Parameter: T *pData(至少 iMax 个), size_t iMax
+   * @ Return: size_t 取到的个数，队列空返回 0
+   */
+  size_t PopBatch(T *pData, size_t iMax) {
+    size_t pos = m_iDequeuePos.load(std::memory_order_relaxed);
+    size_t n;
+    for (;;) {
+      /* 数一下从 pos 开始有几个格子已经写好 */
+      for (n = 0; n < iMax; ++n) {
+        Cell *cell = &m_pCells[(pos + n) & m_iMask];
+        if (cell->seq.load(std::memory_order_acquire) != pos + n + 1) break;
+      }
+      if (n == 0) {
+        /* 头部不可读：可能空了，也可能被别的消费者拿走了 */
+        size_t cur = m_iDequeuePos.load(std::memory_order_relaxed);
+        if (cur == pos) return 0;
+        pos = cur;
+        continue;
+      }
+      if (m_iDequeuePos.compare_exchange_weak(pos, pos + n,
+                                              std::memory_order_relaxed))
+        break;
+    }
+    for (size_t i = 0; i < n; ++i) {
+      Cell *cell = &m_pCells[(pos + i) & m_iMask];
+      pData[i] = cell->data;
+      cell->seq.store(pos + i + m_iMask + 1, std::memory_order_release);
+    }
+    return n;
+  }
+
+  /* 大概的元素个数，只用于统计 */
+  size_t Size() const {
+    size_t enq = m_iEnqueuePos.load(std::memory_order_relaxed);
+    size_t deq = m_iDequeuePos.load(std::memory_order_relaxed);
+    return (enq > deq) ? enq - deq : 0;
+  }
+
+  size_t Capacity() const { return m_iMask + 1; }
+
+ private:
+  struct Cell {
+    std::atomic<size_t> seq;
+    T data;
+  };
+
+  Cell *m_pCells; /* 格子数组 */
+  size_t m_iMask; /* 容量 - 1 */
+
+  /* 生产者和消费者的位置分开放在不同缓存行，避免来回失效 */
+  alignas(NGX_CACHELINE_SIZE) std::atomic<size_t> m_iEnqueuePos;
+  alignas(NGX_CACHELINE_SIZE) std::atomic<size_t> m_iDequeuePos;
+  char m_pad[NGX_CACHELINE_SIZE - sizeof(std::atomic<size_t>)];
+};
+
+#endif
@@ -0,0 +1,92 @@
+/*
+ * @Author: agent
+ * @Date: 2026-10-19 15:43:27
+ * @Last Modified by: agent
+ * @Last Modified time: 2026-10-19 15:43:27
+ * @Description: 会话表 master 创建的共享内存，所有 worker 无锁读
+ */
+
+#ifndef __NGX_C_SESSION_H__
+#define __NGX_C_SESSION_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <atomic>
+
+#include "ngx_c_userregistry.h"
+
+#define NGX_SESSION_TOKEN_LEN 16 /* 前4字节槽位下标(网络序) 后12字节随机数 */
+
+/* 会话槽位 独占缓存行
+ *   写的人先把 iOwner 从0抢成自己的进程号，再把 iSeq 改成奇数，写完再加一
+ *   读的人前后两次 iSeq 一样才算数
+ *   写到一半进程死了，iOwner 留着死进程号，新建会话时看到就收回这个槽位
+ *   iExpire 单独用原子量更新，续期不用进顺序锁 */
+typedef struct alignas(64) ngx_session_slot_s {
+  std::atomic<pid_t> iOwner;     /* 正在写的进程 0 表示没人写 */
+  std::atomic<uint32_t> iSeq;    /* 顺序锁 奇数表示正在写 */
+  std::atomic<uint32_t> iExpire; /* 过期时间(秒) 0 表示空槽或者正在占用 */
+  uint32_t iUserId;              /* 用户编号 */
+  unsigned char token[NGX_SESSION_TOKEN_LEN];
+  char username[NGX_USER_NAME_LEN];
+} ngx_session_slot_t, *lpngx_session_slot_t;
+
+/* 共享内存开头 后面紧跟槽位数组 */
+typedef struct alignas(64) ngx_session_shm_s {
+  std::atomic<uint32_t> iCursor; /* 下一个找空位的起点 所有 worker 共用 */
+} ngx_session_shm_t, *lpngx_session_shm_t;
+
+/*
+ * 会话表：登录成功发一个令牌，客户端重连到任何一个 worker 都能凭令牌恢复登录
+ *   master 在创建 worker 之前 mmap(MAP_SHARED)，fork 之后各 worker 看到同一块内存
+ *   令牌里带槽位下标，查找直接定位不用探测，全程不加锁
+ *   槽位不够时复用已过期的，找不到返回失败
+ */
+class CSessionTable {
+ private:
+  CSessionTable();
+
+  static CSessionTable *m_instance;
+
+  class GC_CSessionTable {
+   public:
+    ~GC_CSessionTable() {
+      delete CSessionTable::m_instance;
+      CSessionTable::m_instance = nullptr;
+    }
+  };
+
+ public:
+  ~CSessionTable();
+
+  static CSessionTable *GetInstance() {
+    if (m_instance == nullptr) {
+      m_instance = new CSessionTable();
+      static GC_CSessionTable gc;
+    }
+    return m_instance;
+  }
+
+  bool Create(int iCapacity, int iTimeout); /* master 创建共享内存 */
+
+  bool Open(const char *username, uint32_t iUserId,
+            unsigned char *pToken); /* 新建会话 返回令牌 */
+  bool Lookup(const unsigned char *pToken, uint32_t *pUserId,
+              char *pUserName); /* 凭令牌查会话 顺便续期 */
+
+  int getCapacity() { return m_iCapacity; } /* 槽位数 */
+
+ private:
+  bool reclaimSlot(lpngx_session_slot_t pSlot,
+                   pid_t iOwner); /* 收回死进程写了一半的槽位 */
+
+  lpngx_session_shm_t m_pShm;    /* 共享内存开头 */
+  lpngx_session_slot_t m_pSlots; /* 槽位数组 */
+  int m_iCapacity;               /* 槽位数 */
+  int m_iTimeout;                /* 会话有效期(秒) */
+  size_t m_iMemLen;              /* mmap 长度 */
+};
+
+#endif
@@ -0,0 +1,44 @@
+/*
+ * @Author: agent
+ * @Date: 2026-10-19 15:47:25
+ * @Last Modified by: agent
+ * @Last Modified time: 2026-10-19 15:47:25
+ * @Description: SHA-256 和 PBKDF2-HMAC-SHA256 存密码摘要用
+ */
+
+#ifndef __NGX_C_SHA256_H__
+#define __NGX_C_SHA256_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define NGX_SHA256_LEN 32   /* 摘要长度 */
+#define NGX_SHA256_BLOCK 64 /* 分组长度 */
+
+/*
+ * SHA-256 按 FIPS 180-4 逐组计算，对象就是一次计算的上下文，可以拷贝
+ *   Pbkdf2 把 HMAC 的内外两层先各吸收一组密钥，每一轮拷贝上下文接着算，
+ *   一轮只做两次压缩
+ */
+class CSHA256 {
+ public:
+  CSHA256() { Init(); }
+
+  void Init();                                           /* 重新开始 */
+  void Update(const unsigned char *pData, size_t iLen);  /* 接着吸收 */
+  void Final(unsigned char *pDigest); /* 输出 NGX_SHA256_LEN 字节 */
+
+  static void Pbkdf2(const char *password, size_t iPassLen,
+                     const unsigned char *salt, size_t iSaltLen,
+                     uint32_t iRounds, unsigned char *pOut,
+                     size_t iOutLen); /* 密码派生 */
+
+ private:
+  void Transform(const unsigned char *pBlock); /* 压缩一组 */
+
+  uint32_t m_state[8];                   /* 中间哈希值 */
+  uint64_t m_iLen;                       /* 已吸收的字节数 */
+  unsigned char m_buf[NGX_SHA256_BLOCK]; /* 不满一组的尾巴 */
+};
+
+#endif
@@ -11,7 +11,9 @@
 
 #include <ctime>
 
+#include "ngx_c_coroutine.h"
 #include "ngx_c_socket.h"
+#include "ngx_logiccomm.h"
 
 class CLogicSocket : public CSocket {
  public:
@@ -21,16 +23,54 @@ class CLogicSocket : public CSocket {
   virtual bool Initialize() override;
   virtual void threadRecvProcFunc(char *pMsgBuf) override;
 
-  bool _HandleRegister(lpngx_connection_t pConn, LPSTRUC_MSG_HEADER pMsgHeader,
-                       char *pPkgBody, unsigned short size); /* 注册业务 */
+  CCoTask _HandleRegister(lpngx_connection_t pConn, STRUC_MSG_HEADER msgHeader,
+                          STRUCT_REGISTER body); /* 注册业务 等注册日志落盘 */
   bool _HandleLogIn(lpngx_connection_t pConn, LPSTRUC_MSG_HEADER pMsgHeader,
-                    char *pPkgBody, unsigned short size); /* 登录业务 */
-  bool _HandlePing(lpngx_connection_t pConn, LPSTRUC_MSG_HEADER pMsgHeader,
-                   char *pPkgBody, unsigned short size); /* 心跳包业务 */
+                    LPSTRUCT_LOGIN pBody); /* 登录业务 */
+  bool _HandlePing(lpngx_connection_t pConn,
+                   LPSTRUC_MSG_HEADER pMsgHeader); /* 心跳包业务 */
+  bool _HandleNotice(lpngx_connection_t pConn, LPSTRUC_MSG_HEADER pMsgHeader,
+                     char *pPkgBody,
+                     unsigned short iBodyLength); /* 公告 广播给所有人 */
+  bool _HandleChecksum(lpngx_connection_t pConn, LPSTRUC_MSG_HEADER pMsgHeader,
+                       LPSTRUCT_CHECKSUM pBody); /* 协商校验方式 */
+  bool _HandleResume(lpngx_connection_t pConn, LPSTRUC_MSG_HEADER pMsgHeader,
+                     LPSTRUCT_SESSION pBody); /* 凭令牌恢复登录 */
+  bool _HandleBatch(lpngx_connection_t pConn, LPSTRUC_MSG_HEADER pMsgHeader,
+                    char *pPkgBody,
+                    unsigned short iBodyLength); /* 批量包 */
+  bool _HandleFraming(lpngx_connection_t pConn, LPSTRUC_MSG_HEADER pMsgHeader,
+                      LPSTRUCT_FRAMING pBody); /* 协商包头格式 */
+  bool _HandleUpload(lpngx_connection_t pConn, LPSTRUC_MSG_HEADER pMsgHeader,
+                     char *pChunk,
+                     unsigned short iChunkLength); /* 上传 每块调一次 */
   virtual void procPingTimeOutChecking(
       LPSTRUC_MSG_HEADER tmpmsg, time_t cur_time) override; /* 心跳包时间逻辑 */
+  virtual int getSendPrio(
+      unsigned short iMsgCode) override; /* 消息码对应发送优先级 */
+  virtual void sendServerBusy(
+      LPSTRUC_MSG_HEADER pMsgHeader) override; /* 回复服务器忙 */
+  virtual int getRecvClass(
+      unsigned short iMsgCode) override; /* 消息码调度类别 */
+  virtual int getRecvQuota(
+      unsigned short iMsgCode) override; /* 消息码并发上限 */
+  virtual bool getRecvInline(
+      unsigned short iMsgCode) override; /* 消息码是否在epoll线程处理 */
+  virtual bool getRecvChunked(
+      unsigned short iMsgCode) override; /* 消息码的包体是否分块交付 */
+  pthread_mutex_t *getLogicMutex(
+      lpngx_connection_t pConn); /* 业务处理用的连接互斥量 */
   void SendNoBodyPkgToClient(LPSTRUC_MSG_HEADER pMsgHeader,
                              unsigned short iMsgCode); /* 发送无包体的数据包 */
+  void SendLoginToClient(LPSTRUC_MSG_HEADER pMsgHeader,
+                         unsigned short iMsgCode, const char *username,
+                         const unsigned char *pToken); /* 发送登录成功 */
+  void SendFailedToClient(LPSTRUC_MSG_HEADER pMsgHeader,
+                          unsigned short iMsgCode,
+                          int iReason); /* 发送注册/登录失败 */
+
+ private:
+  int m_iBatchMaxItems; /* 一个批量包最多几个子消息 */
 };
 
 #endif
\ No newline at end of file
@@ -10,7 +10,6 @@
 #define __NGX_C_SOCKET_H__
 
 #include <pthread.h>
-#include <semaphore.h>
 #include <sys/epoll.h>
 #include <sys/socket.h>
 
@@ -21,23 +20,73 @@
 #include <vector>
 
 #include "ngx_c_memory.h"
+#include "ngx_c_ringbuffer.h"
 #include "ngx_comm.h"
 
 #define NGX_LISTEN_BACKLOG 511 /* 监听维护队列 */
 #define NGX_MAX_EVENTS 512     /* wait 最多返回的fd数目 */
 
+// 发送队列优先级
+#define NGX_SEND_PRIO_AUTO -1 /* 按消息码决定 getSendPrio() */
+#define NGX_SEND_PRIO_HIGH 0  /* 控制类消息，比如心跳 */
+#define NGX_SEND_PRIO_BULK 1  /* 普通业务消息 */
+#define NGX_SEND_PRIO_LANES 2 /* 优先级队列数目 */
+#define NGX_SEND_EPOLL_RING 4096 /* epoll 线程发的回包先放这里 每个优先级一个 */
+
+// 发送线程唤醒状态
+#define NGX_SEND_WAKE_PENDING 1 /* 有新消息或有连接可写 */
+#define NGX_SEND_WAKE_PARKED 2  /* 发送线程阻塞在 eventfd 上 */
+
+// 收消息队列超过上限时的准入策略
+#define NGX_RECV_OVERLOAD_DROP 0  /* 丢掉新来的包 */
+#define NGX_RECV_OVERLOAD_PAUSE 1 /* 暂停读积压最多的连接 */
+#define NGX_RECV_OVERLOAD_BUSY 2  /* 丢掉并回复服务器忙 */
+#define NGX_RECV_OVERLOAD_N 3     /* 策略数目 */
+
+// 消息处理结果 addRecvStat() 用
+#define NGX_MSG_OK 0          /* 处理成功 */
+#define NGX_MSG_ERR_SIZE 1    /* 包体长度和绑定的结构不符 */
+#define NGX_MSG_ERR_HANDLER 2 /* 处理函数返回失败 */
+#define NGX_MSG_ERR_NOCODE 3  /* 消息码没有绑定处理函数 */
+#define NGX_MSG_ERR_CRC 4     /* crc 校验失败 */
+
+// 分块交付的消息 消息头 iChunkFlags 的位
+#define NGX_CHUNK_STREAM 1 /* 这是分块交付的消息，普通消息为0 */
+#define NGX_CHUNK_LAST 2   /* 最后一块 */
+#define NGX_CHUNK_BADCRC 4 /* 最后一块才有：整个包体 crc 不对 */
+
+#define NGX_SEND_LAT_BUCKETS 24 /* 发送延迟直方图 第i格[2^i, 2^(i+1))微秒 */
+
 typedef struct ngx_listening_s ngx_listening_t, *lpngx_listening_t;
 typedef struct ngx_connection_s ngx_connection_t, *lpngx_connection_t;
 typedef class CSocket CSocket;
+struct CCoSendAwaiter;
 
 /* 函数指针 */
 typedef void (CSocket::*ngx_event_handler_pt)(lpngx_connection_t c);
 
+// tcp 参数模板 0 表示不设置用系统默认值
+typedef struct ngx_tcp_profile_s {
+  int nodelay;      /* TCP_NODELAY */
+  int quickack;     /* TCP_QUICKACK 每次收包后重新打开 */
+  int notsentlowat; /* TCP_NOTSENT_LOWAT 字节 */
+  int sndbuf;       /* SO_SNDBUF 字节 */
+  int rcvbuf;       /* SO_RCVBUF 字节 */
+  int fastopen;     /* TCP_FASTOPEN 队列长度 */
+  int usertimeout;  /* TCP_USER_TIMEOUT 毫秒 */
+} ngx_tcp_profile_t, *lpngx_tcp_profile_t;
+
 // 监听结构
 struct ngx_listening_s {
   int port;
   int fd;
   lpngx_connection_t connection;
+  ngx_tcp_profile_t profile; /* 该端口的 tcp 参数 */
+  int admin;                 /* 管理端口 可以发公告等 */
+  int csum;                  /* 新连接的校验方式 NGX_CSUM_* */
+  int csumAllow; /* 允许客户端协商的校验方式 按位 1 << NGX_CSUM_* */
+  int framingV2; /* 允许客户端协商成 v2 包头 */
+  unsigned int streamMax; /* 新连接分块接收的包体上限 */
 };
 
 // 连接体结构
@@ -52,10 +101,12 @@ struct ngx_connection_s {
   // 套接字
   int fd;                      /* 监听套接字 */
   lpngx_listening_t listening; /* 指向本连接的监听套接字 */
+  int iQuickAck; /* 收包后重新打开 TCP_QUICKACK 设置失败后清零不再试 */
 
   // 标记位
   unsigned instance : 1;  /* 失效标志位 1 有效 0 失效 */
   uint64_t iCurrsequence; /* 序号，每次分配加1 */
+  int iSlot;              /* 在连接池中的下标，不随回收复用变化 */
 
   // 网络地址
   struct sockaddr s_sockaddr; /* 保存对方地址 */
@@ -72,6 +123,16 @@ struct ngx_connection_s {
   char *precvbuf;                    /* 数据缓存区地址 */
   unsigned int irecvlen;             /* 数据缓存长度 */
   char *precvMemPointer;             /* 存放数据包内存地址 */
+  unsigned int iRecvCrc; /* 已收到的包体的CRC Sock_RecvCrcInline 开启时用 */
+  std::atomic<int> iCsumMode; /* 包头crc32字段的校验方式 NGX_CSUM_* */
+  int iFraming;               /* 收包的包头格式 NGX_FRAMING_* epoll线程改 */
+
+  // 分块接收 包体按块收，一块一个消息交给业务线程
+  unsigned int iStreamTotal;  /* 包体总长 0表示没有在分块接收 */
+  unsigned int iStreamOffset; /* 正在收的这一块在包体中的偏移 */
+  unsigned int iStreamCrc;    /* 已收到的包体的校验 */
+  unsigned int iStreamCrcWant; /* 包头里的校验 */
+  unsigned int iStreamMax;     /* 分块接收的包体上限 取自监听端口 */
 
   //和发包有关
   std::atomic<int> iThrowsendCount; /* 发送消息的epoll调用标记 */
@@ -80,7 +141,7 @@ struct ngx_connection_s {
   char *psendbuf; /* 发送数据的缓冲区的头指针其实是包头+包体 */
 
   time_t inRecyTime;   /* 连接池回收时间 */
-  time_t lastPingTime; /* 心跳包间隔 */
+  std::atomic<time_t> lastPingTime; /* 最近一次心跳时间 epoll线程写 */
 
   unsigned int isendlen; /* 要发送多少数据 */
 
@@ -92,12 +153,33 @@ struct ngx_connection_s {
 
   pthread_mutex_t logicPorcMutex;
   std::atomic<int> iSendCount;
+
+  std::atomic<bool> ifOnline; /* 已 accept 且未回收的客户端连接 */
+
+  // 收消息过载控制
+  std::atomic<int> iRecvQueued;  /* 已入收消息队列还没处理完的包数 */
+  std::atomic<bool> bRecvPaused; /* 因为过载暂停了读事件 */
 };
 
+// 广播消息共享内存块 [STRUC_SHARED_PKG][n个消息头][包头+包体]
+typedef struct _STRUC_SHARED_PKG {
+  std::atomic<int> iRefCount; /* 还在发送队列中的消息头数目 */
+  char *pPkg;                 /* 指向包头 */
+} STRUC_SHARED_PKG, *LPSTRUC_SHARED_PKG;
+
 // 消息头结构
 typedef struct _STRUC_MSG_HEADER {
-  lpngx_connection_t pConn; /* 记录对应连接 */
-  uint64_t iCurrsequence;   /* 记录序号 */
+  lpngx_connection_t pConn;       /* 记录对应连接 */
+  uint64_t iCurrsequence;         /* 记录序号 */
+  LPSTRUC_SHARED_PKG pSharedPkg; /* 广播消息共享包体 普通消息为空 */
+  uint64_t iEnqueueTime;          /* 进入发送/收消息队列时间 微秒 */
+  uint64_t iDeadline;             /* 过了这个时间就不发了 微秒 0不限 */
+  void *pSendWaiter; /* 等这条消息发完的协程 释放时恢复 一般为空 */
+  bool bCrcChecked;  /* 收包时已经校验过CRC 业务线程不用再算 */
+  int iCsumMode;     /* 收包时连接的校验方式 协商前后排队的包各按各的算 */
+  int iChunkFlags;            /* NGX_CHUNK_* 普通消息为0 */
+  unsigned int iChunkOffset;  /* 这一块在包体中的偏移 */
+  unsigned int iChunkTotal;   /* 包体总长 */
 } STRUC_MSG_HEADER, *LPSTRUC_MSG_HEADER;
 
 // 管理类
@@ -121,8 +203,37 @@ class CSocket {
 
   void printTDInfo(); /* 打印统计信息 */
 
+  static void freeSendMsg(char *pMsgBuf); /* 释放发送消息 */
+
+  virtual int getRecvClass(unsigned short iMsgCode); /* 消息码调度类别 */
+  virtual int getRecvQuota(unsigned short iMsgCode); /* 消息码并发上限 */
+  virtual bool getRecvInline(
+      unsigned short iMsgCode); /* 消息码是否在epoll线程直接处理 */
+  virtual bool getRecvChunked(
+      unsigned short iMsgCode); /* 消息码的包体是否分块交付 */
+  void recvMsgDone(char *pMsgBuf); /* 业务线程处理完一个收到的包 */
+
  protected:
-  void msgSend(char *pSendbuf);                      /* 推入发送队列 */
+  friend struct CCoSendAwaiter;
+
+  void msgSend(char *pSendbuf, int iPrio = NGX_SEND_PRIO_AUTO,
+               int iDeadlineMs = -1); /* 推入发送队列 */
+  CCoSendAwaiter coSend(char *pSendbuf, int iPrio = NGX_SEND_PRIO_AUTO);
+  /* 协程里推入发送队列，co_await 到发完 */
+  virtual int getSendPrio(unsigned short iMsgCode); /* 消息码对应优先级 */
+  virtual void sendServerBusy(
+      LPSTRUC_MSG_HEADER pMsgHeader); /* 过载时告诉客户端服务器忙 */
+  void addRecvStat(unsigned short iMsgCode, int iResult,
+                   uint64_t iUs); /* 记录消息码处理结果和耗时 */
+  void beginBatchReply(LPSTRUC_MSG_HEADER pMsgHeader,
+                       unsigned short iMsgCode); /* 开始攒本线程的回包 */
+  void endBatchReply(); /* 攒下的回包合成一个包发出去 */
+  int msgBroadcast(LPCOMM_PKG_HEADER pPkgHeader,
+                   lpngx_connection_t pExclude = nullptr,
+                   int iPrio = NGX_SEND_PRIO_AUTO); /* 广播给所有在线连接 */
+  int msgBroadcast(LPCOMM_PKG_HEADER pPkgHeader,
+                   const std::vector<STRUC_MSG_HEADER> &targets,
+                   int iPrio = NGX_SEND_PRIO_AUTO); /* 广播给指定连接 */
   void zdClosesocketProc(lpngx_connection_t p_Conn); /* 心跳包超时 */
 
   size_t m_iLenPkgHeader; /* 包头长度 */
@@ -150,6 +261,13 @@ class CSocket {
 
   bool setnonblocking(int fd); /* 设置非阻塞模式 */
 
+  void ngx_read_tcp_profile(int iport,
+                            lpngx_tcp_profile_t profile); /* 读端口模板 */
+  void ngx_set_listen_profile(int fd,
+                              lpngx_tcp_profile_t profile); /* 设置监听套接字 */
+  void ngx_set_accept_profile(int fd,
+                              lpngx_tcp_profile_t profile); /* 设置连接套接字 */
+
   void ReadConf(); /* 读配置文件 */
 
   void initConnection();                             /* 初始化连接池 */
@@ -178,6 +296,24 @@ class CSocket {
                                         bool &isflood); /* 接受包头的第一阶段 */
   void ngx_read_request_handler_proc_plast(
       lpngx_connection_t c, bool &isflood); /* 收到一个完整包后处理 */
+  void ngx_read_request_handler_proc_chunk(
+      lpngx_connection_t c, bool &isflood); /* 收完一块 */
+  char *allocRecvMsg(lpngx_connection_t c, unsigned short iMsgCode,
+                     unsigned int iBodyLen,
+                     int iCrc32); /* 分配收包内存 填好消息头和v1包头 */
+  char *allocRecvChunk(lpngx_connection_t c,
+                       unsigned short iMsgCode); /* 分配下一块 */
+  bool recvOverload(lpngx_connection_t c); /* 收消息队列满时的准入 */
+
+  unsigned int getRecvHeaderLen(lpngx_connection_t c) { /* 收包的包头长度 */
+    return (c->iFraming == NGX_FRAMING_V2) ? sizeof(COMM_PKG_HEADER_V2)
+                                           : m_iLenPkgHeader;
+  }
+  void resetRecvHeader(lpngx_connection_t c) { /* 准备收下一个包头 */
+    c->curStat = _PKG_HD_INIT;
+    c->precvbuf = c->dataHeadInfo;
+    c->irecvlen = getRecvHeaderLen(c);
+  }
 
   void ngx_write_request_handler(lpngx_connection_t pConn); /* 发消息回调函数 */
 
@@ -185,6 +321,15 @@ class CSocket {
                    ssize_t size); /* 发送数据 */
 
   void clearMsgSendQueue(); /* 清空发送队列 */
+  bool collectBatchReply(char *pSendbuf); /* 攒批量回包 攒了返回true */
+  void flushBatchReply();                 /* 攒下的先发出去 */
+
+  LPCOMM_PKG_HEADER getSendPkgHeader(char *pMsgBuf) { /* 发送消息的包头 */
+    LPSTRUC_MSG_HEADER pMsgHeader = (LPSTRUC_MSG_HEADER)pMsgBuf;
+    if (pMsgHeader->pSharedPkg != nullptr)
+      return (LPCOMM_PKG_HEADER)pMsgHeader->pSharedPkg->pPkg;
+    return (LPCOMM_PKG_HEADER)(pMsgBuf + m_iLenMsgHeader);
+  }
 
   void AddToTimerQueue(lpngx_connection_t pConn); /* 加入心跳队列 */
   time_t GetEarliestTime();                       /* 取连接 */
@@ -201,7 +346,14 @@ class CSocket {
 
   std::vector<ThreadItem *> m_threadVector; /* 线程容器*/
   pthread_mutex_t m_sendMessageQueueMutex;  /* 发消息队列互斥量 */
-  sem_t m_semEventSendQueue; /* 处理发消息线程相关的信号量 */
+  int m_sendEventFd;                 /* eventfd 唤醒睡眠中的发送线程 */
+  std::atomic<int> m_iSendWakeState; /* NGX_SEND_WAKE_* 位 */
+
+  void wakeSendThread();    /* 通知发送线程有活干 */
+  bool admitSend(char *pSendbuf, int &iPrio,
+                 int iDeadlineMs); /* 发送前检查积压，定优先级和期限 */
+  void drainEpollSend();    /* epoll 线程的回包挪进发送队列 */
+  bool parkSendThread();    /* 发送线程没活时睡眠 */
 
   std::list<lpngx_connection_t> m_connectionList;     /* 连接池链表 */
   std::list<lpngx_connection_t> m_freeconnectionList; /* 空闲连接池链表 */
@@ -232,8 +384,24 @@ class CSocket {
   static void *ServerSendQueueThread(void *threadData); /* 发送线程 */
   static void *ServerTimerQueueMonitorThread(void *threadData); /* 监视和处理 */
 
-  std::list<char *> m_MsgSendQueue;      /* 发送数据消息队列 */
+  std::list<char *> m_MsgSendQueue[NGX_SEND_PRIO_LANES]; /* 发送消息队列 */
+  CRingBuffer<char *> m_EpollSendRing[NGX_SEND_PRIO_LANES]; /* epoll 线程的回包 */
+  pthread_t m_epollThread; /* epoll 线程 它发的包不拿发送队列锁 */
   std::atomic<int> m_iSendMsgQueueCount; /* 发消息队列大小 */
+  std::atomic<int> m_iSendLaneCount[NGX_SEND_PRIO_LANES]; /* 各优先级队列大小 */
+  int m_iSendHighPrioBurst; /* 连续发多少高优先级消息后让普通消息发一条 */
+
+  int m_iSendDeadlineMs[NGX_MAX_MSGCODE]; /* 各消息码默认发送期限 毫秒 */
+  std::atomic<int> m_iSendExpiredCount[NGX_MAX_MSGCODE]; /* 各消息码过期丢弃数 */
+  std::atomic<int> m_iSendLatency[NGX_SEND_LAT_BUCKETS]; /* 入队到发送延迟直方图 */
+
+  void setSendDeadline(LPSTRUC_MSG_HEADER pMsgHeader, unsigned short iMsgCode,
+                       int iDeadlineMs); /* 填写入队时间和期限 */
+  void addSendLatency(uint64_t iEnqueueTime); /* 记录入队到发送的延迟 */
+  int msgBroadcastGroup(LPCOMM_PKG_HEADER pPkgHeader,
+                        const std::vector<STRUC_MSG_HEADER> &targets,
+                        int iCsumMode,
+                        int iPrio); /* 广播给校验方式相同的一组连接 */
 
   struct epoll_event
       m_events[NGX_MAX_EVENTS]; /* 用于在epoll_wait()中承载返回的所发生的事件 */
@@ -246,9 +414,27 @@ class CSocket {
   unsigned int m_floodTimeInterval; /* 收发数据包减隔 */
   int m_floodKickCount;             /* 累计多少次踢人 */
 
+  int m_iRecvQueueMax;       /* 收消息队列上限 0不限 */
+  int m_iRecvOverloadPolicy; /* 超过上限时的处理 NGX_RECV_OVERLOAD_* */
+  int m_iRecvPauseMin; /* 连接排队的包达到这个数才会被暂停读 */
+  pthread_mutex_t m_epollEventMutex; /* 多个线程修改同一连接的epoll事件 */
+  std::atomic<int> m_iRecvOverloadCount[NGX_RECV_OVERLOAD_N]; /* 各策略触发数 */
+  std::atomic<int> m_iRecvResumeCount; /* 暂停后恢复读的次数 */
+  int m_iRecvInlineCount; /* epoll线程直接处理的消息数 */
+  int m_iRecvCrcInline;   /* 包体边收边算CRC */
+  unsigned int m_iRecvChunkSize; /* 分块接收每块多大 */
+  unsigned int m_iRecvStreamMax; /* 分块接收的包体上限 端口没配时用 */
+  int m_iRecvStreamCount; /* 分块接收完的消息数 */
+  int m_iRecvChunkCount;  /* 分块接收交付的块数 */
+  std::atomic<int> m_iRecvCallCount[NGX_MAX_MSGCODE]; /* 各消息码处理次数 */
+  std::atomic<int> m_iRecvErrCount[NGX_MAX_MSGCODE]; /* 各消息码失败次数 */
+  std::atomic<uint64_t> m_iRecvLatencyUs[NGX_MAX_MSGCODE]; /* 各消息码累计耗时 */
+
   //统计用途
   time_t m_lastprintTime; /* 上次打印统计信息的时间(10秒钟打印一次) */
-  int m_iDiscardSendPkgCount; /* 丢弃的发送数据包数量 */
+  std::atomic<int> m_iDiscardSendPkgCount; /* 丢弃的发送数据包数量 */
+  std::atomic<int> m_iBroadcastCount; /* 广播次数 */
+  std::atomic<int> m_iBroadcastSkipCount; /* 广播时跳过的发送积压连接数 */
 };
 
 #endif
\ No newline at end of file
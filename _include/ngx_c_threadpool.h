@@ -10,11 +10,34 @@
 #define __NGX_C_THREADPOOL_H__
 
 #include <pthread.h>
+#include <stdint.h>
 
 #include <atomic>
+#include <deque>
 #include <list>
 #include <vector>
 
+#include "ngx_c_ringbuffer.h"
+#include "ngx_c_wsdeque.h"
+#include "ngx_comm.h"
+
+#define NGX_SCHED_SHARED 0 /* 所有线程共用一个队列 */
+#define NGX_SCHED_STEAL 1  /* 每个线程一个队列，闲的线程去偷 */
+#define NGX_SCHED_AFFINE 2 /* 每个线程一个队列，同一连接固定一个线程，不偷 */
+
+#define NGX_STEAL_PROBE 4 /* 无锁路径上随机探测几个线程的队列 */
+#define NGX_STEAL_REFILL 8 /* 一次从收件箱搬几条，大了后进先出乱序多 */
+
+#define NGX_RECV_BATCH_MAX 64 /* 每次最多取几条消息 */
+#define NGX_RECV_SCHED_MAX 256 /* 类别加权轮转表的最大长度 */
+
+typedef void (*ngx_pool_task_pt)(void *pArg); /* 投递给线程池的任务 */
+
+typedef struct {
+  ngx_pool_task_pt pHandler; /* 任务函数 */
+  void *pArg;                /* 任务参数 */
+} ngx_pool_task_t;
+
 class CThreadPool {
  public:
   CThreadPool();
@@ -24,39 +47,154 @@ class CThreadPool {
   void StopAll();             /* 停止线程池 */
   void Call();                /* 激发条件量 */
 
-  void inMsgRecvQueueAndSingal(char *buf); /* 加入业务队列 */
+  bool inMsgRecvQueueAndSingal(char *buf); /* 加入业务队列，满了返回 false */
+  void postTask(ngx_pool_task_pt pHandler, void *pArg,
+                int iSlot = -1); /* 投递任务，比如恢复协程 */
 
   int getRecvMsgQueueCount() {
     return m_iRecvMsgQueueCount;
   } /* 获取接收消息队列大小 */
+  int getRecvMsgFullCount() {
+    return m_iRecvMsgFullCount;
+  } /* 获取队列满拒绝入队的次数 */
+  int getSchedMode() { return m_iSchedMode; } /* 获取调度模式 */
+  int getStealCount() { return m_iStealCount; } /* 获取偷到的消息数 */
+  int getThreadNum() { return m_iThreadNUm; }   /* 获取当前线程数 */
+  int getThreadMin() { return m_iThreadMin; }   /* 获取最小线程数 */
+  int getThreadMax() { return m_iThreadMax; }   /* 获取最大线程数 */
+  int getGrowCount() { return m_iGrowCount; }   /* 获取扩容次数 */
+  int getShrinkCount() { return m_iShrinkCount; } /* 获取缩容线程数 */
+  int getSignalCount() { return m_iSignalCount; } /* 获取发信号次数 */
+  void getRecvClassStat(int iClass, int &iDepth,
+                        int &iWaitUs); /* 类别队列长度和平均排队时间 */
+  void resetRecvClassStat(); /* 清零类别排队时间，开始新的统计周期 */
+  int getQuotaDeferCount() {
+    return m_iQuotaDeferCount;
+  } /* 获取超出并发上限被推迟的消息数 */
+  int getRecvWaitUs() {
+    return (int)m_iLastRecvWaitUs;
+  } /* 获取上个统计周期平均排队时间 微秒 */
+  int getTaskCount() { return m_iTaskCount; } /* 获取执行过的任务数 */
 
  private:
   static void *ThreadFunc(void *threadData); /* 子线程入口函数 */
+  static void *AdjustThreadFunc(void *threadData); /* 动态调整线程数的线程 */
 
+  struct ThreadItem;
+
+  char *outMsgRecvQueue(ThreadItem *pItem,
+                        bool bFullScan); /* 取一条消息，没有返回 nullptr */
+  int outThreadQueue(ThreadItem *pItem, char **ppJobs,
+                     int iMax); /* affine 模式从自己的队列取 */
+  int outOwnDeque(ThreadItem *pItem, char **ppJobs,
+                  int iMax); /* steal 模式从自己的双端队列取 */
+  int outMsgRecvBatch(ThreadItem *pItem, char **ppJobs); /* 无锁批量取 */
+  char *stealMsgRecvQueue(ThreadItem *pItem, bool bFullScan); /* 偷别人的 */
+
+  void wakeOne();           /* 有线程在等就唤醒一个 */
   void clearMsgRecvQueue(); /* 清理消息队列 */
+  int runTasks(ThreadItem *pItem); /* 执行投递过来的任务 */
+
+  void initRecvClass(); /* 读取各消息码的类别、并发上限和类别权重 */
+  int popRecvRing(char **ppJobs, int iMax); /* 按类别加权从环形队列取 */
+  bool acquireQuota(int iCode, char *buf);  /* 占一个并发名额，满了推迟 */
+  char *releaseQuota(int iCode); /* 还名额，带回一条被推迟的消息 */
+
+  bool ifAdaptive() {
+    return m_iSchedMode == NGX_SCHED_SHARED && m_iThreadMin < m_iThreadMax;
+  } /* 是否动态调整线程数 */
+  void adjustThreadNum(); /* 按排队时间扩容 */
+  bool shrinkOne();       /* 空闲线程申请退出 */
+  void detachSelf(ThreadItem *pItem); /* 退出的线程摘掉自己 */
 
   struct ThreadItem {
     pthread_t _Handle;   /* 线程id */
     CThreadPool *_pThis; /* 线程池指针 */
     bool ifrunning;      /* 判断是否启动 */
-
-    ThreadItem(CThreadPool *pThis) : _pThis(pThis), ifrunning(false) {}
-    ~ThreadItem(){};
+    bool _bWaiting;      /* affine 模式正在 _queueCond 上等，_queueMutex 保护 */
+    int _index;          /* 线程编号，只增不减，固定线程数时就是容器下标 */
+    unsigned int _seed;  /* 偷取时随机选线程用 */
+
+    pthread_mutex_t _queueMutex;   /* 保护 _queue */
+    pthread_cond_t _queueCond;     /* affine 模式在自己队列上等 */
+    std::deque<char *> _queue;     /* 本线程的消息队列，affine 模式用 */
+    std::atomic<int> _iQueueSize;  /* _queue 大小，不加锁先看一眼 */
+    CRingBuffer<char *> _inbox;     /* steal 模式 epoll 线程投进来的，谁都能取 */
+    CWorkStealDeque<char *> _deque; /* steal 模式 从 _inbox 搬来的，可以被偷 */
+    std::deque<ngx_pool_task_t> _tasks; /* affine 模式投给本线程的任务 */
+    std::atomic<int> _iTaskSize;        /* _tasks 大小 */
+
+    ThreadItem(CThreadPool *pThis, int index)
+        : _pThis(pThis),
+          ifrunning(false),
+          _bWaiting(false),
+          _index(index),
+          _seed(index + 1),
+          _iQueueSize(0),
+          _iTaskSize(0) {
+      pthread_mutex_init(&_queueMutex, NULL);
+      pthread_cond_init(&_queueCond, NULL);
+    }
+    ~ThreadItem() {
+      pthread_cond_destroy(&_queueCond);
+      pthread_mutex_destroy(&_queueMutex);
+    };
   };
 
-  static pthread_mutex_t m_pthreadMutex; /* 互斥量 */
-  static pthread_cond_t m_pthreadCond;   /* 条件变量 */
+  static pthread_mutex_t m_pthreadMutex; /* 保护 m_TaskQueue */
+  static std::atomic<int> m_iWakeSeq;    /* 唤醒序号，空闲线程在上面 futex 等 */
   static bool m_shutdown;                /* 线程退出 */
 
-  int m_iThreadNUm;                     /* 线程池中线程数量 */
+  std::atomic<int> m_iThreadNUm;        /* 线程池中线程数量 */
+  int m_iThreadMin;                     /* 动态调整的下限 */
+  int m_iThreadMax;                     /* 动态调整的上限 */
+  int m_iWaitTargetUs;                  /* 排队时间超过这个值就扩容 */
+  int m_iIdleExitSec;                   /* 空闲多久的线程退出 */
+  uint64_t m_iAdjustIntervalUs;         /* 多久判断一次 */
+  std::atomic<uint64_t> m_iLastRecvWaitUs; /* 上个周期平均排队时间 */
+  std::atomic<uint64_t> m_iRecvWaitSum; /* 本周期排队时间总和 */
+  std::atomic<uint64_t> m_iRecvWaitCnt; /* 本周期出队消息数 */
+  std::atomic<int> m_iGrowCount;        /* 扩容次数 */
+  std::atomic<int> m_iShrinkCount;      /* 退出的线程数 */
+  int m_iNextIndex;                     /* 下一个新线程的编号 */
+  pthread_t m_adjustHandle;             /* 动态调整线程数的线程 */
+  bool m_bAdjustStarted;                /* 动态调整线程是否已启动 */
+  int m_iBatchNum;                      /* 每次最多取几条 */
+  int m_iSpinNum;                       /* 睡之前自旋几次 */
+  int m_iSchedMode;                     /* 调度模式 NGX_SCHED_* */
+  std::atomic<unsigned int> m_iNextThread; /* 轮询分发下标 */
+  std::atomic<int> m_iStealCount;       /* 偷到的消息数 */
   std::atomic<int> m_iRunningThreadNUm; /* 运行线程数 */
+  std::atomic<int> m_iWaitingThreadNum; /* 在 m_iWakeSeq 上等的线程数 */
+  std::atomic<int> m_iSignalCount;      /* 发信号次数 */
 
   time_t m_iLastEmgTime; /* 上次发生线程不够用的时间 */
 
   std::vector<ThreadItem *> m_threadVector; /* 线程容器 */
-
-  std::list<char *> m_MsgRecvQueue; /* 接受消息队列 */
-  int m_iRecvMsgQueueCount;         /* 收消息队列大小 */
+  pthread_mutex_t m_threadVectorMutex; /* 扩容和线程退出时改容器用 */
+  int m_iQueueCap; /* steal/affine 模式每个线程队列的容量 */
+
+  CRingBuffer<char *> m_MsgRecvRing[NGX_RECV_CLASS_N]; /* 各类别环形队列 */
+  std::atomic<int> m_iRecvMsgQueueCount; /* 收消息队列大小 */
+  std::atomic<int> m_iRecvMsgFullCount;  /* 队列满拒绝入队的次数 */
+
+  std::deque<ngx_pool_task_t> m_TaskQueue; /* 任务队列，m_pthreadMutex 保护 */
+  std::atomic<int> m_iTaskQueueSize;       /* 任务队列大小 */
+  std::atomic<int> m_iTaskCount;           /* 执行过的任务数 */
+
+  // 按消息码分类调度，只在 shared 模式使用
+  int m_iMsgClass[NGX_MAX_MSGCODE];        /* 消息码类别 */
+  int m_iMsgQuota[NGX_MAX_MSGCODE];        /* 消息码并发上限 0 不限 */
+  int m_iMsgRunning[NGX_MAX_MSGCODE];      /* 正在处理的数目，m_quotaMutex 保护 */
+  std::list<char *> m_QuotaDefer[NGX_MAX_MSGCODE]; /* 超出上限推迟的消息 */
+  pthread_mutex_t m_quotaMutex;            /* 并发上限互斥量 */
+  std::atomic<int> m_iQuotaDeferCount;     /* 推迟过的消息数 */
+
+  unsigned char m_iClassSched[NGX_RECV_SCHED_MAX]; /* 加权轮转表 */
+  int m_iClassSchedLen;                            /* 轮转表长度 */
+  std::atomic<unsigned int> m_iClassTick;          /* 轮转位置 */
+  std::atomic<uint64_t> m_iClassWaitSum[NGX_RECV_CLASS_N]; /* 类别排队时间 */
+  std::atomic<uint64_t> m_iClassWaitCnt[NGX_RECV_CLASS_N]; /* 类别出队数 */
 };
 
 #endif
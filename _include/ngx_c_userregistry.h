@@ -0,0 +1,130 @@
+/*
+ * @Author: agent
+ * @Date: 2026-10-19 15:40:56
+ * @Last Modified by: agent
+ * @Last Modified time: 2026-10-19 15:47:25
+ * @Description: 用户表 按用户名分片的开放寻址哈希表
+ */
+
+#ifndef __NGX_C_USERREGISTRY_H__
+#define __NGX_C_USERREGISTRY_H__
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+
+#define NGX_USER_NAME_LEN 56 /* 和 STRUCT_REGISTER 的 username 一样长 */
+#define NGX_USER_PASS_LEN 40 /* 和 STRUCT_REGISTER 的 password 一样长 */
+#define NGX_USER_SALT_LEN 16 /* 盐 每个用户随机生成 */
+#define NGX_USER_HASH_LEN 32 /* 密码摘要 PBKDF2-HMAC-SHA256 输出长度 */
+
+// 注册登录结果
+#define NGX_USER_OK 0       /* 成功 */
+#define NGX_USER_EXIST 1    /* 用户名已注册 */
+#define NGX_USER_FULL 2     /* 用户表满 */
+#define NGX_USER_NOTFOUND 3 /* 用户不存在 */
+#define NGX_USER_BADPASS 4  /* 密码错 */
+#define NGX_USER_IOERR 5    /* 注册日志写失败 */
+
+/* 密码凭据 只存加盐摘要不存明文，轮数跟着记录走，改配置不影响老用户 */
+typedef struct ngx_user_cred_s {
+  uint32_t iRounds; /* PBKDF2 轮数 */
+  unsigned char salt[NGX_USER_SALT_LEN];
+  unsigned char hash[NGX_USER_HASH_LEN];
+} ngx_user_cred_t, *lpngx_user_cred_t;
+
+/* 用户记录 定长槽位 */
+typedef struct ngx_user_slot_s {
+  uint32_t iHash;    /* 用户名哈希 0 表示空槽 */
+  uint32_t iUserId;  /* 用户编号 从1开始 0 表示注册被撤销 */
+  int iType;         /* 注册类型 */
+  char username[NGX_USER_NAME_LEN];
+  ngx_user_cred_t cred;
+} ngx_user_slot_t, *lpngx_user_slot_t;
+
+/* 一个分片 单独一把进程间共享的读写锁，独占缓存行免得相邻分片的锁互相干扰 */
+typedef struct alignas(64) ngx_user_shard_s {
+  pthread_rwlock_t lock;
+  lpngx_user_slot_t pSlots; /* 槽位数组 */
+  uint32_t iMask;           /* 槽位数 - 1 */
+  uint32_t iCount;          /* 已用槽位 */
+  uint32_t iLimit;          /* 装载上限 超过就不再插入 */
+} ngx_user_shard_t, *lpngx_user_shard_t;
+
+/* 共享内存开头 后面紧跟分片数组和槽位数组 */
+typedef struct alignas(64) ngx_user_shm_s {
+  std::atomic<uint32_t> iNextUserId; /* 下一个用户编号 所有 worker 共用 */
+  std::atomic<int> iCount;           /* 用户数 */
+} ngx_user_shm_t, *lpngx_user_shm_t;
+
+/*
+ * 用户表：用户名哈希选分片，分片内线性探测
+ *   master 在创建 worker 之前 mmap(MAP_SHARED)，所有 worker 共用一张表，
+ *   在哪个 worker 注册的都能在任何 worker 登录，用户编号也不会重复
+ *   容量启动时一次定好，不扩容不删除，内存 = 槽位数 * sizeof(ngx_user_slot_t)
+ *   撤销的注册只把编号清0，槽位留在探测链上，同名再注册时复用
+ *   只有同一分片的注册互斥，登录只加读锁
+ *   密码只存 PBKDF2 加盐摘要，摘要在锁外算
+ */
+class CUserRegistry {
+ private:
+  CUserRegistry();
+
+  static CUserRegistry *m_instance;
+
+  class GC_CUserRegistry {
+   public:
+    ~GC_CUserRegistry() {
+      delete CUserRegistry::m_instance;
+      CUserRegistry::m_instance = nullptr;
+    }
+  };
+
+ public:
+  ~CUserRegistry();
+
+  static CUserRegistry *GetInstance() {
+    if (m_instance == nullptr) {
+      m_instance = new CUserRegistry();
+      static GC_CUserRegistry gc;
+    }
+    return m_instance;
+  }
+
+  bool Create(int iCapacity, int iShardNum,
+              int iHashRounds); /* master 创建共享内存 */
+
+  int Register(const char *username, const char *password, int iType,
+               uint32_t *pUserId,
+               lpngx_user_cred_t pCred); /* 注册 返回凭据给注册日志 */
+  int Login(const char *username, const char *password,
+            uint32_t *pUserId); /* 校验用户名密码 */
+  void Unregister(const char *username,
+                  uint32_t iUserId); /* 撤销注册 注册日志没写成功时用 */
+  int Restore(const char *username, const ngx_user_cred_t &cred, int iType,
+              uint32_t iUserId); /* 恢复注册日志里的用户 多线程可同时调用 */
+
+  /* 用户数 */
+  int getCount() { return (m_pShm != nullptr) ? (int)m_pShm->iCount : 0; }
+  int getCapacity() { return m_iCapacity; } /* 槽位总数 */
+
+ private:
+  int Insert(const char *username, const ngx_user_cred_t &cred, int iType,
+             uint32_t iUserId, uint32_t *pUserId); /* 插入 编号为0时新分配 */
+  uint32_t Hash(const char *username, size_t *pLen); /* 用户名哈希 非0 */
+  lpngx_user_slot_t Find(lpngx_user_shard_t pShard, uint32_t iHash,
+                         const char *username, size_t iLen,
+                         bool *pEmpty); /* 分片内探测 */
+
+  lpngx_user_shm_t m_pShm;       /* 共享内存开头 */
+  lpngx_user_shard_t m_pShards; /* 分片数组 */
+  int m_iShardNum;              /* 分片数 2的幂 */
+  int m_iShardBits;             /* log2(分片数) */
+  int m_iCapacity;              /* 槽位总数 */
+  int m_iHashRounds;            /* 新注册用户的 PBKDF2 轮数 */
+  size_t m_iMemLen;             /* mmap 长度 */
+};
+
+#endif
@@ -0,0 +1,121 @@
+/*
+ * @Author: agent
+ * @Date: 2026-10-19 15:03:04
+ * @Last Modified by: agent
+ * @Last Modified time: 2026-10-19 15:03:04
+ * @Description: 有界无锁工作窃取双端队列(Chase-Lev)
+ */
+
+#ifndef __NGX_C_WSDEQUE_H__
+#define __NGX_C_WSDEQUE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+
+#include "ngx_c_ringbuffer.h"
+
+/*
+ * 只有拥有者线程在底部 Push/Pop，后进先出，热数据还在缓存里
+ * 其他线程在顶部 Steal，先进先出，偷走的是等得最久的
+ * 底部只有拥有者改，顶部靠 CAS 抢，只剩一个元素时拥有者和偷的一起 CAS 顶部
+ * 内存序按 Lê 等人给弱内存模型写的版本，容量固定不扩
+ */
+template <typename T>
+class CWorkStealDeque {
+ public:
+  CWorkStealDeque() : m_pCells(nullptr), m_iMask(0), m_iTop(0), m_iBottom(0) {}
+  ~CWorkStealDeque() { delete[] m_pCells; }
+
+  CWorkStealDeque(const CWorkStealDeque &) = delete;
+  CWorkStealDeque &operator=(const CWorkStealDeque &) = delete;
+
+  /*
+   * @ Description: 分配格子，容量向上取2的幂 只能在使用前调用一次
+   * @ Parameter: size_t capacity
+   * @ Return: bool
+   */
+  bool Init(size_t capacity) {
+    if (m_pCells != nullptr || capacity < 2) return false;
+    size_t size = 2;
+    while (size < capacity) size <<= 1;
+    m_pCells = new std::atomic<T>[size];
+    m_iMask = size - 1;
+    return true;
+  }
+
+  /*
+   * @ Description: 拥有者在底部放入
+   * @ Parameter: const T &data
+   * @ Return: bool 满了返回 false
+   */
+  bool Push(const T &data) {
+    int64_t b = m_iBottom.load(std::memory_order_relaxed);
+    int64_t t = m_iTop.load(std::memory_order_acquire);
+    if (b - t > (int64_t)m_iMask) return false;
+    m_pCells[b & m_iMask].store(data, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    m_iBottom.store(b + 1, std::memory_order_relaxed);
+    return true;
+  }
+
+  /*
+   * @ Description: 拥有者从底部取
+   * @ Parameter: T &data
+   * @ Return: bool 空了或者最后一个被偷走返回 false
+   */
+  bool Pop(T &data) {
+    int64_t b = m_iBottom.load(std::memory_order_relaxed) - 1;
+    m_iBottom.store(b, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t t = m_iTop.load(std::memory_order_relaxed);
+    if (t > b) { /* 空的，恢复底部 */
+      m_iBottom.store(b + 1, std::memory_order_relaxed);
+      return false;
+    }
+    data = m_pCells[b & m_iMask].load(std::memory_order_relaxed);
+    if (t == b) { /* 最后一个，和偷的抢 */
+      bool bWin = m_iTop.compare_exchange_strong(
+          t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+      m_iBottom.store(b + 1, std::memory_order_relaxed);
+      return bWin;
+    }
+    return true;
+  }
+
+  /*
+   * @ Description: 其他线程从顶部偷
+   * @ Parameter: T &data
+   * @ Return: bool 空了或者没抢过别人返回 false
+   */
+  bool Steal(T &data) {
+    int64_t t = m_iTop.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t b = m_iBottom.load(std::memory_order_acquire);
+    if (t >= b) return false;
+    data = m_pCells[t & m_iMask].load(std::memory_order_relaxed);
+    return m_iTop.compare_exchange_strong(
+        t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+  }
+
+  /* 大概的元素个数，只用于统计和判断要不要去偷 */
+  size_t Size() const {
+    int64_t b = m_iBottom.load(std::memory_order_relaxed);
+    int64_t t = m_iTop.load(std::memory_order_relaxed);
+    return (b > t) ? (size_t)(b - t) : 0;
+  }
+
+  size_t Capacity() const { return m_iMask + 1; }
+
+ private:
+  std::atomic<T> *m_pCells; /* 格子数组 */
+  size_t m_iMask;           /* 容量 - 1 */
+
+  /* 偷的线程改顶部，拥有者改底部，分开放在不同缓存行 */
+  alignas(NGX_CACHELINE_SIZE) std::atomic<int64_t> m_iTop;
+  alignas(NGX_CACHELINE_SIZE) std::atomic<int64_t> m_iBottom;
+  char m_pad[NGX_CACHELINE_SIZE - sizeof(std::atomic<int64_t>)];
+};
+
+#endif
@@ -20,6 +20,18 @@
 
 #define _DATA_BUFSIZE_ 20 /* 包头数据大小 */
 
+#define NGX_MAX_MSGCODE 64 /* 按消息码统计的数组大小 超出的记在最后一个 */
+
+// 收到的消息在业务线程池中的调度类别，数字小的权重高
+#define NGX_RECV_CLASS_HIGH 0   /* 心跳等轻量消息 */
+#define NGX_RECV_CLASS_NORMAL 1 /* 普通业务 */
+#define NGX_RECV_CLASS_BULK 2   /* 登录注册等重消息 */
+#define NGX_RECV_CLASS_N 3      /* 类别数目 */
+
+// 客户端发来的包用的包头格式 _CMD_FRAMING 协商，服务器发的包都是 v1
+#define NGX_FRAMING_V1 1 /* COMM_PKG_HEADER 16位长度 */
+#define NGX_FRAMING_V2 2 /* COMM_PKG_HEADER_V2 32位长度 */
+
 // 结构定义
 #pragma pack(1) /* 1字节对齐方式 */
 
@@ -31,6 +43,21 @@ typedef struct _COMM_PKG_HEADER {
   // uint8_t itest;
 } COMM_PKG_HEADER, *LPCOMM_PKG_HEADER;
 
+// v2 包头 分块接收的消息码包体可以超过 _PKG_MAX_LENGTH，不用整包缓存
+// 其他消息码整包缓存，和 v1 一样包体不能超过 _PKG_MAX_LENGTH-1000
+typedef struct _COMM_PKG_HEADER_V2 {
+  unsigned int pkgLen;    /* 报文总长度 含包头 */
+  unsigned short msgCode; /* 消息类型 */
+  unsigned short flags;   /* 保留 必须为0 */
+  int crc32;              /* 整个包体的 crc 校验 */
+} COMM_PKG_HEADER_V2, *LPCOMM_PKG_HEADER_V2;
+
+// 批量包里每个子消息的头 后面紧跟 iLen 字节子包体，回包也是同样格式
+typedef struct _COMM_BATCH_ITEM {
+  unsigned short iLen;    /* 子包体长度 不含这个头 */
+  unsigned short msgCode; /* 子消息类型 */
+} COMM_BATCH_ITEM, *LPCOMM_BATCH_ITEM;
+
 #pragma pack(0) /* 恢复默认配置 */
 
 #endif
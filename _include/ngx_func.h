@@ -1,6 +1,7 @@
 ﻿#ifndef __NGX_FUNC_H__
 #define __NGX_FUNC_H__
 
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 
@@ -35,5 +36,13 @@ int ngx_daemon();
 
 void ngx_process_events_and_timers();
 
+// 单调时钟 微秒
+uint64_t ngx_time_us();
+
+// worker 进程 cpu 绑定和 numa 内存策略
+void ngx_affinity_init(int inum);
+// 当前线程按角色绑定 cpu
+void ngx_affinity_bind_thread(int role);
+
 #define MYVER "1.2"
 #endif
\ No newline at end of file
@@ -14,6 +14,15 @@
 #define _CMD_PING _CMD_START + 0     /* 心跳包 */
 #define _CMD_REGISTER _CMD_START + 5 /* 注册 */
 #define _CMD_LOGIN _CMD_START + 6    /* 登录 */
+#define _CMD_NOTICE _CMD_START + 7   /* 公告 管理端口发来，广播给所有在线连接 */
+#define _CMD_SERVER_BUSY _CMD_START + 8 /* 服务器忙，只由服务器发出 */
+#define _CMD_CHECKSUM _CMD_START + 9 /* 协商包头crc32字段的校验方式 */
+#define _CMD_REGISTER_FAILED _CMD_START + 10 /* 注册失败，只由服务器发出 */
+#define _CMD_LOGIN_FAILED _CMD_START + 11    /* 登录失败，只由服务器发出 */
+#define _CMD_RESUME _CMD_START + 12 /* 凭令牌恢复登录，可以连到任何 worker */
+#define _CMD_BATCH _CMD_START + 13  /* 一个包带多个子消息 COMM_BATCH_ITEM */
+#define _CMD_FRAMING _CMD_START + 14 /* 协商客户端发来的包用哪种包头 */
+#define _CMD_UPLOAD _CMD_START + 15  /* 上传 包体可以很大，分块交给处理函数 */
 
 //结构定义------------------------------------
 #pragma pack(1)
@@ -31,6 +40,40 @@ typedef struct _STRUCT_LOGIN {
 
 } STRUCT_LOGIN, *LPSTRUCT_LOGIN;
 
+// 公告 包体是任意内容，原样广播；发起的连接收到的回包是这个
+typedef struct _STRUCT_NOTICE {
+  int iCount; /* 进入发送队列的连接数 */
+} STRUCT_NOTICE, *LPSTRUCT_NOTICE;
+
+// 客户端请求的校验方式 NGX_CSUM_*，服务器回同样的结构告诉最终用的方式
+// 服务器按旧方式校验这个包，回包和之后的包都按新方式
+typedef struct _STRUCT_CHECKSUM {
+  int iMode; /* 校验方式 */
+} STRUCT_CHECKSUM, *LPSTRUCT_CHECKSUM;
+
+// 注册/登录失败的原因 NGX_USER_*
+typedef struct _STRUCT_FAILED {
+  int iReason; /* 失败原因 */
+} STRUCT_FAILED, *LPSTRUCT_FAILED;
+
+// 会话令牌 登录成功的回包在 STRUCT_LOGIN 后面带上，_CMD_RESUME 发回来恢复登录
+// 恢复成功回包和登录成功一样
+typedef struct _STRUCT_SESSION {
+  unsigned char token[16]; /* 令牌 */
+} STRUCT_SESSION, *LPSTRUCT_SESSION;
+
+// 客户端请求的包头格式 NGX_FRAMING_*，服务器回包告诉最终用的格式
+// 服务器收完这个包就按新格式收，服务器发的包一直是 v1 包头
+typedef struct _STRUCT_FRAMING {
+  int iVersion; /* 包头格式 */
+} STRUCT_FRAMING, *LPSTRUCT_FRAMING;
+
+// 上传结果 收完最后一块回
+typedef struct _STRUCT_UPLOAD {
+  unsigned int iTotal; /* 收到的包体总长 */
+  int iResult;         /* 0 成功 1 crc 错 */
+} STRUCT_UPLOAD, *LPSTRUCT_UPLOAD;
+
 #pragma pack() /* 取消指定对齐，恢复缺省对齐 */
 
 #endif
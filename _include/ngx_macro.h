@@ -28,4 +28,13 @@
 #define NGX_PROCESS_MASTER 0
 #define NGX_PROCESS_WORKER 1
 
+// 线程角色，cpu 绑定用
+#define NGX_THREAD_REACTOR 0 // epoll 线程，即 worker 主线程
+#define NGX_THREAD_SENDER 1  // 发送线程
+#define NGX_THREAD_TIMER 2   // 定时器、连接回收和线程池调整线程
+#define NGX_THREAD_LOGIC 3   // 业务线程池
+#define NGX_THREAD_IO 4      // 协程的文件 IO 线程
+#define NGX_THREAD_JOURNAL 5 // 注册日志刷盘线程
+#define NGX_THREAD_ROLE_N 6
+
 #endif
\ No newline at end of file
@@ -0,0 +1,23 @@
+/*
+ * @Author: agent
+ * @Date: 2026-10-19 14:58:46
+ * @Last Modified by: agent
+ * @Last Modified time: 2026-10-19 14:58:46
+ * @Description: 时间相关函数
+ */
+
+#include <stdint.h>
+#include <time.h>
+
+#include "ngx_func.h"
+
+/*
+ * @ Description: 单调时钟 不受系统改时间影响 用来算间隔
+ * @ Parameter: void
+ * @ Return: uint64_t 微秒
+ */
+uint64_t ngx_time_us() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
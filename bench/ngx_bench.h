@@ -0,0 +1,66 @@
+/*
+ * @Author: agent
+ * @Date: 2026-10-19 15:01:54
+ * @Last Modified by: agent
+ * @Last Modified time: 2026-10-19 15:01:54
+ * @Description: 基准测试公用的计时、模拟处理和统计函数
+ */
+
+#ifndef __NGX_BENCH_H__
+#define __NGX_BENCH_H__
+
+#include <linux/futex.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <vector>
+
+/* 单调时钟 纳秒 */
+static inline uint64_t ngx_bench_now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* 自旋时让出流水线 */
+static inline void ngx_bench_pause() {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#else
+  __asm__ __volatile__("" ::: "memory");
+#endif
+}
+
+/* futex 等和唤醒 和 misc/ngx_c_threadpool.cpp 里的一样 */
+static inline void ngx_bench_futex_wait(std::atomic<int> *pAddr, int iVal) {
+  syscall(SYS_futex, (int *)pAddr, FUTEX_WAIT_PRIVATE, iVal, NULL, NULL, 0);
+}
+static inline void ngx_bench_futex_wake(std::atomic<int> *pAddr, int iNum) {
+  syscall(SYS_futex, (int *)pAddr, FUTEX_WAKE_PRIVATE, iNum, NULL, NULL, 0);
+}
+
+/* 模拟业务处理 空转 iLoop 次 */
+static inline void ngx_bench_work(int iLoop) {
+  for (int i = 0; i < iLoop; ++i) __asm__ __volatile__("" ::: "memory");
+}
+
+/* 百分位 会打乱 v 的顺序 */
+static inline uint64_t ngx_bench_percentile(std::vector<uint64_t> &v,
+                                            double p) {
+  if (v.empty()) return 0;
+  size_t k = (size_t)(p * (v.size() - 1));
+  std::nth_element(v.begin(), v.begin() + k, v.end());
+  return v[k];
+}
+
+/* 命令行第 i 个参数转整数，没有用默认值 */
+static inline int ngx_bench_arg(int argc, char **argv, int i, int iDefault) {
+  return (argc > i) ? atoi(argv[i]) : iDefault;
+}
+
+#endif
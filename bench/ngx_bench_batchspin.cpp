@@ -0,0 +1,133 @@
+/*
+ * @Author: agent
+ * @Date: 2026-10-19 15:07:36
+ * @Last Modified by: agent
+ * @Last Modified time: 2026-10-19 15:07:36
+ * @Description: ProcMsgRecvBatch/ProcMsgRecvSpin 基准
+ *   和 CThreadPool 一样的取法：无锁批量取，取不到自旋 Spin 次，
+ *   还取不到登记等待后 futex 睡；生产者有人等才 futex 唤醒
+ *   数 futex 等/唤醒的系统调用次数和进程的上下文切换次数
+ *   用法: batchspin [线程数 默认8] [消息数 默认200000] [每条空转次数 默认200]
+ */
+
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <sys/resource.h>
+
+#include <atomic>
+#include <vector>
+
+#include "ngx_bench.h"
+#include "ngx_c_ringbuffer.h"
+
+#define BENCH_BATCH_MAX 64 /* 和 NGX_RECV_BATCH_MAX 一样 */
+
+struct BenchRun {
+  CRingBuffer<char *> ring;
+  int iBatch;                 /* 一次最多取几条 */
+  int iSpin;                  /* 睡之前自旋几次 */
+  int iWork;                  /* 每条处理空转次数 */
+  std::atomic<int> iWaiting;  /* 在 iWakeSeq 上等的线程数 */
+  std::atomic<int> iWakeSeq;  /* 唤醒序号 */
+  std::atomic<bool> bStop;
+  std::atomic<int> iDone;     /* 处理完的条数 */
+  std::atomic<int> iWait;     /* futex 等的次数 */
+  std::atomic<int> iWake;     /* futex 唤醒的次数 */
+};
+
+static void *workerFunc(void *pArg) {
+  BenchRun *pRun = (BenchRun *)pArg;
+  char *jobs[BENCH_BATCH_MAX];
+  while (true) {
+    int n = (int)pRun->ring.PopBatch(jobs, pRun->iBatch);
+    for (int i = 0; n == 0 && i < pRun->iSpin; ++i) {
+      ngx_bench_pause();
+      n = (int)pRun->ring.PopBatch(jobs, pRun->iBatch);
+    }
+    while (n == 0 && !pRun->bStop) {
+      int iSeq = pRun->iWakeSeq.load();
+      ++pRun->iWaiting;
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      n = (int)pRun->ring.PopBatch(jobs, pRun->iBatch);
+      if (n == 0 && !pRun->bStop) {
+        ++pRun->iWait;
+        ngx_bench_futex_wait(&pRun->iWakeSeq, iSeq);
+      }
+      --pRun->iWaiting;
+    }
+    if (n == 0) break;
+    for (int i = 0; i < n; ++i) ngx_bench_work(pRun->iWork);
+    pRun->iDone += n;
+  }
+  return NULL;
+}
+
+/* 进程到目前为止的上下文切换次数 */
+static long contextSwitches() {
+  struct rusage ru;
+  getrusage(RUSAGE_SELF, &ru);
+  return ru.ru_nvcsw + ru.ru_nivcsw;
+}
+
+static void runOne(int iThreads, int iMsgs, int iWork, int iBatch,
+                   int iSpin) {
+  BenchRun *pRun = new BenchRun;
+  pRun->ring.Init(65536);
+  pRun->iBatch = iBatch;
+  pRun->iSpin = iSpin;
+  pRun->iWork = iWork;
+  pRun->iWaiting = 0;
+  pRun->iWakeSeq = 0;
+  pRun->bStop = false;
+  pRun->iDone = 0;
+  pRun->iWait = 0;
+  pRun->iWake = 0;
+  std::vector<pthread_t> tids(iThreads);
+  static char msg; /* 只看队列，消息内容无所谓 */
+
+  for (int i = 0; i < iThreads; ++i)
+    pthread_create(&tids[i], NULL, workerFunc, pRun);
+
+  long iCsw = contextSwitches();
+  uint64_t start = ngx_bench_now_ns();
+  for (int i = 0; i < iMsgs; ++i) {
+    while (!pRun->ring.Push(&msg)) ngx_bench_pause();
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (pRun->iWaiting > 0) {
+      ++pRun->iWakeSeq;
+      ngx_bench_futex_wake(&pRun->iWakeSeq, 1);
+      ++pRun->iWake;
+    }
+  }
+  while (pRun->iDone < iMsgs) ngx_bench_pause();
+  uint64_t elapsed = ngx_bench_now_ns() - start;
+  iCsw = contextSwitches() - iCsw;
+
+  pRun->bStop = true;
+  ++pRun->iWakeSeq;
+  ngx_bench_futex_wake(&pRun->iWakeSeq, INT_MAX);
+  for (int i = 0; i < iThreads; ++i) pthread_join(tids[i], NULL);
+
+  printf("%6d %6d %12.0f %10d %10d %12.3f %10ld\n", iBatch, iSpin,
+         iMsgs * 1e9 / elapsed, pRun->iWait.load(), pRun->iWake.load(),
+         (double)(pRun->iWait + pRun->iWake) / iMsgs, iCsw);
+  delete pRun;
+}
+
+int main(int argc, char **argv) {
+  int iThreads = ngx_bench_arg(argc, argv, 1, 8);
+  int iMsgs = ngx_bench_arg(argc, argv, 2, 200000);
+  int iWork = ngx_bench_arg(argc, argv, 3, 200);
+  static const int iBatch[] = {1, 4, 16, 64};
+  static const int iSpin[] = {0, 100, 1000};
+
+  printf("批量取/自旋 %d 个线程 %d 条 每条空转 %d 次\n", iThreads, iMsgs,
+         iWork);
+  printf("%6s %6s %12s %10s %10s %12s %10s\n", "batch", "spin", "msg/s",
+         "waits", "wakes", "calls/msg", "csw");
+  for (int b : iBatch) {
+    for (int s : iSpin) runOne(iThreads, iMsgs, iWork, b, s);
+  }
+  return 0;
+}
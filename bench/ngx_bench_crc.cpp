@@ -0,0 +1,103 @@
+/*
+ * @Author: agent
+ * @Date: 2026-10-19 15:34:14
+ * @Last Modified by: agent
+ * @Last Modified time: 2026-10-19 15:38:20
+ * @Description: CCRC32 吞吐基准
+ *   原来的 一次查一个字节
+ *   对比 现在的 Update_CRC(小于64字节 slice-by-16，否则 pclmul 折叠+查表收尾)
+ *   对比 Update_CRC32C 和 Copy_CRC(边拷贝边算)
+ *   每种长度先和逐字节的结果比一遍，不一致直接退出
+ *   用法: crc [每种长度总字节数 默认256MB]
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include <vector>
+
+#include "ngx_bench.h"
+#include "ngx_c_crc32.h"
+
+/* 原来的 Get_CRC 一次一个字节 */
+static unsigned int byteCrc(CCRC32 *pCrc, const unsigned char *buffer,
+                            unsigned int dwSize) {
+  unsigned int crc = 0xffffffff;
+  while (dwSize--)
+    crc = (crc >> 8) ^ pCrc->crc32_table[0][(crc & 0xFF) ^ *buffer++];
+  return crc ^ 0xffffffff;
+}
+
+/* 原来的 CRC32C 查表 */
+static unsigned int byteCrc32c(CCRC32 *pCrc, const unsigned char *buffer,
+                               unsigned int dwSize) {
+  unsigned int crc = 0xffffffff;
+  while (dwSize--)
+    crc = (crc >> 8) ^ pCrc->crc32c_table[(crc & 0xFF) ^ *buffer++];
+  return crc ^ 0xffffffff;
+}
+
+/* 按 iTotal 字节算 iLen 长的包，返回 MB/s，结果异或进 iSink 防止被优化掉 */
+template <typename F>
+static double runOne(unsigned int iLen, uint64_t iTotal, F fn,
+                     unsigned int &iSink) {
+  uint64_t iRound = iTotal / iLen;
+  if (iRound == 0) iRound = 1;
+  uint64_t start = ngx_bench_now_ns();
+  for (uint64_t i = 0; i < iRound; ++i) iSink ^= fn();
+  uint64_t elapsed = ngx_bench_now_ns() - start;
+  return (double)iRound * iLen * 1000.0 / elapsed; /* 字节/纳秒 * 1000 */
+}
+
+int main(int argc, char **argv) {
+  uint64_t iTotal = (uint64_t)ngx_bench_arg(argc, argv, 1, 256) << 20;
+  static const unsigned int iLens[] = {16,   48,   64,    256,  1024,
+                                       4096, 16384, 30000, 65536};
+  CCRC32 *pCrc = CCRC32::GetInstance();
+
+  /* 不从缓冲区开头算，看非对齐的情况 */
+  std::vector<unsigned char> src(65536 + 16), dst(65536 + 16);
+  unsigned int iSeed = 1;
+  for (size_t i = 0; i < src.size(); ++i)
+    src[i] = (unsigned char)rand_r(&iSeed);
+  const unsigned char *p = src.data() + 3;
+
+  for (unsigned int iLen : iLens) {
+    if (pCrc->Update_CRC(0, p, iLen) != byteCrc(pCrc, p, iLen) ||
+        pCrc->Update_CRC32C(0, p, iLen) != byteCrc32c(pCrc, p, iLen)) {
+      printf("长度 %u 结果和逐字节不一致\n", iLen);
+      return 1;
+    }
+    /* 分两段接着算要和整段一样 */
+    unsigned int iHalf = iLen / 2 + 1;
+    if (pCrc->Update_CRC(pCrc->Update_CRC(0, p, iHalf), p + iHalf,
+                         iLen - iHalf) != byteCrc(pCrc, p, iLen)) {
+      printf("长度 %u 分段结果不一致\n", iLen);
+      return 1;
+    }
+  }
+
+  printf("CRC 吞吐 MB/s 每种长度共 %llu MB 实现 %s\n",
+         (unsigned long long)(iTotal >> 20), pCrc->getImpl());
+  printf("%8s %10s %10s %10s %10s %10s %10s\n", "len", "byte", "crc32",
+         "speedup", "byte32c", "crc32c", "copy_crc");
+  unsigned int iSink = 0;
+  for (unsigned int iLen : iLens) {
+    double fByte = runOne(
+        iLen, iTotal / 8, [&] { return byteCrc(pCrc, p, iLen); }, iSink);
+    double fCrc = runOne(iLen, iTotal,
+                         [&] { return pCrc->Update_CRC(0, p, iLen); }, iSink);
+    double fByteC = runOne(
+        iLen, iTotal / 8, [&] { return byteCrc32c(pCrc, p, iLen); }, iSink);
+    double fCrcC = runOne(iLen, iTotal,
+                          [&] { return pCrc->Update_CRC32C(0, p, iLen); },
+                          iSink);
+    double fCopy = runOne(
+        iLen, iTotal,
+        [&] { return pCrc->Copy_CRC(0, dst.data() + 3, p, iLen); }, iSink);
+    printf("%8u %10.0f %10.0f %9.1fx %10.0f %10.0f %10.0f\n", iLen, fByte,
+           fCrc, fCrc / fByte, fByteC, fCrcC, fCopy);
+  }
+  printf("结果异或 %08x\n", iSink); /* 用上结果，循环不会被优化掉 */
+  return 0;
+}
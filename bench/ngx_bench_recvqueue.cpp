@@ -0,0 +1,279 @@
+/*
+ * @Author: agent
+ * @Date: 2026-10-19 15:01:54
+ * @Last Modified by: agent
+ * @Last Modified time: 2026-10-19 15:01:54
+ * @Description: 收消息队列基准
+ *   原来的 list+互斥量+条件变量(每次入队都加锁、都发信号)
+ *   对比 环形队列+有线程在等才加锁发条件变量信号
+ *   对比 现在的环形队列+futex 唤醒序号(入队和唤醒都不加锁)
+ *   一个生产者模拟 epoll 线程，8/64/256 个消费者模拟业务线程
+ *   用法: recvqueue [消息数 默认200000] [每条处理空转次数 默认200]
+ */
+
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+
+#include <atomic>
+#include <list>
+#include <vector>
+
+#include "ngx_bench.h"
+#include "ngx_c_ringbuffer.h"
+
+struct BenchMsg {
+  uint64_t iEnqueueTime; /* 入队时间 纳秒 */
+  int iIndex;            /* 下标，记排队时间用 */
+};
+
+/* 原来的实现 */
+class CListQueue {
+ public:
+  CListQueue() : m_stop(false), m_iSignal(0), m_iSleep(0) {
+    pthread_mutex_init(&m_mutex, NULL);
+    pthread_cond_init(&m_cond, NULL);
+  }
+  ~CListQueue() {
+    pthread_cond_destroy(&m_cond);
+    pthread_mutex_destroy(&m_mutex);
+  }
+  static const char *Name() { return "list+mutex"; }
+
+  bool Push(BenchMsg *pMsg) {
+    pthread_mutex_lock(&m_mutex);
+    m_queue.push_back(pMsg);
+    pthread_mutex_unlock(&m_mutex);
+    pthread_cond_signal(&m_cond);
+    ++m_iSignal;
+    return true;
+  }
+
+  int Pop(BenchMsg **ppMsg, int iMax) {
+    (void)iMax; /* 原来一次只取一条 */
+    pthread_mutex_lock(&m_mutex);
+    while (m_queue.empty() && !m_stop) {
+      ++m_iSleep;
+      pthread_cond_wait(&m_cond, &m_mutex);
+    }
+    int n = 0;
+    if (!m_queue.empty()) {
+      ppMsg[n++] = m_queue.front();
+      m_queue.pop_front();
+    }
+    pthread_mutex_unlock(&m_mutex);
+    return n;
+  }
+
+  void Stop() {
+    pthread_mutex_lock(&m_mutex);
+    m_stop = true;
+    pthread_cond_broadcast(&m_cond);
+    pthread_mutex_unlock(&m_mutex);
+  }
+  int getSignalCount() { return m_iSignal; }
+  int getSleepCount() { return m_iSleep; }
+
+ private:
+  pthread_mutex_t m_mutex;
+  pthread_cond_t m_cond;
+  std::list<BenchMsg *> m_queue;
+  bool m_stop;
+  int m_iSignal;
+  int m_iSleep; /* m_mutex 保护 */
+};
+
+/* 环形队列，有线程在等时拿锁发条件变量信号 */
+class CRingCondQueue {
+ public:
+  CRingCondQueue() : m_iWaiting(0), m_stop(false), m_iSignal(0), m_iSleep(0) {
+    pthread_mutex_init(&m_mutex, NULL);
+    pthread_cond_init(&m_cond, NULL);
+    m_ring.Init(65536);
+  }
+  ~CRingCondQueue() {
+    pthread_cond_destroy(&m_cond);
+    pthread_mutex_destroy(&m_mutex);
+  }
+  static const char *Name() { return "ring+cond"; }
+
+  bool Push(BenchMsg *pMsg) {
+    if (!m_ring.Push(pMsg)) return false;
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (m_iWaiting > 0) {
+      pthread_mutex_lock(&m_mutex);
+      pthread_cond_signal(&m_cond);
+      pthread_mutex_unlock(&m_mutex);
+      ++m_iSignal;
+    }
+    return true;
+  }
+
+  int Pop(BenchMsg **ppMsg, int iMax) {
+    (void)iMax; /* 环形队列一次取一条 */
+    int n = (int)m_ring.Pop(ppMsg[0]);
+    if (n > 0) return n;
+
+    pthread_mutex_lock(&m_mutex);
+    ++m_iWaiting;
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    while ((n = (int)m_ring.Pop(ppMsg[0])) == 0 && !m_stop) {
+      ++m_iSleep;
+      pthread_cond_wait(&m_cond, &m_mutex);
+    }
+    --m_iWaiting;
+    pthread_mutex_unlock(&m_mutex);
+    return n;
+  }
+
+  void Stop() {
+    pthread_mutex_lock(&m_mutex);
+    m_stop = true;
+    pthread_cond_broadcast(&m_cond);
+    pthread_mutex_unlock(&m_mutex);
+  }
+  int getSignalCount() { return m_iSignal; }
+  int getSleepCount() { return m_iSleep; }
+
+ private:
+  CRingBuffer<BenchMsg *> m_ring;
+  pthread_mutex_t m_mutex;
+  pthread_cond_t m_cond;
+  std::atomic<int> m_iWaiting;
+  bool m_stop;
+  std::atomic<int> m_iSignal;
+  std::atomic<int> m_iSleep;
+};
+
+/* 现在的实现，和 CThreadPool::wakeOne()/ThreadFunc() 的等待协议一样 不用锁 */
+class CRingFutexQueue {
+ public:
+  CRingFutexQueue()
+      : m_iWaiting(0), m_iWakeSeq(0), m_stop(false), m_iSignal(0), m_iSleep(0) {
+    m_ring.Init(65536);
+  }
+  static const char *Name() { return "ring+futex"; }
+
+  bool Push(BenchMsg *pMsg) {
+    if (!m_ring.Push(pMsg)) return false;
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (m_iWaiting > 0) {
+      ++m_iWakeSeq;
+      ngx_bench_futex_wake(&m_iWakeSeq, 1);
+      ++m_iSignal;
+    }
+    return true;
+  }
+
+  int Pop(BenchMsg **ppMsg, int iMax) {
+    (void)iMax; /* 环形队列一次取一条 */
+    int n = (int)m_ring.Pop(ppMsg[0]);
+    while (n == 0 && !m_stop) {
+      int iSeq = m_iWakeSeq.load();
+      ++m_iWaiting;
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      if ((n = (int)m_ring.Pop(ppMsg[0])) == 0 && !m_stop) {
+        ++m_iSleep;
+        ngx_bench_futex_wait(&m_iWakeSeq, iSeq);
+      }
+      --m_iWaiting;
+    }
+    return n;
+  }
+
+  void Stop() {
+    m_stop = true;
+    ++m_iWakeSeq;
+    ngx_bench_futex_wake(&m_iWakeSeq, INT_MAX);
+  }
+  int getSignalCount() { return m_iSignal; }
+  int getSleepCount() { return m_iSleep; }
+
+ private:
+  CRingBuffer<BenchMsg *> m_ring;
+  std::atomic<int> m_iWaiting;
+  std::atomic<int> m_iWakeSeq;
+  std::atomic<bool> m_stop;
+  std::atomic<int> m_iSignal;
+  std::atomic<int> m_iSleep;
+};
+
+template <typename Q>
+struct BenchRun {
+  Q queue;
+  int iWork;                     /* 每条处理空转次数 */
+  std::atomic<int> iDone;        /* 处理完的条数 */
+  std::vector<uint64_t> lat;     /* 每条的排队时间 */
+};
+
+template <typename Q>
+static void *consumerFunc(void *pArg) {
+  BenchRun<Q> *pRun = (BenchRun<Q> *)pArg;
+  BenchMsg *msgs[1];
+  int n;
+  while ((n = pRun->queue.Pop(msgs, 1)) > 0) {
+    uint64_t now = ngx_bench_now_ns();
+    for (int i = 0; i < n; ++i) {
+      pRun->lat[msgs[i]->iIndex] = now - msgs[i]->iEnqueueTime;
+      ngx_bench_work(pRun->iWork);
+    }
+    pRun->iDone += n;
+  }
+  return NULL;
+}
+
+template <typename Q>
+static void runOne(int iThreads, int iMsgs, int iWork) {
+  BenchRun<Q> *pRun = new BenchRun<Q>;
+  pRun->iWork = iWork;
+  pRun->iDone = 0;
+  pRun->lat.assign(iMsgs, 0);
+  std::vector<BenchMsg> msgs(iMsgs);
+  std::vector<pthread_t> tids(iThreads);
+
+  for (int i = 0; i < iThreads; ++i)
+    pthread_create(&tids[i], NULL, consumerFunc<Q>, pRun);
+
+  int iFull = 0;
+  uint64_t iPushNs = 0;
+  uint64_t start = ngx_bench_now_ns();
+  for (int i = 0; i < iMsgs; ++i) {
+    msgs[i].iIndex = i;
+    msgs[i].iEnqueueTime = ngx_bench_now_ns();
+    while (!pRun->queue.Push(&msgs[i])) { /* 只在环形队列满时重试 */
+      ++iFull;
+      ngx_bench_pause();
+    }
+    iPushNs += ngx_bench_now_ns() - msgs[i].iEnqueueTime;
+  }
+  while (pRun->iDone < iMsgs) ngx_bench_pause();
+  uint64_t elapsed = ngx_bench_now_ns() - start;
+
+  pRun->queue.Stop();
+  for (int i = 0; i < iThreads; ++i) pthread_join(tids[i], NULL);
+
+  uint64_t p50 = ngx_bench_percentile(pRun->lat, 0.50);
+  uint64_t p99 = ngx_bench_percentile(pRun->lat, 0.99);
+  printf("%-12s %7d %12.0f %10.1f %10.1f %10.1f %10d %10d %8d\n", Q::Name(),
+         iThreads, iMsgs * 1e9 / elapsed, (double)iPushNs / iMsgs,
+         p50 / 1000.0, p99 / 1000.0, pRun->queue.getSignalCount(),
+         pRun->queue.getSleepCount(), iFull);
+  delete pRun;
+}
+
+int main(int argc, char **argv) {
+  int iMsgs = ngx_bench_arg(argc, argv, 1, 200000);
+  int iWork = ngx_bench_arg(argc, argv, 2, 200);
+  static const int iThreads[] = {8, 64, 256};
+
+  printf("收消息队列 %d 条 每条空转 %d 次\n", iMsgs, iWork);
+  printf("%-12s %7s %12s %10s %10s %10s %10s %10s %8s\n", "queue",
+         "threads", "msg/s", "push ns", "p50 us", "p99 us", "signals",
+         "sleeps", "full");
+  for (int t : iThreads) {
+    runOne<CListQueue>(t, iMsgs, iWork);
+    runOne<CRingCondQueue>(t, iMsgs, iWork);
+    runOne<CRingFutexQueue>(t, iMsgs, iWork);
+  }
+  return 0;
+}
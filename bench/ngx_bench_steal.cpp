@@ -0,0 +1,262 @@
+/*
+ * @Author: agent
+ * @Date: 2026-10-19 15:03:04
+ * @Last Modified by: agent
+ * @Last Modified time: 2026-10-19 15:03:04
+ * @Description: steal 调度模式排队尾延迟基准
+ *   原来的 每线程 std::deque+互斥量，自己和偷的都从头部取
+ *   对比 现在的 每线程无锁收件箱+Chase-Lev 双端队列
+ *   一个生产者按固定间隔轮询投递，1% 的消息是长任务，
+ *   看长任务卡住线程时排在它后面的消息要等多久
+ *   用法: steal [消息数 默认100000] [投递间隔纳秒 默认5000]
+ *              [短任务空转次数 默认100] [长任务空转次数 默认100000]
+ */
+
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+
+#include <atomic>
+#include <deque>
+#include <vector>
+
+#include "ngx_bench.h"
+#include "ngx_c_ringbuffer.h"
+#include "ngx_c_wsdeque.h"
+
+#define BENCH_PROBE 4   /* 和 NGX_STEAL_PROBE 一样 */
+#define BENCH_REFILL 8  /* 和 NGX_STEAL_REFILL 一样 */
+
+struct BenchMsg {
+  uint64_t iEnqueueTime; /* 入队时间 纳秒 */
+  int iIndex;            /* 下标，记排队时间用 */
+  int iWork;             /* 处理空转次数 */
+};
+
+/* 原来的实现 */
+class CMutexDeques {
+ public:
+  static const char *Name() { return "deque+mutex"; }
+  ~CMutexDeques() {
+    for (size_t i = 0; i < m_items.size(); ++i) {
+      pthread_mutex_destroy(&m_items[i]->mutex);
+      delete m_items[i];
+    }
+  }
+  void Init(int iThreads, int iCap) {
+    (void)iCap;
+    for (int i = 0; i < iThreads; ++i) {
+      Item *pItem = new Item;
+      pthread_mutex_init(&pItem->mutex, NULL);
+      pItem->iSize = 0;
+      m_items.push_back(pItem);
+    }
+  }
+  bool Push(int i, BenchMsg *pMsg) {
+    Item *pItem = m_items[i];
+    pthread_mutex_lock(&pItem->mutex);
+    pItem->queue.push_back(pMsg);
+    ++pItem->iSize;
+    pthread_mutex_unlock(&pItem->mutex);
+    return true;
+  }
+  bool PopOwn(int i, BenchMsg *&pMsg) { return popFront(m_items[i], pMsg); }
+  bool Steal(int i, BenchMsg *&pMsg) { return popFront(m_items[i], pMsg); }
+
+ private:
+  struct Item {
+    pthread_mutex_t mutex;
+    std::deque<BenchMsg *> queue;
+    std::atomic<int> iSize;
+  };
+  bool popFront(Item *pItem, BenchMsg *&pMsg) {
+    if (pItem->iSize == 0) return false;
+    bool bOk = false;
+    pthread_mutex_lock(&pItem->mutex);
+    if (!pItem->queue.empty()) {
+      pMsg = pItem->queue.front();
+      pItem->queue.pop_front();
+      --pItem->iSize;
+      bOk = true;
+    }
+    pthread_mutex_unlock(&pItem->mutex);
+    return bOk;
+  }
+  std::vector<Item *> m_items;
+};
+
+/* 现在的实现，和 CThreadPool::outOwnDeque()/stealMsgRecvQueue() 一样 */
+class CChaseLevDeques {
+ public:
+  static const char *Name() { return "chase-lev"; }
+  ~CChaseLevDeques() {
+    for (size_t i = 0; i < m_items.size(); ++i) delete m_items[i];
+  }
+  void Init(int iThreads, int iCap) {
+    for (int i = 0; i < iThreads; ++i) {
+      Item *pItem = new Item;
+      pItem->inbox.Init(iCap);
+      pItem->deque.Init(BENCH_REFILL);
+      m_items.push_back(pItem);
+    }
+  }
+  bool Push(int i, BenchMsg *pMsg) { return m_items[i]->inbox.Push(pMsg); }
+  bool PopOwn(int i, BenchMsg *&pMsg) {
+    Item *pItem = m_items[i];
+    if (pItem->deque.Pop(pMsg)) return true;
+    int iRoom = (int)(pItem->deque.Capacity() - pItem->deque.Size());
+    if (iRoom > BENCH_REFILL) iRoom = BENCH_REFILL;
+    BenchMsg *pRefill;
+    for (int k = 0; k < iRoom && pItem->inbox.Pop(pRefill); ++k) {
+      if (pItem->deque.Push(pRefill)) continue;
+      if (!pItem->inbox.Push(pRefill)) {
+        pMsg = pRefill;
+        return true;
+      }
+      break;
+    }
+    return pItem->deque.Pop(pMsg);
+  }
+  bool Steal(int i, BenchMsg *&pMsg) {
+    return m_items[i]->deque.Steal(pMsg) || m_items[i]->inbox.Pop(pMsg);
+  }
+
+ private:
+  struct Item {
+    CRingBuffer<BenchMsg *> inbox;
+    CWorkStealDeque<BenchMsg *> deque;
+  };
+  std::vector<Item *> m_items;
+};
+
+template <typename Q>
+struct BenchRun {
+  Q queue;
+  int iThreads;
+  std::atomic<int> iWaiting;  /* 在 iWakeSeq 上等的线程数 */
+  std::atomic<int> iWakeSeq;  /* 唤醒序号 */
+  std::atomic<bool> bStop;
+  std::atomic<int> iDone;     /* 处理完的条数 */
+  std::atomic<int> iSteal;    /* 偷到的条数 */
+  std::vector<uint64_t> lat;  /* 每条的排队时间 */
+};
+
+template <typename Q>
+struct BenchWorker {
+  BenchRun<Q> *pRun;
+  int iIndex;
+  unsigned int iSeed;
+};
+
+/* 先取自己的，再偷 bFull 时全部看一遍 */
+template <typename Q>
+static bool takeOne(BenchWorker<Q> *pWorker, BenchMsg *&pMsg, bool bFull) {
+  BenchRun<Q> *pRun = pWorker->pRun;
+  if (pRun->queue.PopOwn(pWorker->iIndex, pMsg)) return true;
+  int iProbe = bFull ? pRun->iThreads : BENCH_PROBE;
+  for (int i = 0; i < iProbe; ++i) {
+    int iVictim = bFull ? (pWorker->iIndex + 1 + i) % pRun->iThreads
+                        : rand_r(&pWorker->iSeed) % pRun->iThreads;
+    if (iVictim == pWorker->iIndex) continue;
+    if (pRun->queue.Steal(iVictim, pMsg)) {
+      ++pRun->iSteal;
+      return true;
+    }
+  }
+  return false;
+}
+
+template <typename Q>
+static void *workerFunc(void *pArg) {
+  BenchWorker<Q> *pWorker = (BenchWorker<Q> *)pArg;
+  BenchRun<Q> *pRun = pWorker->pRun;
+  BenchMsg *pMsg;
+  while (true) {
+    bool bGot = takeOne(pWorker, pMsg, false);
+    while (!bGot && !pRun->bStop) { /* 和 ThreadFunc 的等待协议一样 */
+      int iSeq = pRun->iWakeSeq.load();
+      ++pRun->iWaiting;
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      bGot = takeOne(pWorker, pMsg, true);
+      if (!bGot && !pRun->bStop) ngx_bench_futex_wait(&pRun->iWakeSeq, iSeq);
+      --pRun->iWaiting;
+    }
+    if (!bGot) break;
+    pRun->lat[pMsg->iIndex] = ngx_bench_now_ns() - pMsg->iEnqueueTime;
+    ngx_bench_work(pMsg->iWork);
+    ++pRun->iDone;
+  }
+  return NULL;
+}
+
+template <typename Q>
+static void runOne(int iThreads, int iMsgs, int iGapNs, int iShort,
+                   int iLong) {
+  BenchRun<Q> *pRun = new BenchRun<Q>;
+  pRun->queue.Init(iThreads, 65536);
+  pRun->iThreads = iThreads;
+  pRun->iWaiting = 0;
+  pRun->iWakeSeq = 0;
+  pRun->bStop = false;
+  pRun->iDone = 0;
+  pRun->iSteal = 0;
+  pRun->lat.assign(iMsgs, 0);
+  std::vector<BenchMsg> msgs(iMsgs);
+  std::vector<BenchWorker<Q> > workers(iThreads);
+  std::vector<pthread_t> tids(iThreads);
+
+  for (int i = 0; i < iThreads; ++i) {
+    workers[i].pRun = pRun;
+    workers[i].iIndex = i;
+    workers[i].iSeed = i + 1;
+    pthread_create(&tids[i], NULL, workerFunc<Q>, &workers[i]);
+  }
+
+  uint64_t start = ngx_bench_now_ns();
+  for (int i = 0; i < iMsgs; ++i) {
+    while (ngx_bench_now_ns() < start + (uint64_t)i * iGapNs)
+      ngx_bench_pause();
+    msgs[i].iIndex = i;
+    msgs[i].iWork = (i % 100 == 0) ? iLong : iShort;
+    msgs[i].iEnqueueTime = ngx_bench_now_ns();
+    while (!pRun->queue.Push(i % iThreads, &msgs[i])) ngx_bench_pause();
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (pRun->iWaiting > 0) {
+      ++pRun->iWakeSeq;
+      ngx_bench_futex_wake(&pRun->iWakeSeq, 1);
+    }
+  }
+  while (pRun->iDone < iMsgs) ngx_bench_pause();
+
+  pRun->bStop = true;
+  ++pRun->iWakeSeq;
+  ngx_bench_futex_wake(&pRun->iWakeSeq, INT_MAX);
+  for (int i = 0; i < iThreads; ++i) pthread_join(tids[i], NULL);
+
+  uint64_t p50 = ngx_bench_percentile(pRun->lat, 0.50);
+  uint64_t p99 = ngx_bench_percentile(pRun->lat, 0.99);
+  uint64_t p999 = ngx_bench_percentile(pRun->lat, 0.999);
+  uint64_t pmax = ngx_bench_percentile(pRun->lat, 1.0);
+  printf("%-12s %7d %10.1f %10.1f %10.1f %10.1f %10d\n", Q::Name(), iThreads,
+         p50 / 1000.0, p99 / 1000.0, p999 / 1000.0, pmax / 1000.0,
+         pRun->iSteal.load());
+  delete pRun;
+}
+
+int main(int argc, char **argv) {
+  int iMsgs = ngx_bench_arg(argc, argv, 1, 100000);
+  int iGapNs = ngx_bench_arg(argc, argv, 2, 5000);
+  int iShort = ngx_bench_arg(argc, argv, 3, 100);
+  int iLong = ngx_bench_arg(argc, argv, 4, 100000);
+  static const int iThreads[] = {8, 64, 256};
+
+  printf("steal 模式排队时间 %d 条 间隔 %d 纳秒 空转 短/长(%d/%d) 长任务 1%%\n",
+         iMsgs, iGapNs, iShort, iLong);
+  printf("%-12s %7s %10s %10s %10s %10s %10s\n", "queue", "threads",
+         "p50 us", "p99 us", "p99.9 us", "max us", "steals");
+  for (int t : iThreads) {
+    runOne<CMutexDeques>(t, iMsgs, iGapNs, iShort, iLong);
+    runOne<CChaseLevDeques>(t, iMsgs, iGapNs, iShort, iLong);
+  }
+  return 0;
+}
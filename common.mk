@@ -3,11 +3,11 @@
 
 ifeq ($(DEBUG),true)
 #-g是生成调试信息。GNU调试器可以利用该信息
-CC = g++ -g -Wall -std=c++17
+CC = g++ -g -Wall -std=c++20
 # -fsanitize=address -fno-omit-frame-pointer
 VERSION = debug
 else
-CC = g++ -std=c++17
+CC = g++ -std=c++20
 VERSION = release
 endif
 
@@ -12,36 +12,107 @@
 
 #include <cstring>
 
+#include "ngx_c_conf.h"
 #include "ngx_c_crc32.h"
+#include "ngx_c_journal.h"
 #include "ngx_c_lockmutex.h"
+#include "ngx_c_msgbuilder.h"
+#include "ngx_c_msgregistry.h"
+#include "ngx_c_session.h"
+#include "ngx_c_userregistry.h"
 #include "ngx_func.h"
+#include "ngx_global.h"
 #include "ngx_logiccomm.h"
 #include "ngx_macro.h"
 
-/* 回调处理函数指针 */
-typedef bool (CLogicSocket::*handler)(lpngx_connection_t pConn,
-                                      LPSTRUC_MSG_HEADER pMsgHeader,
-                                      char *pPkgBody,
-                                      unsigned short iBodyLength);
-
-/* 回调函数类别 */
-static const handler statusHandler[] = {
-    &CLogicSocket::_HandlePing,     /* 下标0 */
-    nullptr,                        /* 下标1 */
-    nullptr,                        /* 下标2 */
-    nullptr,                        /* 下标3 */
-    nullptr,                        /* 下标4 */
-    &CLogicSocket::_HandleRegister, /* 下标5 */
-    &CLogicSocket::_HandleLogIn,    /* 下标6 */
+/* 注册包体解码：类型转本机序，防止客户端发送过来畸形包 */
+template <>
+struct ngx_msg_body<STRUCT_REGISTER> {
+  static void Decode(STRUCT_REGISTER &body) {
+    body.iType = ntohl(body.iType);
+    body.username[sizeof(body.username) - 1] = 0;
+    body.password[sizeof(body.password) - 1] = 0;
+  }
+};
+
+/* 注册包里的明文密码 算完摘要就清掉 */
+template <>
+struct ngx_msg_wipe<STRUCT_REGISTER> {
+  static void Wipe(STRUCT_REGISTER &body) {
+    explicit_bzero(body.password, sizeof(body.password));
+  }
+};
+
+/* 登录包体解码 */
+template <>
+struct ngx_msg_body<STRUCT_LOGIN> {
+  static void Decode(STRUCT_LOGIN &body) {
+    body.username[sizeof(body.username) - 1] = 0;
+    body.password[sizeof(body.password) - 1] = 0;
+  }
+};
+
+/* 登录包里的明文密码 校验完就清掉 */
+template <>
+struct ngx_msg_wipe<STRUCT_LOGIN> {
+  static void Wipe(STRUCT_LOGIN &body) {
+    explicit_bzero(body.password, sizeof(body.password));
+  }
 };
 
-/* 函数指针总数 编译期绑定 */
-#define AUTH_TOTAL_COMMANDS sizeof(statusHandler) / sizeof(handler)
+/* 协议里的令牌就是会话表的令牌 */
+static_assert(sizeof(STRUCT_SESSION::token) == NGX_SESSION_TOKEN_LEN,
+              "session token length mismatch");
+
+/* 校验方式协商包体解码 */
+template <>
+struct ngx_msg_body<STRUCT_CHECKSUM> {
+  static void Decode(STRUCT_CHECKSUM &body) { body.iMode = ntohl(body.iMode); }
+};
+
+/* 包头格式协商包体解码 */
+template <>
+struct ngx_msg_body<STRUCT_FRAMING> {
+  static void Decode(STRUCT_FRAMING &body) {
+    body.iVersion = ntohl(body.iVersion);
+  }
+};
+
+/* 消息码处理表 消息码、包体结构、处理函数、调度类别、并发上限、epoll线程处理
+ *   长度检查、解码和调用在编译期生成，按消息码下标直接取
+ *   广播要遍历所有连接，同时只让一个线程做 */
+typedef ngx_msg_table<
+    CLogicSocket,
+    ngx_msg_bind<CLogicSocket, _CMD_PING, void, &CLogicSocket::_HandlePing,
+                 NGX_RECV_CLASS_HIGH, 0, true>,
+    ngx_msg_bind<CLogicSocket, _CMD_REGISTER, STRUCT_REGISTER,
+                 &CLogicSocket::_HandleRegister, NGX_RECV_CLASS_BULK>,
+    ngx_msg_bind<CLogicSocket, _CMD_LOGIN, STRUCT_LOGIN,
+                 &CLogicSocket::_HandleLogIn, NGX_RECV_CLASS_BULK>,
+    ngx_msg_bind<CLogicSocket, _CMD_CHECKSUM, STRUCT_CHECKSUM,
+                 &CLogicSocket::_HandleChecksum, NGX_RECV_CLASS_HIGH, 0,
+                 true>,
+    ngx_msg_bind<CLogicSocket, _CMD_NOTICE, ngx_msg_raw,
+                 &CLogicSocket::_HandleNotice, NGX_RECV_CLASS_BULK, 1>,
+    ngx_msg_bind<CLogicSocket, _CMD_RESUME, STRUCT_SESSION,
+                 &CLogicSocket::_HandleResume, NGX_RECV_CLASS_HIGH, 0, true>,
+    ngx_msg_bind<CLogicSocket, _CMD_BATCH, ngx_msg_raw,
+                 &CLogicSocket::_HandleBatch, NGX_RECV_CLASS_BULK>,
+    ngx_msg_bind<CLogicSocket, _CMD_FRAMING, STRUCT_FRAMING,
+                 &CLogicSocket::_HandleFraming, NGX_RECV_CLASS_HIGH, 0, true>,
+    ngx_msg_bind<CLogicSocket, _CMD_UPLOAD, ngx_msg_chunk,
+                 &CLogicSocket::_HandleUpload, NGX_RECV_CLASS_BULK>>
+    ngx_logic_msg_table;
+
+static constexpr const auto &statusHandler = ngx_logic_msg_table::m_table;
+
+/* 处理表长度 编译期确定 */
+#define AUTH_TOTAL_COMMANDS ngx_logic_msg_table::N
 
 /*
  * @ Description: 构造函数
  */
-CLogicSocket::CLogicSocket() {}
+CLogicSocket::CLogicSocket() : m_iBatchMaxItems(64) {}
 
 /*
  * @ Description: 析构函数
@@ -54,6 +125,10 @@ CLogicSocket::~CLogicSocket() {}
  * @ Return: bool
  */
 bool CLogicSocket::Initialize() {
+  CConfig *p_config = CConfig::GetInstance();
+  m_iBatchMaxItems = p_config->GetIntDefault("Batch_MaxItems", m_iBatchMaxItems);
+  if (m_iBatchMaxItems < 1) m_iBatchMaxItems = 1;
+
   bool bParentInit = CSocket::Initialize();
   return bParentInit;
 }
@@ -71,36 +146,44 @@ void CLogicSocket::threadRecvProcFunc(char *pMsgBuf) {
   unsigned short pkglen =
       ntohs(pPkgHeader->pkgLen);  //客户端指明的包宽度【包头+包体】
 
+  unsigned short imsgCode = ntohs(pPkgHeader->msgCode);  //消息代码拿出来
+
   if (m_iLenPkgHeader == pkglen) {
     //没有包体，只有包头
-    if (pPkgHeader->crc32 != 0)  //只有包头的crc值给0
+    if (pMsgHeader->bCrcChecked == false &&
+        pPkgHeader->crc32 != 0)  //只有包头的crc值给0
     {
+      addRecvStat(imsgCode, NGX_MSG_ERR_CRC, 0);
       return;  // crc错，直接丢弃
     }
     pPkgBody = NULL;
   } else {
     //有包体，走到这里
-    pPkgHeader->crc32 =
-        ntohl(pPkgHeader->crc32);  //针对4字节的数据，网络序转主机序
     pPkgBody = (void *)(pMsgBuf + m_iLenMsgHeader +
                         m_iLenPkgHeader);  //跳过消息头 以及 包头 ，指向包体
+  }
+
+  //收包时已经边收边校验过的不用再算
+  if (pPkgBody != NULL && pMsgHeader->bCrcChecked == false) {
+    pPkgHeader->crc32 =
+        ntohl(pPkgHeader->crc32);  //针对4字节的数据，网络序转主机序
 
     //计算crc值判断包的完整性
-    int calccrc = CCRC32::GetInstance()->Get_CRC(
-        (unsigned char *)pPkgBody,
-        pkglen - m_iLenPkgHeader);  //计算纯包体的crc值
+    int calccrc = CCRC32::GetInstance()->Update_Csum(
+        pMsgHeader->iCsumMode, 0, (unsigned char *)pPkgBody,
+        pkglen - m_iLenPkgHeader);  //按连接的校验方式计算纯包体的crc值
     if (calccrc != pPkgHeader->crc32)
     //服务器端根据包体计算crc值，和客户端传递过来的包头中的crc32信息比较
     {
       ngx_log_stderr(
           0,
           "CLogicSocket::threadRecvProcFunc()中CRC错误，丢弃数据!");  //正式代码中可以干掉这个信息
+      addRecvStat(imsgCode, NGX_MSG_ERR_CRC, 0);
       return;  // crc错，直接丢弃
     }
   }
 
   //包crc校验OK才能走到这里
-  unsigned short imsgCode = ntohs(pPkgHeader->msgCode);  //消息代码拿出来
   lpngx_connection_t p_Conn =
       pMsgHeader->pConn;  //消息头中藏着连接池中连接的指针
 
@@ -114,141 +197,204 @@ void CLogicSocket::threadRecvProcFunc(char *pMsgBuf) {
   }
 
   //(2)判断消息码是正确的，防止客户端恶意侵害我们服务器，发送一个不在我们服务器处理范围内的消息码
-  if (imsgCode >= AUTH_TOTAL_COMMANDS)  //无符号数不可能<0
-  {
-    ngx_log_stderr(
-        0, "CLogicSocket::threadRecvProcFunc()中imsgCode=%d消息码不对!",
-        imsgCode);  //这种有恶意倾向或者错误倾向的包，希望打印出来看看是谁干的
-    return;         //丢弃不理这种包【恶意包或者错误包】
-  }
-
-  //能走到这里的，包没过期，不恶意，那好继续判断是否有相应的处理函数
   //(3)有对应的消息处理函数吗
-  if (statusHandler[imsgCode] ==
-      NULL)  //这种用imsgCode的方式可以使查找要执行的成员函数效率特别高
+  if (imsgCode >= AUTH_TOTAL_COMMANDS ||
+      statusHandler[imsgCode].pThunk ==
+          NULL)  //这种用imsgCode的方式可以使查找要执行的成员函数效率特别高
   {
     ngx_log_stderr(
         0,
         "CLogicSocket::threadRecvProcFunc()中imsgCode=%"
         "d消息码找不到对应的处理函数!",
         imsgCode);  //这种有恶意倾向或者错误倾向的包，希望打印出来看看是谁干的
-    return;         //没有相关的处理函数
+    addRecvStat(imsgCode, NGX_MSG_ERR_NOCODE, 0);
+    return;  //丢弃不理这种包【恶意包或者错误包】
   }
 
   //一切正确，可以放心大胆的处理了
-  //(4)调用消息码对应的成员函数来处理
-  (this->*statusHandler[imsgCode])(p_Conn, pMsgHeader, (char *)pPkgBody,
-                                   pkglen - m_iLenPkgHeader);
+  //(4)长度检查、解码、调用处理函数，协程版跑到第一个co_await就返回
+  uint64_t iStart = ngx_time_us();
+  int iRet = statusHandler[imsgCode].pThunk(this, p_Conn, pMsgHeader,
+                                            (char *)pPkgBody,
+                                            pkglen - m_iLenPkgHeader);
+  addRecvStat(imsgCode, iRet, ngx_time_us() - iStart);
   return;
 }
 
 /*
- * @ Description: 处理注册信息
+ * @ Description: 批量包 子消息逐个走处理表，回包合成一个 _CMD_BATCH 包
+ *   整个包只分配、校验、排队一次；子消息不能再是批量包
+ *   也不能是在epoll线程处理的(校验方式、包头格式只能在那里改)、
+ *   有并发上限的(会绕过配额)、分块交付的
+ *   子消息最多 Batch_MaxItems 个，多了后面的不处理
+ *   协程处理函数挂起之后才发的回包不在合并包里，单独发
  * @ Paramater: lpngx_connection_t pConn, LPSTRUC_MSG_HEADER pMsgHeader,
- * char *pPkgBody, unsigned short iBodyLength
- * @ Return: void
+ *   char *pPkgBody, unsigned short iBodyLength
+ * @ Return: bool(子消息格式不对返回false，前面的子消息已经处理)
  */
-bool CLogicSocket::_HandleRegister(lpngx_connection_t pConn,
-                                   LPSTRUC_MSG_HEADER pMsgHeader,
-                                   char *pPkgBody, unsigned short iBodyLength) {
-  if (pPkgBody == nullptr) return false;
+bool CLogicSocket::_HandleBatch(lpngx_connection_t pConn,
+                                LPSTRUC_MSG_HEADER pMsgHeader, char *pPkgBody,
+                                unsigned short iBodyLength) {
+  bool bOk = true;
+  beginBatchReply(pMsgHeader, _CMD_BATCH);
+
+  unsigned short iPos = 0;
+  int iItems = 0;
+  while (iPos < iBodyLength) {
+    if (++iItems > m_iBatchMaxItems ||
+        iBodyLength - iPos < (int)sizeof(COMM_BATCH_ITEM)) {
+      bOk = false;
+      break;
+    }
+    LPCOMM_BATCH_ITEM pItem = (LPCOMM_BATCH_ITEM)(pPkgBody + iPos);
+    unsigned short iLen = ntohs(pItem->iLen);
+    unsigned short iCode = ntohs(pItem->msgCode);
+    iPos += sizeof(COMM_BATCH_ITEM);
+    if (iLen > iBodyLength - iPos) {
+      bOk = false;
+      break;
+    }
+    char *pSubBody = (iLen > 0) ? pPkgBody + iPos : nullptr;
+    iPos += iLen;
+
+    if (iCode == _CMD_BATCH || iCode >= AUTH_TOTAL_COMMANDS ||
+        statusHandler[iCode].pThunk == nullptr ||
+        statusHandler[iCode].bInline || statusHandler[iCode].iQuota > 0 ||
+        statusHandler[iCode].bChunk) {
+      addRecvStat(iCode, NGX_MSG_ERR_NOCODE, 0);
+      continue;
+    }
+    uint64_t iStart = ngx_time_us();
+    int iRet =
+        statusHandler[iCode].pThunk(this, pConn, pMsgHeader, pSubBody, iLen);
+    addRecvStat(iCode, iRet, ngx_time_us() - iStart);
+  }
 
-  int iRecvLen = sizeof(STRUCT_REGISTER);
-  if (iRecvLen != iBodyLength) return false;
+  endBatchReply();
+  return bOk;
+}
 
-  CLock lock(&pConn->logicPorcMutex);
+/*
+ * @ Description: 业务处理要用的连接互斥量
+ *   affine 模式下同一连接的消息固定在一个线程上顺序执行，不用加锁
+ * @ Paramater: lpngx_connection_t pConn
+ * @ Return: pthread_mutex_t* 不用加锁时返回 nullptr
+ */
+pthread_mutex_t *CLogicSocket::getLogicMutex(lpngx_connection_t pConn) {
+  if (g_threadpool.getSchedMode() == NGX_SCHED_AFFINE) return nullptr;
+  return &pConn->logicPorcMutex;
+}
 
-  // 业务逻辑
-  LPSTRUCT_REGISTER p_RecvInfo = (LPSTRUCT_REGISTER)pPkgBody;
-  p_RecvInfo->iType = ntohl(p_RecvInfo->iType);
-  /* 防止客户端发送过来畸形包 */
-  p_RecvInfo->username[sizeof(p_RecvInfo->username) - 1] = 0;
-  p_RecvInfo->password[sizeof(p_RecvInfo->password) - 1] = 0;
+/*
+ * @ Description: 处理注册信息 长度和解码已经由处理表做完
+ *   协程版：写注册日志时挂起，按 JournalSync 落盘之后才回包，不占业务线程
+ *   连接锁只在同步的业务处理里拿，co_await 之前放掉
+ *   注册日志没写成功就撤销注册，内存里和磁盘上的用户表保持一致
+ * @ Paramater: lpngx_connection_t pConn, STRUC_MSG_HEADER msgHeader,
+ *   STRUCT_REGISTER body
+ * @ Return: CCoTask
+ */
+CCoTask CLogicSocket::_HandleRegister(lpngx_connection_t pConn,
+                                      STRUC_MSG_HEADER msgHeader,
+                                      STRUCT_REGISTER body) {
+  // 业务逻辑 用户表自己按分片加锁
+  // 明文密码算完摘要就清掉，协程帧里不留
+  uint32_t iUserId;
+  ngx_user_cred_t cred;
+  int iRet;
+  {
+    CLock lock(getLogicMutex(pConn));
+    iRet = CUserRegistry::GetInstance()->Register(
+        body.username, body.password, body.iType, &iUserId, &cred);
+  }
+  explicit_bzero(body.password, sizeof(body.password));
+  if (iRet == NGX_USER_OK) {
+    bool bDurable = co_await CUserJournal::GetInstance()->Append(
+        iUserId, body.iType, body.username, cred);
+    /* 没落盘重启后就没了，现在就撤销，不让客户端以为注册成功 */
+    if (!bDurable) {
+      CUserRegistry::GetInstance()->Unregister(body.username, iUserId);
+      iRet = NGX_USER_IOERR;
+    }
+  }
+  if (iRet != NGX_USER_OK) {
+    SendFailedToClient(&msgHeader, _CMD_REGISTER_FAILED, iRet);
+    co_return true;
+  }
   // ngx_log_error_core(NGX_LOG_DEBUG, 0,
   //                    "CLogicSocket::_HandleRegister() successful");
   // 业务处理结束
 
-  // 服务端回复消息
-  LPCOMM_PKG_HEADER pPkgHeader;
-  CMemory *p_memory = CMemory::GetInstance();
-  CCRC32 *p_crc32 = CCRC32::GetInstance();
-  int iSendLen = sizeof(STRUCT_REGISTER);
-
-  // iSendLen = 65000;
-
-  char *p_sendbuf = static_cast<char *>(p_memory->AllocMemory(
-      m_iLenMsgHeader + m_iLenPkgHeader + iSendLen, false));
-  memcpy(p_sendbuf, pMsgHeader, m_iLenMsgHeader);
-  pPkgHeader = (LPCOMM_PKG_HEADER)(p_sendbuf + m_iLenMsgHeader);
-  pPkgHeader->msgCode = _CMD_REGISTER;
-  pPkgHeader->msgCode = htons(pPkgHeader->msgCode);
-  pPkgHeader->pkgLen = htons(m_iLenPkgHeader + iSendLen);
-  LPSTRUCT_REGISTER p_sendInfo =
-      (LPSTRUCT_REGISTER)(p_sendbuf + m_iLenMsgHeader + m_iLenPkgHeader);
-  pPkgHeader->crc32 = p_crc32->Get_CRC((unsigned char *)p_sendInfo, iSendLen);
-  pPkgHeader->crc32 = htonl(pPkgHeader->crc32);
-
-  // ngx_log_error_core(NGX_LOG_DEBUG, 0,
-  //                    "CLogicSocket::_HandleRegister() begin to send data");
-  // send 先不写，防止泄漏
-  msgSend(p_sendbuf);
-  return true;
+  // 服务端回复消息 回类型和用户名，密码不回
+  CMsgBuilder reply(&msgHeader, _CMD_REGISTER, sizeof(STRUCT_REGISTER));
+  reply.PutInt32(body.iType);
+  reply.PutString(body.username, sizeof(body.username));
+  reply.PutZero(sizeof(body.password));
+  co_await coSend(reply.Finish());
+  co_return true;
 }
 
 /*
- * @ Description: 处理登录信息
+ * @ Description: 处理登录信息 长度和解码已经由处理表做完
  * @ Paramater: lpngx_connection_t pConn, LPSTRUC_MSG_HEADER pMsgHeader,
- * char *pPkgBody, unsigned short iBodyLength
- * @ Return: void
+ *   LPSTRUCT_LOGIN p_RecvInfo
+ * @ Return: bool
  */
 bool CLogicSocket::_HandleLogIn(lpngx_connection_t pConn,
-                                LPSTRUC_MSG_HEADER pMsgHeader, char *pPkgBody,
-                                unsigned short iBodyLength) {
-  if (pPkgBody == nullptr) return false;
+                                LPSTRUC_MSG_HEADER pMsgHeader,
+                                LPSTRUCT_LOGIN p_RecvInfo) {
+  CLock lock(getLogicMutex(pConn));
+
+  // 业务逻辑 用户表自己按分片加锁，连接锁只保证同一连接的消息按顺序处理
+  uint32_t iUserId;
+  int iRet = CUserRegistry::GetInstance()->Login(
+      p_RecvInfo->username, p_RecvInfo->password, &iUserId);
+  if (iRet != NGX_USER_OK) {
+    SendFailedToClient(pMsgHeader, _CMD_LOGIN_FAILED, iRet);
+    return true;
+  }
 
-  int iRecvLen = sizeof(STRUCT_LOGIN);
-  if (iRecvLen != iBodyLength) return false;
+  // 发会话令牌，会话表满了令牌全0，客户端只是不能凭令牌恢复
+  STRUCT_SESSION session;
+  if (!CSessionTable::GetInstance()->Open(p_RecvInfo->username, iUserId,
+                                          session.token))
+    memset(session.token, 0, sizeof(session.token));
 
-  CLock lock(&pConn->logicPorcMutex);
+  SendLoginToClient(pMsgHeader, _CMD_LOGIN, p_RecvInfo->username,
+                    session.token);
+  return true;
+}
 
-  // 业务逻辑
-  LPSTRUCT_LOGIN p_RecvInfo = (LPSTRUCT_LOGIN)pPkgBody;
-  p_RecvInfo->username[sizeof(p_RecvInfo->username) - 1] = 0;
-  p_RecvInfo->password[sizeof(p_RecvInfo->password) - 1] = 0;
+/*
+ * @ Description: 凭令牌恢复登录 只查共享内存不加锁，在epoll线程里执行
+ *   令牌可以是任何一个 worker 发的
+ * @ Paramater: lpngx_connection_t pConn, LPSTRUC_MSG_HEADER pMsgHeader,
+ *   LPSTRUCT_SESSION p_RecvInfo
+ * @ Return: bool
+ */
+bool CLogicSocket::_HandleResume(lpngx_connection_t,
+                                 LPSTRUC_MSG_HEADER pMsgHeader,
+                                 LPSTRUCT_SESSION p_RecvInfo) {
+  uint32_t iUserId;
+  char username[NGX_USER_NAME_LEN];
+  if (!CSessionTable::GetInstance()->Lookup(p_RecvInfo->token, &iUserId,
+                                            username)) {
+    SendFailedToClient(pMsgHeader, _CMD_LOGIN_FAILED, NGX_USER_NOTFOUND);
+    return true;
+  }
 
-  LPCOMM_PKG_HEADER pPkgHeader;
-  CMemory *p_memory = CMemory::GetInstance();
-  CCRC32 *p_crc32 = CCRC32::GetInstance();
-
-  int iSendLen = sizeof(STRUCT_LOGIN);
-  char *p_sendbuf = (char *)p_memory->AllocMemory(
-      m_iLenMsgHeader + m_iLenPkgHeader + iSendLen, false);
-  memcpy(p_sendbuf, pMsgHeader, m_iLenMsgHeader);
-  pPkgHeader = (LPCOMM_PKG_HEADER)(p_sendbuf + m_iLenMsgHeader);
-  pPkgHeader->msgCode = _CMD_LOGIN;
-  pPkgHeader->msgCode = htons(pPkgHeader->msgCode);
-  pPkgHeader->pkgLen = htons(m_iLenPkgHeader + iSendLen);
-  LPSTRUCT_LOGIN p_sendInfo =
-      (LPSTRUCT_LOGIN)(p_sendbuf + m_iLenMsgHeader + m_iLenPkgHeader);
-  pPkgHeader->crc32 = p_crc32->Get_CRC((unsigned char *)p_sendInfo, iSendLen);
-  pPkgHeader->crc32 = htonl(pPkgHeader->crc32);
-  msgSend(p_sendbuf);
+  SendLoginToClient(pMsgHeader, _CMD_RESUME, username, p_RecvInfo->token);
   return true;
 }
 
 /*
- * @ Description: 处理心跳包
- * @ Paramater: lpngx_connection_t pConn, LPSTRUC_MSG_HEADER pMsgHeader,
- * char *pPkgBody, unsigned short iBodyLength
- * @ Return: void
+ * @ Description: 处理心跳包 心跳包没有包体，长度由处理表检查
+ * @ Paramater: lpngx_connection_t pConn, LPSTRUC_MSG_HEADER pMsgHeader
+ * @ Return: bool
  */
 bool CLogicSocket::_HandlePing(lpngx_connection_t pConn,
-                               LPSTRUC_MSG_HEADER pMsgHeader, char *pPkgBody,
-                               unsigned short iBodyLength) {
-  if (iBodyLength != 0) /* 心跳包包体应该为0 */
-    return false;
-
-  CLock lock(&pConn->logicPorcMutex);
+                               LPSTRUC_MSG_HEADER pMsgHeader) {
+  /* 在epoll线程里执行，不能去等业务线程持有的连接锁，lastPingTime 是原子的 */
   pConn->lastPingTime = time(NULL);
 
   SendNoBodyPkgToClient(pMsgHeader, _CMD_PING);
@@ -258,6 +404,131 @@ bool CLogicSocket::_HandlePing(lpngx_connection_t pConn,
   return true;
 }
 
+/*
+ * @ Description: 公告 只有管理端口能发，收到的包原样广播给其它在线连接
+ *   所有连接共用一份包，回包告诉发起者发给了多少连接
+ *   包体长度不固定，处理表不检查，这里自己看
+ * @ Paramater: lpngx_connection_t pConn, LPSTRUC_MSG_HEADER pMsgHeader,
+ * char *pPkgBody, unsigned short iBodyLength
+ * @ Return: bool(不是管理端口或者没有内容返回false)
+ */
+bool CLogicSocket::_HandleNotice(lpngx_connection_t pConn,
+                                 LPSTRUC_MSG_HEADER pMsgHeader, char *pPkgBody,
+                                 unsigned short iBodyLength) {
+  if (!pConn->listening->admin || iBodyLength == 0) return false;
+
+  /* 包头就在包体前面，crc 由广播按各连接的校验方式重新填 */
+  LPCOMM_PKG_HEADER pRecvHeader =
+      (LPCOMM_PKG_HEADER)(pPkgBody - m_iLenPkgHeader);
+  int iCount = msgBroadcast(pRecvHeader, pConn);
+
+  // 回复发起者
+  CMsgBuilder reply(pMsgHeader, _CMD_NOTICE, sizeof(STRUCT_NOTICE));
+  reply.PutInt32(iCount);
+  msgSend(reply.Finish());
+  return true;
+}
+
+/*
+ * @ Description: 协商校验方式 只能选监听端口允许的
+ *   在epoll线程里执行，这个连接接着收的包马上按新方式算，客户端可以不等回包
+ *   回包告诉客户端最终用的方式，不允许的话还是原来的方式
+ *   还在处理的请求的回包可能已经按新方式算，所以应在没有未完成请求时协商
+ * @ Paramater: lpngx_connection_t pConn, LPSTRUC_MSG_HEADER pMsgHeader,
+ *   LPSTRUCT_CHECKSUM p_RecvInfo
+ * @ Return: bool
+ */
+bool CLogicSocket::_HandleChecksum(lpngx_connection_t pConn,
+                                   LPSTRUC_MSG_HEADER pMsgHeader,
+                                   LPSTRUCT_CHECKSUM p_RecvInfo) {
+  int iMode = p_RecvInfo->iMode;
+  bool bAllow = (iMode >= 0 && iMode < NGX_CSUM_N &&
+                 (pConn->listening->csumAllow & (1 << iMode)) != 0);
+  if (bAllow) pConn->iCsumMode = iMode;
+
+  CMsgBuilder reply(pMsgHeader, _CMD_CHECKSUM, sizeof(STRUCT_CHECKSUM));
+  reply.PutInt32(pConn->iCsumMode);
+  msgSend(reply.Finish());
+  return bAllow;
+}
+
+/*
+ * @ Description: 协商客户端发来的包用哪种包头 v2 要监听端口允许
+ *   在epoll线程里执行，这个包收完就按新格式收下一个包头，客户端可以不等回包
+ *   回包还是 v1 包头，告诉客户端最终用的格式
+ * @ Paramater: lpngx_connection_t pConn, LPSTRUC_MSG_HEADER pMsgHeader,
+ *   LPSTRUCT_FRAMING p_RecvInfo
+ * @ Return: bool
+ */
+bool CLogicSocket::_HandleFraming(lpngx_connection_t pConn,
+                                  LPSTRUC_MSG_HEADER pMsgHeader,
+                                  LPSTRUCT_FRAMING p_RecvInfo) {
+  int iVersion = p_RecvInfo->iVersion;
+  bool bAllow = (iVersion == NGX_FRAMING_V1 ||
+                 (iVersion == NGX_FRAMING_V2 && pConn->listening->framingV2));
+  if (bAllow) pConn->iFraming = iVersion;
+
+  CMsgBuilder reply(pMsgHeader, _CMD_FRAMING, sizeof(STRUCT_FRAMING));
+  reply.PutInt32(pConn->iFraming);
+  msgSend(reply.Finish());
+  return bAllow;
+}
+
+/*
+ * @ Description: 上传 包体按块送来，同一连接的块按顺序一块处理完才收下一块
+ *   示例只数字节，收完最后一块回总长；真正的业务按 iChunkOffset 写文件，
+ *   收到带 NGX_CHUNK_BADCRC 的最后一块时丢掉已写的部分
+ *   一块就装得下的包体整包校验，crc 错不会送到这里
+ * @ Paramater: lpngx_connection_t pConn, LPSTRUC_MSG_HEADER pMsgHeader,
+ *   char *pChunk, unsigned short iChunkLength
+ * @ Return: bool
+ */
+bool CLogicSocket::_HandleUpload(lpngx_connection_t,
+                                 LPSTRUC_MSG_HEADER pMsgHeader, char *,
+                                 unsigned short) {
+  if ((pMsgHeader->iChunkFlags & NGX_CHUNK_LAST) == 0) return true;
+
+  bool bBadCrc = (pMsgHeader->iChunkFlags & NGX_CHUNK_BADCRC) != 0;
+  CMsgBuilder reply(pMsgHeader, _CMD_UPLOAD, sizeof(STRUCT_UPLOAD));
+  reply.PutInt32(pMsgHeader->iChunkTotal);
+  reply.PutInt32(bBadCrc ? 1 : 0);
+  msgSend(reply.Finish());
+  return !bBadCrc;
+}
+
+/*
+ * @ Description: 发送登录成功 用户名、清零的密码、会话令牌
+ * @ Paramater: LPSTRUC_MSG_HEADER pMsgHeader, unsigned short iMsgCode,
+ *   const char *username, const unsigned char *pToken
+ * @ Returns: void
+ */
+void CLogicSocket::SendLoginToClient(LPSTRUC_MSG_HEADER pMsgHeader,
+                                     unsigned short iMsgCode,
+                                     const char *username,
+                                     const unsigned char *pToken) {
+  CMsgBuilder reply(pMsgHeader, iMsgCode,
+                    sizeof(STRUCT_LOGIN) + sizeof(STRUCT_SESSION));
+  reply.PutString(username, sizeof(STRUCT_LOGIN::username));
+  reply.PutZero(sizeof(STRUCT_LOGIN::password));
+  reply.Append(pToken, sizeof(STRUCT_SESSION::token));
+  msgSend(reply.Finish());
+  return;
+}
+
+/*
+ * @ Description: 发送注册/登录失败
+ * @ Paramater: LPSTRUC_MSG_HEADER pMsgHeader, unsigned short iMsgCode,
+ *   int iReason(NGX_USER_*)
+ * @ Returns: void
+ */
+void CLogicSocket::SendFailedToClient(LPSTRUC_MSG_HEADER pMsgHeader,
+                                      unsigned short iMsgCode, int iReason) {
+  CMsgBuilder reply(pMsgHeader, iMsgCode, sizeof(STRUCT_FAILED));
+  reply.PutInt32(iReason);
+  msgSend(reply.Finish());
+  return;
+}
+
 /*
  * @ Description: 发送没有包体的数据包
  * @ Paramater: LPSTRUC_MSG_HEADER pMsgHeader, unsigned short iMsgCode
@@ -265,22 +536,70 @@ bool CLogicSocket::_HandlePing(lpngx_connection_t pConn,
  */
 void CLogicSocket::SendNoBodyPkgToClient(LPSTRUC_MSG_HEADER pMsgHeader,
                                          unsigned short iMsgCode) {
-  CMemory *p_memory = CMemory::GetInstance();
-  char *p_sendbuf =
-      (char *)p_memory->AllocMemory(m_iLenMsgHeader + m_iLenPkgHeader, false);
-  char *p_tmpbuf = p_sendbuf;
+  CMsgBuilder reply(pMsgHeader, iMsgCode, 0);
+  msgSend(reply.Finish());
+  return;
+}
 
-  memcpy(p_tmpbuf, pMsgHeader, m_iLenMsgHeader);
-  p_tmpbuf += m_iLenMsgHeader;
+/*
+ * @ Description: 消息码对应的发送优先级，心跳回包走高优先级队列
+ *   防止排在大量业务回包后面导致客户端认为连接已断
+ * @ Paramater: unsigned short iMsgCode(本机序)
+ * @ Return: int
+ */
+int CLogicSocket::getSendPrio(unsigned short iMsgCode) {
+  if (iMsgCode == _CMD_PING || iMsgCode == _CMD_SERVER_BUSY)
+    return NGX_SEND_PRIO_HIGH;
+  return NGX_SEND_PRIO_BULK;
+}
 
-  /* 指向包头 */
-  LPCOMM_PKG_HEADER pPkgHeader = (LPCOMM_PKG_HEADER)p_tmpbuf;
-  pPkgHeader->msgCode = htons(iMsgCode);
-  pPkgHeader->pkgLen = htons(m_iLenPkgHeader);
-  pPkgHeader->crc32 = 0;
+/*
+ * @ Description: 收消息队列过载，回一个无包体的服务器忙，客户端收到后退避重发
+ * @ Paramater: LPSTRUC_MSG_HEADER pMsgHeader(收到的包的消息头)
+ * @ Return: void
+ */
+void CLogicSocket::sendServerBusy(LPSTRUC_MSG_HEADER pMsgHeader) {
+  SendNoBodyPkgToClient(pMsgHeader, _CMD_SERVER_BUSY);
+}
 
-  msgSend(p_sendbuf);
-  return;
+/*
+ * @ Description: 消息码在业务线程池中的调度类别，取自处理表
+ * @ Paramater: unsigned short iMsgCode(本机序)
+ * @ Return: int NGX_RECV_CLASS_*
+ */
+int CLogicSocket::getRecvClass(unsigned short iMsgCode) {
+  if (iMsgCode >= AUTH_TOTAL_COMMANDS) return NGX_RECV_CLASS_NORMAL;
+  return statusHandler[iMsgCode].iClass;
+}
+
+/*
+ * @ Description: 消息码最多同时被几个业务线程处理，取自处理表
+ * @ Paramater: unsigned short iMsgCode(本机序)
+ * @ Return: int 0 不限
+ */
+int CLogicSocket::getRecvQuota(unsigned short iMsgCode) {
+  if (iMsgCode >= AUTH_TOTAL_COMMANDS) return 0;
+  return statusHandler[iMsgCode].iQuota;
+}
+
+/*
+ * @ Description: 消息码是否在epoll线程直接处理，取自处理表
+ * @ Paramater: unsigned short iMsgCode(本机序)
+ * @ Return: bool
+ */
+bool CLogicSocket::getRecvInline(unsigned short iMsgCode) {
+  if (iMsgCode >= AUTH_TOTAL_COMMANDS) return false;
+  return statusHandler[iMsgCode].bInline;
+}
+
+/*
+ * @ Description: 消息码的包体是否分块交付，取自处理表
+ * @ Paramater: unsigned short iMsgCode(本机序)
+ * @ Return: bool
+ */
+bool CLogicSocket::getRecvChunked(unsigned short iMsgCode) {
+  if (iMsgCode >= AUTH_TOTAL_COMMANDS) return false;
+  return statusHandler[iMsgCode].bChunk;
 }
 
 /*
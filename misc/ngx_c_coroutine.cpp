@@ -0,0 +1,334 @@
+/*
+ * @Author: agent
+ * @Date: 2026-10-19 15:26:49
+ * @Last Modified by: agent
+ * @Last Modified time: 2026-10-19 15:26:49
+ * @Description: 协程调度器和等待对象
+ */
+
+#include "ngx_c_coroutine.h"
+
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ngx_c_lockmutex.h"
+#include "ngx_c_socket.h"
+#include "ngx_func.h"
+#include "ngx_global.h"
+#include "ngx_macro.h"
+
+CCoScheduler *CCoScheduler::m_instance = nullptr;
+
+/*
+ * @ Description: 定时器到期时间
+ * @ Parameter: int iMs(毫秒)
+ * @ Return: CCoSleepAwaiter
+ */
+CCoSleepAwaiter ngx_co_sleep(int iMs) {
+  CCoSleepAwaiter awaiter;
+  awaiter.iDeadlineUs = ngx_time_us() + (uint64_t)((iMs > 0) ? iMs : 0) * 1000;
+  return awaiter;
+}
+
+/*
+ * @ Description: 生成一个IO等待对象
+ * @ Parameter: int iOp, int fd, void *pBuf, size_t iLen, off_t iOffset
+ * @ Return: CCoIoAwaiter
+ */
+static CCoIoAwaiter ngx_co_io(int iOp, int fd, void *pBuf, size_t iLen,
+                              off_t iOffset) {
+  CCoIoAwaiter awaiter;
+  awaiter.iOp = iOp;
+  awaiter.fd = fd;
+  awaiter.pBuf = pBuf;
+  awaiter.iLen = iLen;
+  awaiter.iOffset = iOffset;
+  awaiter.iResult = -1;
+  awaiter.iErrno = 0;
+  return awaiter;
+}
+
+CCoIoAwaiter ngx_co_pread(int fd, void *pBuf, size_t iLen, off_t iOffset) {
+  return ngx_co_io(NGX_CO_IO_PREAD, fd, pBuf, iLen, iOffset);
+}
+
+CCoIoAwaiter ngx_co_pwrite(int fd, const void *pBuf, size_t iLen,
+                           off_t iOffset) {
+  return ngx_co_io(NGX_CO_IO_PWRITE, fd, (void *)pBuf, iLen, iOffset);
+}
+
+CCoIoAwaiter ngx_co_fdatasync(int fd) {
+  return ngx_co_io(NGX_CO_IO_FDATASYNC, fd, nullptr, 0, 0);
+}
+
+/*
+ * 挂起后协程可能马上在别的线程恢复并销毁协程帧(等待对象就在帧里)，
+ * 所以 await_suspend 把自己交出去以后就不能再碰成员
+ */
+void CCoSleepAwaiter::await_suspend(CCoTask::handle_t h) {
+  CCoScheduler::GetInstance()->AddTimer(iDeadlineUs, h);
+}
+
+void CCoIoAwaiter::await_suspend(CCoTask::handle_t h) {
+  hWaiter = h;
+  CCoScheduler::GetInstance()->AddIo(this);
+}
+
+ssize_t CCoIoAwaiter::await_resume() const noexcept {
+  if (iResult < 0) errno = iErrno;
+  return iResult;
+}
+
+void CCoSendAwaiter::await_suspend(CCoTask::handle_t h) {
+  ((LPSTRUC_MSG_HEADER)pSendbuf)->pSendWaiter = h.address();
+  pSocket->msgSend(pSendbuf, iPrio); /* 被丢弃时这里面就会恢复 */
+}
+
+/*
+ * @ Description: 构造函数
+ */
+CCoScheduler::CCoScheduler()
+    : m_shutdown(false),
+      m_iIoThreadNum(1),
+      m_bTimerStarted(false),
+      m_iTimerCount(0),
+      m_iIoCount(0) {
+  pthread_condattr_t attr;
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC); /* 和 ngx_time_us 一致 */
+  pthread_mutex_init(&m_timerMutex, NULL);
+  pthread_cond_init(&m_timerCond, &attr);
+  pthread_condattr_destroy(&attr);
+  pthread_mutex_init(&m_ioMutex, NULL);
+  pthread_cond_init(&m_ioCond, NULL);
+}
+
+/*
+ * @ Description: 析构函数
+ */
+CCoScheduler::~CCoScheduler() {
+  pthread_cond_destroy(&m_ioCond);
+  pthread_mutex_destroy(&m_ioMutex);
+  pthread_cond_destroy(&m_timerCond);
+  pthread_mutex_destroy(&m_timerMutex);
+}
+
+/*
+ * @ Description: 记下IO线程数
+ *   定时器线程和IO线程在第一次 AddTimer()/AddIo() 时才创建，
+ *   没有协程等定时器或者做文件IO的进程不多占线程
+ * @ Parameter: int iIoThreadNum
+ * @ Return: bool
+ */
+bool CCoScheduler::Start(int iIoThreadNum) {
+  m_iIoThreadNum = (iIoThreadNum < 1) ? 1 : iIoThreadNum;
+  return true;
+}
+
+/*
+ * @ Description: 停止线程 还没等到的协程不再恢复，协程帧在这里销毁
+ *   之后再有人要恢复协程(比如发送线程清队列)也直接销毁，不再投给线程池
+ * @ Parameter: void
+ * @ Return: void
+ */
+void CCoScheduler::Stop() {
+  if (m_shutdown) return;
+
+  pthread_mutex_lock(&m_timerMutex);
+  pthread_mutex_lock(&m_ioMutex);
+  m_shutdown = true;
+  pthread_cond_broadcast(&m_timerCond);
+  pthread_cond_broadcast(&m_ioCond);
+  pthread_mutex_unlock(&m_ioMutex);
+  pthread_mutex_unlock(&m_timerMutex);
+
+  /* 置位以后不会再创建线程，不用加锁 */
+  if (m_bTimerStarted) pthread_join(m_timerThread, NULL);
+  for (size_t i = 0; i < m_ioThreads.size(); ++i)
+    pthread_join(m_ioThreads[i], NULL);
+  m_ioThreads.clear();
+
+  /* 线程都退了，剩下的等待不会再有人管 */
+  std::multimap<uint64_t, void *>::iterator it;
+  for (it = m_timers.begin(); it != m_timers.end(); ++it)
+    CCoTask::handle_t::from_address(it->second).destroy();
+  m_timers.clear();
+  m_iTimerCount = 0;
+  while (!m_ioQueue.empty()) {
+    m_ioQueue.front()->hWaiter.destroy(); /* 等待对象在帧里，先出队再销毁 */
+    m_ioQueue.pop_front();
+  }
+  m_iIoCount = 0;
+
+  ngx_log_error_core(NGX_LOG_NOTICE, 0, "CCoScheduler::Stop() successful");
+  return;
+}
+
+/*
+ * @ Description: 协程等定时器，比当前最早的还早就叫醒定时器线程重新算
+ *   第一次用时创建定时器线程，已经停了或者创建失败就销毁协程
+ * @ Parameter: uint64_t iDeadlineUs, CCoTask::handle_t h
+ * @ Return: void
+ */
+void CCoScheduler::AddTimer(uint64_t iDeadlineUs, CCoTask::handle_t h) {
+  CLock lock(&m_timerMutex);
+  if (m_bTimerStarted == false && m_shutdown == false) {
+    int err = pthread_create(&m_timerThread, NULL, TimerThread, this);
+    if (err != 0)
+      ngx_log_error_core(NGX_LOG_ERR, err,
+                         "CCoScheduler::AddTimer()->pthread_create() failed");
+    else
+      m_bTimerStarted = true;
+  }
+  if (m_bTimerStarted == false || m_shutdown) {
+    h.destroy(); /* 没有线程会来恢复它 */
+    return;
+  }
+
+  bool bEarliest = m_timers.empty() || iDeadlineUs < m_timers.begin()->first;
+  m_timers.insert(std::make_pair(iDeadlineUs, h.address()));
+  ++m_iTimerCount;
+  if (bEarliest) pthread_cond_signal(&m_timerCond);
+  return;
+}
+
+/*
+ * @ Description: 协程等文件IO
+ *   第一次用时创建IO线程，已经停了或者一个都没创建成功就销毁协程
+ * @ Parameter: CCoIoAwaiter *pIo
+ * @ Return: void
+ */
+void CCoScheduler::AddIo(CCoIoAwaiter *pIo) {
+  CLock lock(&m_ioMutex);
+  while ((int)m_ioThreads.size() < m_iIoThreadNum && m_shutdown == false) {
+    pthread_t tid;
+    int err = pthread_create(&tid, NULL, IoThread, this);
+    if (err != 0) {
+      ngx_log_error_core(NGX_LOG_ERR, err,
+                         "CCoScheduler::AddIo()->pthread_create() failed");
+      break;
+    }
+    m_ioThreads.push_back(tid);
+  }
+  if (m_ioThreads.empty() || m_shutdown) {
+    pIo->hWaiter.destroy(); /* pIo 在协程帧里，销毁后不能再碰 */
+    return;
+  }
+
+  m_ioQueue.push_back(pIo);
+  ++m_iIoCount;
+  pthread_cond_signal(&m_ioCond);
+  return;
+}
+
+/*
+ * @ Description: 交给业务线程池恢复，调度器停了就销毁
+ *   停的顺序是调度器在线程池之前，这样线程池停了以后不会再有任务投进去
+ * @ Parameter: CCoTask::handle_t h
+ * @ Return: void
+ */
+void CCoScheduler::Resume(CCoTask::handle_t h) {
+  if (GetInstance()->m_shutdown) {
+    h.destroy();
+    return;
+  }
+  g_threadpool.postTask(ResumeTask, h.address(), h.promise().iSlot);
+}
+
+void CCoScheduler::ResumeTask(void *pArg) {
+  CCoTask::handle_t::from_address(pArg).resume();
+}
+
+/*
+ * @ Description: 定时器线程 睡到最早的到期时间，到期的都交给线程池
+ * @ Parameter: void *threadData
+ * @ Return: void*
+ */
+void *CCoScheduler::TimerThread(void *threadData) {
+  CCoScheduler *pThis = static_cast<CCoScheduler *>(threadData);
+  ngx_affinity_bind_thread(NGX_THREAD_TIMER);
+
+  std::vector<void *> expired;
+  pthread_mutex_lock(&pThis->m_timerMutex);
+  while (pThis->m_shutdown == false) {
+    if (pThis->m_timers.empty()) {
+      pthread_cond_wait(&pThis->m_timerCond, &pThis->m_timerMutex);
+      continue;
+    }
+
+    uint64_t now = ngx_time_us();
+    uint64_t first = pThis->m_timers.begin()->first;
+    if (first > now) {
+      struct timespec abstime;
+      clock_gettime(CLOCK_MONOTONIC, &abstime);
+      uint64_t ns = abstime.tv_nsec + (first - now) * 1000;
+      abstime.tv_sec += ns / 1000000000;
+      abstime.tv_nsec = ns % 1000000000;
+      pthread_cond_timedwait(&pThis->m_timerCond, &pThis->m_timerMutex,
+                             &abstime);
+      continue;
+    }
+
+    /* 到期的一次取走，放开锁再投递，投递时不占着定时器锁 */
+    while (!pThis->m_timers.empty() &&
+           pThis->m_timers.begin()->first <= now) {
+      expired.push_back(pThis->m_timers.begin()->second);
+      pThis->m_timers.erase(pThis->m_timers.begin());
+    }
+    pThis->m_iTimerCount -= expired.size();
+    pthread_mutex_unlock(&pThis->m_timerMutex);
+    for (size_t i = 0; i < expired.size(); ++i)
+      Resume(CCoTask::handle_t::from_address(expired[i]));
+    expired.clear();
+    pthread_mutex_lock(&pThis->m_timerMutex);
+  }
+  pthread_mutex_unlock(&pThis->m_timerMutex);
+  return (void *)0;
+}
+
+/*
+ * @ Description: IO线程 替协程做阻塞的文件操作，做完交给线程池
+ * @ Parameter: void *threadData
+ * @ Return: void*
+ */
+void *CCoScheduler::IoThread(void *threadData) {
+  CCoScheduler *pThis = static_cast<CCoScheduler *>(threadData);
+  ngx_affinity_bind_thread(NGX_THREAD_IO);
+
+  while (true) {
+    pthread_mutex_lock(&pThis->m_ioMutex);
+    while (pThis->m_ioQueue.empty() && pThis->m_shutdown == false)
+      pthread_cond_wait(&pThis->m_ioCond, &pThis->m_ioMutex);
+    if (pThis->m_shutdown) {
+      pthread_mutex_unlock(&pThis->m_ioMutex);
+      break;
+    }
+    CCoIoAwaiter *pIo = pThis->m_ioQueue.front();
+    pThis->m_ioQueue.pop_front();
+    pthread_mutex_unlock(&pThis->m_ioMutex);
+
+    switch (pIo->iOp) {
+      case NGX_CO_IO_PREAD:
+        pIo->iResult = pread(pIo->fd, pIo->pBuf, pIo->iLen, pIo->iOffset);
+        break;
+      case NGX_CO_IO_PWRITE:
+        pIo->iResult = pwrite(pIo->fd, pIo->pBuf, pIo->iLen, pIo->iOffset);
+        break;
+      case NGX_CO_IO_FDATASYNC:
+        pIo->iResult = fdatasync(pIo->fd);
+        break;
+      default:
+        pIo->iResult = -1;
+        errno = EINVAL;
+        break;
+    }
+    if (pIo->iResult < 0) pIo->iErrno = errno;
+    --pThis->m_iIoCount;
+
+    /* 恢复以后 pIo 所在的协程帧随时可能没了，先取出句柄 */
+    CCoTask::handle_t h = pIo->hWaiter;
+    Resume(h);
+  }
+  return (void *)0;
+}
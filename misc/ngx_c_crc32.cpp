@@ -8,6 +8,7 @@
 
 #include "ngx_c_crc32.h"
 
+#include <cstdint>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
@@ -15,10 +16,149 @@
 //类静态变量初始化
 CCRC32* CCRC32::m_instance = NULL;
 
+#define NGX_CRC_FOLD_MIN 64 /* 短于这个长度折叠不划算 */
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+
+/*
+ * @ Description: PCLMULQDQ 折叠，常数是多项式 0xEDB88320 反射域下的
+ *   x^(k) mod P，最后 Barrett 约简到32位
+ *   crc 是取反后的中间值，dwSize 至少64且是16的倍数
+ * @ Parameter: unsigned int crc, const unsigned char* buffer,
+ *   unsigned int dwSize
+ * @ Returns: unsigned int
+ */
+__attribute__((target("sse4.2,pclmul"))) static unsigned int ngx_crc32_pclmul(
+    unsigned int crc, const unsigned char* buffer, unsigned int dwSize) {
+  alignas(16) static const uint64_t k1k2[] = {0x0154442bd4, 0x01c6e41596};
+  alignas(16) static const uint64_t k3k4[] = {0x01751997d0, 0x00ccaa009e};
+  alignas(16) static const uint64_t k5k0[] = {0x0163cd6124, 0x0000000000};
+  alignas(16) static const uint64_t poly[] = {0x01db710641, 0x01f7011641};
+
+  __m128i x0, x1, x2, x3, x4, x5, x6, x7, x8, y5, y6, y7, y8;
+
+  /* 4 路并行，每次64字节 */
+  x1 = _mm_loadu_si128((const __m128i*)(buffer + 0x00));
+  x2 = _mm_loadu_si128((const __m128i*)(buffer + 0x10));
+  x3 = _mm_loadu_si128((const __m128i*)(buffer + 0x20));
+  x4 = _mm_loadu_si128((const __m128i*)(buffer + 0x30));
+  x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(crc));
+  x0 = _mm_load_si128((const __m128i*)k1k2);
+  buffer += 64;
+  dwSize -= 64;
+
+  while (dwSize >= 64) {
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+    x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+    x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+    x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+    x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+    y5 = _mm_loadu_si128((const __m128i*)(buffer + 0x00));
+    y6 = _mm_loadu_si128((const __m128i*)(buffer + 0x10));
+    y7 = _mm_loadu_si128((const __m128i*)(buffer + 0x20));
+    y8 = _mm_loadu_si128((const __m128i*)(buffer + 0x30));
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), y5);
+    x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), y6);
+    x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), y7);
+    x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), y8);
+    buffer += 64;
+    dwSize -= 64;
+  }
+
+  /* 4 路合成 128 位 */
+  x0 = _mm_load_si128((const __m128i*)k3k4);
+  x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+  x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+  x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+  x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+  x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+  x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+  x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+  x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+  x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+  /* 剩下的16字节一块 */
+  while (dwSize >= 16) {
+    x2 = _mm_loadu_si128((const __m128i*)buffer);
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+    buffer += 16;
+    dwSize -= 16;
+  }
+
+  /* 128 位折到 64 位 */
+  x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+  x3 = _mm_setr_epi32(~0, 0, ~0, 0);
+  x1 = _mm_srli_si128(x1, 8);
+  x1 = _mm_xor_si128(x1, x2);
+  x0 = _mm_loadl_epi64((const __m128i*)k5k0);
+  x2 = _mm_srli_si128(x1, 4);
+  x1 = _mm_and_si128(x1, x3);
+  x1 = _mm_clmulepi64_si128(x1, x0, 0x00);
+  x1 = _mm_xor_si128(x1, x2);
+
+  /* Barrett 约简到 32 位 */
+  x0 = _mm_load_si128((const __m128i*)poly);
+  x2 = _mm_and_si128(x1, x3);
+  x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+  x2 = _mm_and_si128(x2, x3);
+  x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+  x1 = _mm_xor_si128(x1, x2);
+  return (unsigned int)_mm_extract_epi32(x1, 1);
+}
+
+/*
+ * @ Description: SSE4.2 crc32 指令算 CRC32C，一次8字节
+ *   crc 是取反后的中间值
+ * @ Parameter: unsigned int crc, const unsigned char* buffer,
+ *   unsigned int dwSize
+ * @ Returns: unsigned int
+ */
+__attribute__((target("sse4.2"))) static unsigned int ngx_crc32c_sse42(
+    unsigned int crc, const unsigned char* buffer, unsigned int dwSize) {
+#if defined(__x86_64__)
+  uint64_t crc64 = crc;
+  while (dwSize >= 8) {
+    uint64_t v;
+    memcpy(&v, buffer, 8);
+    crc64 = _mm_crc32_u64(crc64, v);
+    buffer += 8;
+    dwSize -= 8;
+  }
+  crc = (unsigned int)crc64;
+#endif
+  while (dwSize >= 4) {
+    uint32_t v;
+    memcpy(&v, buffer, 4);
+    crc = _mm_crc32_u32(crc, v);
+    buffer += 4;
+    dwSize -= 4;
+  }
+  while (dwSize--) crc = _mm_crc32_u8(crc, *buffer++);
+  return crc;
+}
+#endif
+
 /*
  * @ Description: 构造函数
  */
-CCRC32::CCRC32() { Init_CRC32_Table(); }
+CCRC32::CCRC32()
+    : m_pFold(nullptr), m_pCrc32c(nullptr), m_pImpl("slice-by-16") {
+  Init_CRC32_Table();
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.2")) {
+    m_pFold = ngx_crc32_pclmul;
+    m_pImpl = "pclmul";
+  }
+  if (__builtin_cpu_supports("sse4.2")) m_pCrc32c = ngx_crc32c_sse42;
+#endif
+}
 
 /*
  * @ Description: 析构函数
@@ -40,13 +180,28 @@ void CCRC32::Init_CRC32_Table() {
   unsigned int ulPolynomial = 0x04c11db7;
 
   for (int i = 0; i <= 0xFF; i++) {
-    crc32_table[i] = Reflect(i, 8) << 24;
+    crc32_table[0][i] = Reflect(i, 8) << 24;
 
     for (int j = 0; j < 8; j++) {
-      crc32_table[i] = (crc32_table[i] << 1) ^
-                       (crc32_table[i] & (1 << 31) ? ulPolynomial : 0);
+      crc32_table[0][i] = (crc32_table[0][i] << 1) ^
+                          (crc32_table[0][i] & (1 << 31) ? ulPolynomial : 0);
+    }
+    crc32_table[0][i] = Reflect(crc32_table[0][i], 32);
+  }
+
+  /* CRC32C 反射多项式 0x82F63B78 */
+  for (unsigned int i = 0; i <= 0xFF; i++) {
+    unsigned int c = i;
+    for (int j = 0; j < 8; j++) c = (c >> 1) ^ ((c & 1) ? 0x82F63B78 : 0);
+    crc32c_table[i] = c;
+  }
+
+  /* 第k张表：字节后面再跟k个0字节时的CRC，一次查16张表处理16字节 */
+  for (int i = 0; i <= 0xFF; i++) {
+    for (int k = 1; k < 16; k++) {
+      unsigned int prev = crc32_table[k - 1][i];
+      crc32_table[k][i] = (prev >> 8) ^ crc32_table[0][prev & 0xFF];
     }
-    crc32_table[i] = Reflect(crc32_table[i], 32);
   }
 }
 
@@ -56,12 +211,110 @@ void CCRC32::Init_CRC32_Table() {
  * @ Returns: void
  */
 int CCRC32::Get_CRC(unsigned char* buffer, unsigned int dwSize) {
-  unsigned int crc(0xffffffff);
-  int len;
+  return Update_CRC(0, buffer, dwSize);
+}
 
-  len = dwSize;
+/*
+ * @ Description: 分段计算CRC，crc 给上一段的结果，第一段给0
+ *   Update_CRC(Update_CRC(0, a), b) 和整段一起算结果相同
+ * @ Parameter: unsigned int crc, const unsigned char* buffer,
+ *   unsigned int dwSize
+ * @ Returns: unsigned int
+ */
+unsigned int CCRC32::Update_CRC(unsigned int crc, const unsigned char* buffer,
+                                unsigned int dwSize) {
+  crc ^= 0xffffffff;
+  if (m_pFold != nullptr && dwSize >= NGX_CRC_FOLD_MIN) {
+    unsigned int iFold = dwSize & ~15u; /* 折叠按16字节一块 */
+    crc = m_pFold(crc, buffer, iFold);
+    buffer += iFold;
+    dwSize -= iFold;
+  }
+  crc = Slice_CRC(crc, buffer, dwSize);
+  return crc ^ 0xffffffff;
+}
 
-  while (len--) crc = (crc >> 8) ^ crc32_table[(crc & 0xFF) ^ *buffer++];
+/*
+ * @ Description: 查表计算 够16字节时一次查16张表，crc 是取反后的中间值
+ * @ Parameter: unsigned int crc, const unsigned char* buffer,
+ *   unsigned int dwSize
+ * @ Returns: unsigned int
+ */
+unsigned int CCRC32::Slice_CRC(unsigned int crc, const unsigned char* buffer,
+                               unsigned int dwSize) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  const unsigned int(*t)[256] = crc32_table;
+  while (dwSize >= 16) {
+    uint32_t a, b, c, d;
+    memcpy(&a, buffer, 4);
+    memcpy(&b, buffer + 4, 4);
+    memcpy(&c, buffer + 8, 4);
+    memcpy(&d, buffer + 12, 4);
+    a ^= crc;
+    crc = t[15][a & 0xFF] ^ t[14][(a >> 8) & 0xFF] ^ t[13][(a >> 16) & 0xFF] ^
+          t[12][a >> 24] ^ t[11][b & 0xFF] ^ t[10][(b >> 8) & 0xFF] ^
+          t[9][(b >> 16) & 0xFF] ^ t[8][b >> 24] ^ t[7][c & 0xFF] ^
+          t[6][(c >> 8) & 0xFF] ^ t[5][(c >> 16) & 0xFF] ^ t[4][c >> 24] ^
+          t[3][d & 0xFF] ^ t[2][(d >> 8) & 0xFF] ^ t[1][(d >> 16) & 0xFF] ^
+          t[0][d >> 24];
+    buffer += 16;
+    dwSize -= 16;
+  }
+#endif
+  while (dwSize--)
+    crc = (crc >> 8) ^ crc32_table[0][(crc & 0xFF) ^ *buffer++];
+  return crc;
+}
 
+/*
+ * @ Description: 拷贝的同时计算CRC，数据只过一遍
+ * @ Parameter: unsigned int crc, unsigned char* dst,
+ *   const unsigned char* src, unsigned int dwSize
+ * @ Returns: unsigned int
+ */
+unsigned int CCRC32::Copy_CRC(unsigned int crc, unsigned char* dst,
+                              const unsigned char* src, unsigned int dwSize,
+                              int iMode) {
+  /* 分段拷贝，每段拷完马上在一级缓存里算，数据只从内存读一遍 */
+  while (dwSize > 0) {
+    unsigned int iChunk = (dwSize > 4096) ? 4096 : dwSize;
+    memcpy(dst, src, iChunk);
+    crc = Update_Csum(iMode, crc, dst, iChunk);
+    dst += iChunk;
+    src += iChunk;
+    dwSize -= iChunk;
+  }
+  return crc;
+}
+
+/*
+ * @ Description: 分段计算CRC32C，用法和 Update_CRC 一样
+ * @ Parameter: unsigned int crc, const unsigned char* buffer,
+ *   unsigned int dwSize
+ * @ Returns: unsigned int
+ */
+unsigned int CCRC32::Update_CRC32C(unsigned int crc,
+                                   const unsigned char* buffer,
+                                   unsigned int dwSize) {
+  crc ^= 0xffffffff;
+  if (m_pCrc32c != nullptr) {
+    crc = m_pCrc32c(crc, buffer, dwSize);
+  } else {
+    while (dwSize--) crc = (crc >> 8) ^ crc32c_table[(crc & 0xFF) ^ *buffer++];
+  }
   return crc ^ 0xffffffff;
 }
+
+/*
+ * @ Description: 按校验方式分段计算，NGX_CSUM_NONE 总是0
+ * @ Parameter: int iMode(NGX_CSUM_*), unsigned int crc,
+ *   const unsigned char* buffer, unsigned int dwSize
+ * @ Returns: unsigned int
+ */
+unsigned int CCRC32::Update_Csum(int iMode, unsigned int crc,
+                                 const unsigned char* buffer,
+                                 unsigned int dwSize) {
+  if (iMode == NGX_CSUM_CRC32C) return Update_CRC32C(crc, buffer, dwSize);
+  if (iMode == NGX_CSUM_NONE) return 0;
+  return Update_CRC(crc, buffer, dwSize);
+}
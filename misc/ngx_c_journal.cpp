@@ -0,0 +1,398 @@
+/*
+ * @Author: agent
+ * @Date: 2026-10-19 15:47:25
+ * @Last Modified by: agent
+ * @Last Modified time: 2026-10-19 15:47:25
+ * @Description: 注册日志
+ */
+
+#include "ngx_c_journal.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <vector>
+
+#include "ngx_c_crc32.h"
+#include "ngx_func.h"
+#include "ngx_macro.h"
+
+#define NGX_JOURNAL_BATCH 256 /* 刷盘线程一次最多取多少条 */
+
+CUserJournal *CUserJournal::m_instance = nullptr;
+
+/* 记录的校验和 从 iUserId 开始算 */
+static uint32_t ngx_journal_crc(const ngx_journal_rec_t *pRec) {
+  const unsigned char *p = (const unsigned char *)&pRec->iUserId;
+  return CCRC32::GetInstance()->Update_CRC32C(
+      0, p, sizeof(ngx_journal_rec_t) - offsetof(ngx_journal_rec_t, iUserId));
+}
+
+/* 恢复线程各管一段记录 */
+struct ngx_journal_recover_s {
+  const ngx_journal_rec_t *pRecs;
+  size_t iBegin;
+  size_t iEnd;
+  int iRestored; /* 恢复的用户数 */
+  int iBad;      /* 校验不过的记录 */
+  int iSkipped;  /* 重复或者用户表满 */
+};
+
+/*
+ * @ Description: 不等落盘时直接放进暂存队列，不挂起
+ */
+bool CJournalAwaiter::await_ready() noexcept {
+  CUserJournal *pJournal = CUserJournal::GetInstance();
+  if (!pJournal->isEnabled()) {
+    bOk = true;
+    return true;
+  }
+  if (pJournal->getSyncMode() == NGX_JOURNAL_SYNC_NONE) {
+    pJournal->Push(rec, nullptr);
+    bOk = true;
+    return true;
+  }
+  return false;
+}
+
+/*
+ * @ Description: 放进暂存队列等刷盘线程恢复
+ *   入队之后协程随时可能被恢复，不能再碰 this
+ */
+void CJournalAwaiter::await_suspend(CCoTask::handle_t h) noexcept {
+  hWaiter = h;
+  CUserJournal::GetInstance()->Push(rec, this);
+}
+
+/*
+ * @ Description: 构造函数
+ */
+CUserJournal::CUserJournal()
+    : m_fd(-1),
+      m_iSyncMode(NGX_JOURNAL_SYNC_DATA),
+      m_bSleeping(false),
+      m_bStop(false),
+      m_bStarted(false),
+      m_iWriteCount(0),
+      m_iSyncCount(0),
+      m_iRecordCount(0) {
+  pthread_mutex_init(&m_mutex, NULL);
+  pthread_cond_init(&m_cond, NULL);
+}
+
+/*
+ * @ Description: 析构函数
+ */
+CUserJournal::~CUserJournal() {
+  Stop();
+  if (m_fd != -1) {
+    close(m_fd);
+    m_fd = -1;
+  }
+  pthread_cond_destroy(&m_cond);
+  pthread_mutex_destroy(&m_mutex);
+}
+
+/*
+ * @ Description: master 打开日志并恢复共享用户表，要在 fork 之前调用
+ *   文件长度不是记录长度的整数倍说明上次写到一半断了，截掉，不然后面追加的全错位
+ *   文件里有密码摘要，只给属主读写
+ * @ Parameter: const char *pFileName, int iRecoverThreads(恢复线程数)
+ * @ Return: bool
+ */
+bool CUserJournal::Open(const char *pFileName, int iRecoverThreads) {
+  m_fd = open(pFileName, O_RDWR | O_APPEND | O_CREAT, 0600);
+  if (m_fd == -1) {
+    ngx_log_error_core(NGX_LOG_ERR, errno,
+                       "CUserJournal::Open()->open(%s) failed", pFileName);
+    return false;
+  }
+
+  struct stat st;
+  if (fstat(m_fd, &st) == -1) {
+    ngx_log_error_core(NGX_LOG_ERR, errno, "CUserJournal::Open()->fstat() failed");
+    return false;
+  }
+  /* 以前建的文件可能是 0644，一起收紧 */
+  if ((st.st_mode & 0077) != 0 && fchmod(m_fd, 0600) == -1)
+    ngx_log_error_core(NGX_LOG_WARN, errno,
+                       "CUserJournal::Open()->fchmod(0600) failed");
+  off_t iTail = st.st_size % sizeof(ngx_journal_rec_t);
+  if (iTail != 0) {
+    if (ftruncate(m_fd, st.st_size - iTail) == -1) {
+      ngx_log_error_core(NGX_LOG_ERR, errno,
+                         "CUserJournal::Open()->ftruncate() failed");
+      return false;
+    }
+    ngx_log_error_core(NGX_LOG_WARN, 0,
+                       "CUserJournal::Open() dropped %d bytes of torn tail",
+                       (int)iTail);
+  }
+
+  if (iRecoverThreads < 1) iRecoverThreads = 1;
+  return Recover(iRecoverThreads);
+}
+
+/*
+ * @ Description: worker 起刷盘线程 用户表 master 已经恢复好了
+ * @ Parameter: int iSyncMode(NGX_JOURNAL_SYNC_*), int iQueueSize(暂存队列长度)
+ * @ Return: bool
+ */
+bool CUserJournal::Start(int iSyncMode, int iQueueSize) {
+  if (m_fd == -1) return true; /* 没配日志文件 */
+
+  if (iSyncMode < NGX_JOURNAL_SYNC_NONE || iSyncMode > NGX_JOURNAL_SYNC_DATA)
+    iSyncMode = NGX_JOURNAL_SYNC_DATA;
+  m_iSyncMode = iSyncMode;
+  if (iQueueSize < NGX_JOURNAL_BATCH) iQueueSize = NGX_JOURNAL_BATCH;
+
+  m_queue.Init(iQueueSize);
+  int err = pthread_create(&m_tid, NULL, FlushThread, this);
+  if (err != 0) {
+    ngx_log_error_core(NGX_LOG_ERR, err,
+                       "CUserJournal::Start()->pthread_create() failed");
+    return false;
+  }
+  m_bStarted = true;
+  return true;
+}
+
+/*
+ * @ Description: 停刷盘线程 暂存队列里剩下的会先写完
+ * @ Parameter: void
+ * @ Return: void
+ */
+void CUserJournal::Stop() {
+  if (!m_bStarted) return;
+  m_bStarted = false;
+
+  pthread_mutex_lock(&m_mutex);
+  m_bStop = true;
+  pthread_cond_signal(&m_cond);
+  pthread_mutex_unlock(&m_mutex);
+  pthread_join(m_tid, NULL);
+
+  ngx_log_error_core(NGX_LOG_NOTICE, 0, "CUserJournal::Stop() successful");
+  return;
+}
+
+/*
+ * @ Description: 生成一条注册记录，调用者 co_await 结果
+ * @ Parameter: uint32_t iUserId, int iType, const char *username,
+ *   const ngx_user_cred_t &cred
+ * @ Return: CJournalAwaiter
+ */
+CJournalAwaiter CUserJournal::Append(uint32_t iUserId, int iType,
+                                     const char *username,
+                                     const ngx_user_cred_t &cred) {
+  CJournalAwaiter awaiter;
+  memset(&awaiter.rec, 0, sizeof(awaiter.rec));
+  awaiter.rec.iMagic = NGX_JOURNAL_MAGIC;
+  awaiter.rec.iUserId = iUserId;
+  awaiter.rec.iType = iType;
+  strncpy(awaiter.rec.username, username, NGX_USER_NAME_LEN - 1);
+  awaiter.rec.cred = cred;
+  awaiter.rec.iCrc = ngx_journal_crc(&awaiter.rec);
+  awaiter.bOk = false;
+  return awaiter;
+}
+
+/*
+ * @ Description: 放进暂存队列，满了就让出CPU等刷盘线程腾地方，不丢记录
+ *   刷盘线程在睡才去叫它
+ * @ Parameter: const ngx_journal_rec_t &rec, CJournalAwaiter *pWaiter
+ * @ Return: void
+ */
+void CUserJournal::Push(const ngx_journal_rec_t &rec,
+                        CJournalAwaiter *pWaiter) {
+  JournalItem item;
+  item.rec = rec;
+  item.pWaiter = pWaiter;
+  while (!m_queue.Push(item)) sched_yield();
+
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (m_bSleeping.load(std::memory_order_relaxed)) {
+    pthread_mutex_lock(&m_mutex);
+    pthread_cond_signal(&m_cond);
+    pthread_mutex_unlock(&m_mutex);
+  }
+  return;
+}
+
+/*
+ * @ Description: 刷盘线程 一次取一批，一次 write，按配置一次 fdatasync
+ *   刷盘期间新来的记录攒成下一批，负载越高一批越大
+ * @ Parameter: void *threadData
+ * @ Return: void*
+ */
+void *CUserJournal::FlushThread(void *threadData) {
+  CUserJournal *pThis = static_cast<CUserJournal *>(threadData);
+  ngx_affinity_bind_thread(NGX_THREAD_JOURNAL);
+
+  std::vector<JournalItem> items(NGX_JOURNAL_BATCH);
+  std::vector<ngx_journal_rec_t> recs(NGX_JOURNAL_BATCH);
+
+  while (true) {
+    size_t n = pThis->m_queue.PopBatch(items.data(), NGX_JOURNAL_BATCH);
+    if (n == 0) {
+      if (pThis->m_bStop) break;
+      /* 先挂牌再看一眼队列，入队的人看到牌子会来叫，超时兜底 */
+      pThis->m_bSleeping.store(true, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      pthread_mutex_lock(&pThis->m_mutex);
+      if (pThis->m_queue.Size() == 0 && !pThis->m_bStop) {
+        struct timeval now;
+        gettimeofday(&now, NULL);
+        struct timespec ts;
+        ts.tv_sec = now.tv_sec + 1;
+        ts.tv_nsec = now.tv_usec * 1000;
+        pthread_cond_timedwait(&pThis->m_cond, &pThis->m_mutex, &ts);
+      }
+      pthread_mutex_unlock(&pThis->m_mutex);
+      pThis->m_bSleeping.store(false, std::memory_order_relaxed);
+      continue;
+    }
+
+    for (size_t i = 0; i < n; ++i) recs[i] = items[i].rec;
+
+    /* O_APPEND 一次 write 整批落在文件末尾，不会和别的 worker 交错 */
+    bool bOk = true;
+    const char *p = (const char *)recs.data();
+    size_t iLeft = n * sizeof(ngx_journal_rec_t);
+    while (iLeft > 0) {
+      ssize_t w = write(pThis->m_fd, p, iLeft);
+      if (w < 0) {
+        if (errno == EINTR) continue;
+        ngx_log_error_core(NGX_LOG_ERR, errno,
+                           "CUserJournal::FlushThread()->write() failed");
+        bOk = false;
+        break;
+      }
+      p += w;
+      iLeft -= w;
+    }
+    ++pThis->m_iWriteCount;
+    if (bOk) pThis->m_iRecordCount += (int)n;
+
+    if (bOk && pThis->m_iSyncMode == NGX_JOURNAL_SYNC_DATA) {
+      if (fdatasync(pThis->m_fd) == -1) {
+        ngx_log_error_core(NGX_LOG_ERR, errno,
+                           "CUserJournal::FlushThread()->fdatasync() failed");
+        bOk = false;
+      }
+      ++pThis->m_iSyncCount;
+    }
+
+    for (size_t i = 0; i < n; ++i) {
+      CJournalAwaiter *pWaiter = items[i].pWaiter;
+      if (pWaiter == nullptr) continue;
+      /* 恢复以后 pWaiter 所在的协程帧随时可能没了，先取出句柄 */
+      CCoTask::handle_t h = pWaiter->hWaiter;
+      pWaiter->bOk = bOk;
+      CCoScheduler::Resume(h);
+    }
+  }
+  return (void *)0;
+}
+
+/*
+ * @ Description: 恢复线程 校验一段记录，插回用户表
+ * @ Parameter: void *threadData(ngx_journal_recover_s)
+ * @ Return: void*
+ */
+void *CUserJournal::RecoverThread(void *threadData) {
+  ngx_journal_recover_s *pPart = static_cast<ngx_journal_recover_s *>(threadData);
+  CUserRegistry *pRegistry = CUserRegistry::GetInstance();
+
+  for (size_t i = pPart->iBegin; i < pPart->iEnd; ++i) {
+    const ngx_journal_rec_t *pRec = &pPart->pRecs[i];
+    if (pRec->iMagic != NGX_JOURNAL_MAGIC ||
+        pRec->iCrc != ngx_journal_crc(pRec)) {
+      ++pPart->iBad;
+      continue;
+    }
+    /* 记录是自己写的，这里补0只是防坏文件 */
+    char username[NGX_USER_NAME_LEN];
+    memcpy(username, pRec->username, NGX_USER_NAME_LEN);
+    username[NGX_USER_NAME_LEN - 1] = 0;
+    if (pRegistry->Restore(username, pRec->cred, pRec->iType,
+                           pRec->iUserId) == NGX_USER_OK)
+      ++pPart->iRestored;
+    else
+      ++pPart->iSkipped;
+  }
+  return (void *)0;
+}
+
+/*
+ * @ Description: mmap 整个日志，切成几段多线程恢复，用户表分片锁让它们不互相等
+ *   在 master 里做，线程都 join 完才 fork
+ * @ Parameter: int iThreads
+ * @ Return: bool
+ */
+bool CUserJournal::Recover(int iThreads) {
+  struct stat st;
+  if (fstat(m_fd, &st) == -1) {
+    ngx_log_error_core(NGX_LOG_ERR, errno,
+                       "CUserJournal::Recover()->fstat() failed");
+    return false;
+  }
+  size_t iCount = st.st_size / sizeof(ngx_journal_rec_t);
+  if (iCount == 0) return true;
+
+  struct timeval tvBegin, tvEnd;
+  gettimeofday(&tvBegin, NULL);
+
+  size_t iLen = iCount * sizeof(ngx_journal_rec_t);
+  void *pMap = mmap(NULL, iLen, PROT_READ, MAP_SHARED, m_fd, 0);
+  if (pMap == MAP_FAILED) {
+    ngx_log_error_core(NGX_LOG_ERR, errno,
+                       "CUserJournal::Recover()->mmap() failed");
+    return false;
+  }
+  madvise(pMap, iLen, MADV_WILLNEED);
+
+  if ((size_t)iThreads > iCount) iThreads = (int)iCount;
+  std::vector<ngx_journal_recover_s> parts(iThreads);
+  for (int i = 0; i < iThreads; ++i) {
+    parts[i].pRecs = (const ngx_journal_rec_t *)pMap;
+    parts[i].iBegin = iCount * i / iThreads;
+    parts[i].iEnd = iCount * (i + 1) / iThreads;
+    parts[i].iRestored = parts[i].iBad = parts[i].iSkipped = 0;
+  }
+
+  /* 第0段当前线程自己做，起不了线程的段也是 */
+  std::vector<pthread_t> tids;
+  for (int i = 1; i < iThreads; ++i) {
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, RecoverThread, &parts[i]) == 0)
+      tids.push_back(tid);
+    else
+      RecoverThread(&parts[i]);
+  }
+  RecoverThread(&parts[0]);
+  for (size_t i = 0; i < tids.size(); ++i) pthread_join(tids[i], NULL);
+  munmap(pMap, iLen);
+
+  int iRestored = 0, iBad = 0, iSkipped = 0;
+  for (int i = 0; i < iThreads; ++i) {
+    iRestored += parts[i].iRestored;
+    iBad += parts[i].iBad;
+    iSkipped += parts[i].iSkipped;
+  }
+  gettimeofday(&tvEnd, NULL);
+  int iMs = (int)((tvEnd.tv_sec - tvBegin.tv_sec) * 1000 +
+                  (tvEnd.tv_usec - tvBegin.tv_usec) / 1000);
+  ngx_log_error_core(NGX_LOG_NOTICE, 0,
+                     "CUserJournal::Recover() %d records, restored %d, bad %d, "
+                     "skipped %d, %d threads, %dms",
+                     (int)iCount, iRestored, iBad, iSkipped,
+                     (int)tids.size() + 1, iMs);
+  return true;
+}
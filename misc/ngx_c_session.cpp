@@ -0,0 +1,201 @@
+/*
+ * @Author: agent
+ * @Date: 2026-10-19 15:43:27
+ * @Last Modified by: agent
+ * @Last Modified time: 2026-10-19 15:43:27
+ * @Description: 会话表
+ */
+
+#include "ngx_c_session.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/random.h>
+#include <time.h>
+
+#include "ngx_func.h"
+#include "ngx_global.h"
+#include "ngx_macro.h"
+
+/* 跨进程用的原子量必须是无锁的 */
+static_assert(std::atomic<uint32_t>::is_always_lock_free &&
+                  std::atomic<pid_t>::is_always_lock_free,
+              "session table needs lock-free 32-bit atomics");
+
+#define NGX_SESSION_PROBE 64 /* 新建会话最多看多少个槽位 */
+#define NGX_SESSION_READ_RETRY 1024 /* 查会话最多重读几次 */
+
+CSessionTable *CSessionTable::m_instance = nullptr;
+
+/*
+ * @ Description: 构造函数
+ */
+CSessionTable::CSessionTable()
+    : m_pShm(nullptr),
+      m_pSlots(nullptr),
+      m_iCapacity(0),
+      m_iTimeout(0),
+      m_iMemLen(0) {}
+
+/*
+ * @ Description: 析构函数 每个进程解除自己的映射
+ */
+CSessionTable::~CSessionTable() {
+  if (m_pShm != nullptr) {
+    munmap(m_pShm, m_iMemLen);
+    m_pShm = nullptr;
+  }
+}
+
+/*
+ * @ Description: master 创建共享内存，要在 fork worker 之前调用
+ * @ Parameter: int iCapacity(槽位数), int iTimeout(会话有效期 秒)
+ * @ Return: bool
+ */
+bool CSessionTable::Create(int iCapacity, int iTimeout) {
+  if (iCapacity < 1024) iCapacity = 1024;
+  if (iTimeout < 60) iTimeout = 60;
+
+  m_iCapacity = iCapacity;
+  m_iTimeout = iTimeout;
+  m_iMemLen =
+      sizeof(ngx_session_shm_t) + (size_t)iCapacity * sizeof(ngx_session_slot_t);
+  void *p = mmap(NULL, m_iMemLen, PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (p == MAP_FAILED) {
+    ngx_log_error_core(NGX_LOG_ERR, errno,
+                       "CSessionTable::Create()->mmap(%d) failed", iCapacity);
+    return false;
+  }
+
+  /* 匿名映射本来就是全0，全0就是所有槽位空 */
+  m_pShm = (lpngx_session_shm_t)p;
+  m_pSlots = (lpngx_session_slot_t)(m_pShm + 1);
+
+  ngx_log_error_core(NGX_LOG_NOTICE, 0,
+                     "CSessionTable::Create() %d slots, timeout %ds, %d MB",
+                     iCapacity, iTimeout, (int)(m_iMemLen >> 20));
+  return true;
+}
+
+/*
+ * @ Description: 写槽位的进程已经不在了，抢过来把顺序锁改回偶数、过期时间清0
+ *   抢到之后槽位归调用者写
+ * @ Parameter: lpngx_session_slot_t pSlot, pid_t iOwner(看到的写的进程)
+ * @ Return: bool(进程还活着或者被别人抢先收回返回false)
+ */
+bool CSessionTable::reclaimSlot(lpngx_session_slot_t pSlot, pid_t iOwner) {
+  if (kill(iOwner, 0) == 0 || errno != ESRCH) return false;
+  if (!pSlot->iOwner.compare_exchange_strong(iOwner, ngx_pid,
+                                             std::memory_order_acquire))
+    return false;
+  pSlot->iExpire.store(0, std::memory_order_relaxed);
+  uint32_t iSeq = pSlot->iSeq.load(std::memory_order_relaxed);
+  if (iSeq & 1) pSlot->iSeq.store(iSeq + 1, std::memory_order_release);
+  ngx_log_error_core(NGX_LOG_WARN, 0,
+                     "CSessionTable::reclaimSlot() slot %d left by pid %d",
+                     (int)(pSlot - m_pSlots), (int)iOwner);
+  return true;
+}
+
+/*
+ * @ Description: 新建会话 从共享游标开始找一个空的或者过期的槽位占用
+ * @ Parameter: const char *username, uint32_t iUserId,
+ *   unsigned char *pToken(返回令牌 NGX_SESSION_TOKEN_LEN 字节)
+ * @ Return: bool(没有空槽或者取随机数失败返回false)
+ */
+bool CSessionTable::Open(const char *username, uint32_t iUserId,
+                         unsigned char *pToken) {
+  if (getrandom(pToken + 4, NGX_SESSION_TOKEN_LEN - 4, 0) !=
+      NGX_SESSION_TOKEN_LEN - 4) {
+    ngx_log_error_core(NGX_LOG_ERR, errno,
+                       "CSessionTable::Open()->getrandom() failed");
+    return false;
+  }
+
+  uint32_t now = (uint32_t)time(NULL);
+  for (int i = 0; i < NGX_SESSION_PROBE; ++i) {
+    uint32_t idx = m_pShm->iCursor.fetch_add(1, std::memory_order_relaxed) %
+                   (uint32_t)m_iCapacity;
+    lpngx_session_slot_t pSlot = &m_pSlots[idx];
+
+    uint32_t iExpire = pSlot->iExpire.load(std::memory_order_relaxed);
+    if (iExpire > now) continue; /* 还在用 */
+    pid_t iOwner = 0;
+    if (!pSlot->iOwner.compare_exchange_strong(iOwner, ngx_pid,
+                                               std::memory_order_acquire)) {
+      if (!reclaimSlot(pSlot, iOwner)) continue; /* 别人正在写 */
+      iExpire = 0;
+    }
+    /* 占住之后顺序锁改成奇数，再把过期时间清0
+     * 和并发的续期抢，抢输了就放掉 */
+    uint32_t iSeq = pSlot->iSeq.load(std::memory_order_relaxed);
+    pSlot->iSeq.store(iSeq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    if (iExpire > 0 && !pSlot->iExpire.compare_exchange_strong(
+                           iExpire, 0, std::memory_order_relaxed)) {
+      pSlot->iSeq.store(iSeq + 2, std::memory_order_release);
+      pSlot->iOwner.store(0, std::memory_order_release);
+      continue;
+    }
+
+    uint32_t iIndex = htonl(idx);
+    memcpy(pToken, &iIndex, 4);
+    memcpy(pSlot->token, pToken, NGX_SESSION_TOKEN_LEN);
+    pSlot->iUserId = iUserId;
+    strncpy(pSlot->username, username, NGX_USER_NAME_LEN - 1);
+    pSlot->username[NGX_USER_NAME_LEN - 1] = 0;
+
+    pSlot->iExpire.store(now + m_iTimeout, std::memory_order_relaxed);
+    pSlot->iSeq.store(iSeq + 2, std::memory_order_release);
+    pSlot->iOwner.store(0, std::memory_order_release);
+    return true;
+  }
+  return false;
+}
+
+/*
+ * @ Description: 凭令牌查会话 不加锁，读到一半被改了就重读
+ *   重读 NGX_SESSION_READ_RETRY 次还在写(写的人可能死了)就当没查到
+ *   剩余有效期不到一半时续期
+ * @ Parameter: const unsigned char *pToken, uint32_t *pUserId,
+ *   char *pUserName(NGX_USER_NAME_LEN 字节)
+ * @ Return: bool(令牌不对或者过期返回false)
+ */
+bool CSessionTable::Lookup(const unsigned char *pToken, uint32_t *pUserId,
+                           char *pUserName) {
+  uint32_t idx;
+  memcpy(&idx, pToken, 4);
+  idx = ntohl(idx);
+  if (idx >= (uint32_t)m_iCapacity) return false;
+  lpngx_session_slot_t pSlot = &m_pSlots[idx];
+
+  /* 先看过期，没过期的槽位不会被抢走，之后读到的令牌不对就说明换人了 */
+  uint32_t now = (uint32_t)time(NULL);
+  uint32_t iExpire = pSlot->iExpire.load(std::memory_order_relaxed);
+  if (iExpire <= now) return false;
+
+  unsigned char token[NGX_SESSION_TOKEN_LEN];
+  int i = 0;
+  for (; i < NGX_SESSION_READ_RETRY; ++i) {
+    uint32_t iSeq = pSlot->iSeq.load(std::memory_order_acquire);
+    if (iSeq & 1) continue; /* 写的人很快，转一下就好 */
+    memcpy(token, pSlot->token, NGX_SESSION_TOKEN_LEN);
+    *pUserId = pSlot->iUserId;
+    memcpy(pUserName, pSlot->username, NGX_USER_NAME_LEN);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (pSlot->iSeq.load(std::memory_order_relaxed) == iSeq) break;
+  }
+  if (i == NGX_SESSION_READ_RETRY) return false;
+  if (memcmp(token, pToken, NGX_SESSION_TOKEN_LEN) != 0) return false;
+
+  if (iExpire - now < (uint32_t)m_iTimeout / 2) {
+    /* 续期 失败说明别人刚续过或者槽位刚被抢走，都不影响这次结果 */
+    pSlot->iExpire.compare_exchange_strong(iExpire, now + m_iTimeout,
+                                           std::memory_order_relaxed);
+  }
+  return true;
+}
@@ -0,0 +1,216 @@
+/*
+ * @Author: agent
+ * @Date: 2026-10-19 15:47:25
+ * @Last Modified by: agent
+ * @Last Modified time: 2026-10-19 15:47:25
+ * @Description: SHA-256 和 PBKDF2-HMAC-SHA256
+ */
+
+#include "ngx_c_sha256.h"
+
+#include <string.h>
+
+static const uint32_t ngx_sha256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+    0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+    0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+    0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+    0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+    0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+
+static inline uint32_t ngx_sha256_ror(uint32_t x, int n) {
+  return (x >> n) | (x << (32 - n));
+}
+
+/*
+ * @ Description: 回到初始哈希值
+ * @ Parameter: void
+ * @ Return: void
+ */
+void CSHA256::Init() {
+  m_state[0] = 0x6a09e667;
+  m_state[1] = 0xbb67ae85;
+  m_state[2] = 0x3c6ef372;
+  m_state[3] = 0xa54ff53a;
+  m_state[4] = 0x510e527f;
+  m_state[5] = 0x9b05688c;
+  m_state[6] = 0x1f83d9ab;
+  m_state[7] = 0x5be0cd19;
+  m_iLen = 0;
+}
+
+/*
+ * @ Description: 压缩一组 64 字节，大端读入
+ * @ Parameter: const unsigned char *pBlock
+ * @ Return: void
+ */
+void CSHA256::Transform(const unsigned char *pBlock) {
+  uint32_t w[64];
+  for (int i = 0; i < 16; ++i)
+    w[i] = (uint32_t)pBlock[4 * i] << 24 | (uint32_t)pBlock[4 * i + 1] << 16 |
+           (uint32_t)pBlock[4 * i + 2] << 8 | (uint32_t)pBlock[4 * i + 3];
+  for (int i = 16; i < 64; ++i) {
+    uint32_t s0 = ngx_sha256_ror(w[i - 15], 7) ^
+                  ngx_sha256_ror(w[i - 15], 18) ^ (w[i - 15] >> 3);
+    uint32_t s1 = ngx_sha256_ror(w[i - 2], 17) ^
+                  ngx_sha256_ror(w[i - 2], 19) ^ (w[i - 2] >> 10);
+    w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+  }
+
+  uint32_t a = m_state[0], b = m_state[1], c = m_state[2], d = m_state[3];
+  uint32_t e = m_state[4], f = m_state[5], g = m_state[6], h = m_state[7];
+  for (int i = 0; i < 64; ++i) {
+    uint32_t S1 = ngx_sha256_ror(e, 6) ^ ngx_sha256_ror(e, 11) ^
+                  ngx_sha256_ror(e, 25);
+    uint32_t ch = (e & f) ^ (~e & g);
+    uint32_t t1 = h + S1 + ch + ngx_sha256_k[i] + w[i];
+    uint32_t S0 = ngx_sha256_ror(a, 2) ^ ngx_sha256_ror(a, 13) ^
+                  ngx_sha256_ror(a, 22);
+    uint32_t maj = (a & b) ^ (a & c) ^ (b & c);
+    uint32_t t2 = S0 + maj;
+    h = g;
+    g = f;
+    f = e;
+    e = d + t1;
+    d = c;
+    c = b;
+    b = a;
+    a = t1 + t2;
+  }
+  m_state[0] += a;
+  m_state[1] += b;
+  m_state[2] += c;
+  m_state[3] += d;
+  m_state[4] += e;
+  m_state[5] += f;
+  m_state[6] += g;
+  m_state[7] += h;
+}
+
+/*
+ * @ Description: 接着吸收数据，凑满一组就压缩
+ * @ Parameter: const unsigned char *pData, size_t iLen
+ * @ Return: void
+ */
+void CSHA256::Update(const unsigned char *pData, size_t iLen) {
+  size_t iHave = m_iLen % NGX_SHA256_BLOCK;
+  m_iLen += iLen;
+  if (iHave != 0) {
+    size_t n = NGX_SHA256_BLOCK - iHave;
+    if (iLen < n) {
+      memcpy(m_buf + iHave, pData, iLen);
+      return;
+    }
+    memcpy(m_buf + iHave, pData, n);
+    Transform(m_buf);
+    pData += n;
+    iLen -= n;
+  }
+  for (; iLen >= NGX_SHA256_BLOCK; iLen -= NGX_SHA256_BLOCK) {
+    Transform(pData);
+    pData += NGX_SHA256_BLOCK;
+  }
+  memcpy(m_buf, pData, iLen);
+}
+
+/*
+ * @ Description: 补位加长度，输出大端摘要 之后要 Init 才能再用
+ * @ Parameter: unsigned char *pDigest(NGX_SHA256_LEN 字节)
+ * @ Return: void
+ */
+void CSHA256::Final(unsigned char *pDigest) {
+  uint64_t iBits = m_iLen * 8;
+  size_t iHave = m_iLen % NGX_SHA256_BLOCK;
+  m_buf[iHave++] = 0x80;
+  if (iHave > NGX_SHA256_BLOCK - 8) {
+    memset(m_buf + iHave, 0, NGX_SHA256_BLOCK - iHave);
+    Transform(m_buf);
+    iHave = 0;
+  }
+  memset(m_buf + iHave, 0, NGX_SHA256_BLOCK - 8 - iHave);
+  for (int i = 0; i < 8; ++i)
+    m_buf[NGX_SHA256_BLOCK - 1 - i] = (unsigned char)(iBits >> (8 * i));
+  Transform(m_buf);
+
+  for (int i = 0; i < 8; ++i) {
+    pDigest[4 * i] = (unsigned char)(m_state[i] >> 24);
+    pDigest[4 * i + 1] = (unsigned char)(m_state[i] >> 16);
+    pDigest[4 * i + 2] = (unsigned char)(m_state[i] >> 8);
+    pDigest[4 * i + 3] = (unsigned char)m_state[i];
+  }
+}
+
+/*
+ * @ Description: PBKDF2-HMAC-SHA256 (RFC 8018)
+ *   HMAC 的内外两层上下文只算一次，之后每轮从它们拷贝
+ *   用过的密钥块和中间值都清掉，不在栈上留密码
+ * @ Parameter: const char *password, size_t iPassLen,
+ *   const unsigned char *salt, size_t iSaltLen, uint32_t iRounds(至少1),
+ *   unsigned char *pOut, size_t iOutLen
+ * @ Return: void
+ */
+void CSHA256::Pbkdf2(const char *password, size_t iPassLen,
+                     const unsigned char *salt, size_t iSaltLen,
+                     uint32_t iRounds, unsigned char *pOut, size_t iOutLen) {
+  unsigned char key[NGX_SHA256_BLOCK];
+  memset(key, 0, sizeof(key));
+  if (iPassLen > NGX_SHA256_BLOCK) {
+    CSHA256 kh;
+    kh.Update((const unsigned char *)password, iPassLen);
+    kh.Final(key);
+  } else {
+    memcpy(key, password, iPassLen);
+  }
+
+  CSHA256 inner, outer;
+  unsigned char pad[NGX_SHA256_BLOCK];
+  for (int i = 0; i < NGX_SHA256_BLOCK; ++i) pad[i] = key[i] ^ 0x36;
+  inner.Update(pad, NGX_SHA256_BLOCK);
+  for (int i = 0; i < NGX_SHA256_BLOCK; ++i) pad[i] = key[i] ^ 0x5c;
+  outer.Update(pad, NGX_SHA256_BLOCK);
+  explicit_bzero(key, sizeof(key));
+  explicit_bzero(pad, sizeof(pad));
+
+  CSHA256 ctx;
+  unsigned char u[NGX_SHA256_LEN], t[NGX_SHA256_LEN];
+  for (uint32_t iBlock = 1; iOutLen > 0; ++iBlock) {
+    /* U1 = HMAC(P, S || INT(i)) */
+    unsigned char be[4] = {(unsigned char)(iBlock >> 24),
+                           (unsigned char)(iBlock >> 16),
+                           (unsigned char)(iBlock >> 8), (unsigned char)iBlock};
+    ctx = inner;
+    ctx.Update(salt, iSaltLen);
+    ctx.Update(be, sizeof(be));
+    ctx.Final(u);
+    ctx = outer;
+    ctx.Update(u, NGX_SHA256_LEN);
+    ctx.Final(u);
+    memcpy(t, u, NGX_SHA256_LEN);
+
+    /* Uj = HMAC(P, Uj-1)，全部异或起来 */
+    for (uint32_t j = 1; j < iRounds; ++j) {
+      ctx = inner;
+      ctx.Update(u, NGX_SHA256_LEN);
+      ctx.Final(u);
+      ctx = outer;
+      ctx.Update(u, NGX_SHA256_LEN);
+      ctx.Final(u);
+      for (int k = 0; k < NGX_SHA256_LEN; ++k) t[k] ^= u[k];
+    }
+
+    size_t n = (iOutLen < NGX_SHA256_LEN) ? iOutLen : NGX_SHA256_LEN;
+    memcpy(pOut, t, n);
+    pOut += n;
+    iOutLen -= n;
+  }
+  explicit_bzero(u, sizeof(u));
+  explicit_bzero(t, sizeof(t));
+  explicit_bzero(&inner, sizeof(inner));
+  explicit_bzero(&outer, sizeof(outer));
+  explicit_bzero(&ctx, sizeof(ctx));
+}
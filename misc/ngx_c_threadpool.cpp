@@ -8,28 +8,113 @@
 
 #include "ngx_c_threadpool.h"
 
+#include <arpa/inet.h>
+#include <errno.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <time.h>
 #include <unistd.h>
 
+#include <algorithm>
+
+#include "ngx_c_conf.h"
+#include "ngx_c_lockmutex.h"
 #include "ngx_c_memory.h"
 #include "ngx_c_socket.h"
 #include "ngx_func.h"
 #include "ngx_global.h"
 #include "ngx_macro.h"
 
+/* 自旋等待时让出流水线，减少对超线程兄弟的影响 */
+static inline void ngx_cpu_pause() {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#else
+  __asm__ __volatile__("" ::: "memory");
+#endif
+}
+
+/* *pAddr 还等于 iVal 就睡，iSec > 0 时最多睡这么多秒 超时返回 false */
+static inline bool ngx_futex_wait(std::atomic<int>* pAddr, int iVal,
+                                  int iSec) {
+  struct timespec ts = {iSec, 0};
+  long r = syscall(SYS_futex, (int*)pAddr, FUTEX_WAIT_PRIVATE, iVal,
+                   iSec > 0 ? &ts : NULL, NULL, 0);
+  return !(r == -1 && errno == ETIMEDOUT);
+}
+
+/* 唤醒在 *pAddr 上睡的最多 iNum 个线程 */
+static inline void ngx_futex_wake(std::atomic<int>* pAddr, int iNum) {
+  syscall(SYS_futex, (int*)pAddr, FUTEX_WAKE_PRIVATE, iNum, NULL, NULL, 0);
+}
+
+/* 收到消息的消息码，超出的记在最后一个 */
+static inline int ngx_recv_msgcode(char* buf) {
+  LPCOMM_PKG_HEADER pPkgHeader =
+      (LPCOMM_PKG_HEADER)(buf + sizeof(STRUC_MSG_HEADER));
+  int iCode = ntohs(pPkgHeader->msgCode);
+  return ngx_min(iCode, NGX_MAX_MSGCODE - 1);
+}
+
 pthread_mutex_t CThreadPool::m_pthreadMutex = PTHREAD_MUTEX_INITIALIZER;
-pthread_cond_t CThreadPool::m_pthreadCond = PTHREAD_COND_INITIALIZER;
+std::atomic<int> CThreadPool::m_iWakeSeq(0);
 bool CThreadPool::m_shutdown = false;
 
 /*
  * @ Description: 构造函数
  */
 CThreadPool::CThreadPool()
-    : m_iRunningThreadNUm(0), m_iLastEmgTime(0), m_iRecvMsgQueueCount(0) {}
+    : m_iThreadNUm(0),
+      m_iThreadMin(0),
+      m_iThreadMax(0),
+      m_iWaitTargetUs(0),
+      m_iIdleExitSec(0),
+      m_iAdjustIntervalUs(0),
+      m_iLastRecvWaitUs(0),
+      m_iRecvWaitSum(0),
+      m_iRecvWaitCnt(0),
+      m_iGrowCount(0),
+      m_iShrinkCount(0),
+      m_iNextIndex(0),
+      m_bAdjustStarted(false),
+      m_iBatchNum(1),
+      m_iSpinNum(0),
+      m_iSchedMode(NGX_SCHED_SHARED),
+      m_iNextThread(0),
+      m_iStealCount(0),
+      m_iRunningThreadNUm(0),
+      m_iWaitingThreadNum(0),
+      m_iSignalCount(0),
+      m_iLastEmgTime(0),
+      m_iRecvMsgQueueCount(0),
+      m_iRecvMsgFullCount(0),
+      m_iTaskQueueSize(0),
+      m_iTaskCount(0),
+      m_iQuotaDeferCount(0),
+      m_iClassSchedLen(0),
+      m_iClassTick(0) {
+  memset(m_iMsgClass, 0, sizeof(m_iMsgClass));
+  memset(m_iMsgQuota, 0, sizeof(m_iMsgQuota));
+  memset(m_iMsgRunning, 0, sizeof(m_iMsgRunning));
+  for (int i = 0; i < NGX_RECV_CLASS_N; ++i) {
+    m_iClassWaitSum[i] = 0;
+    m_iClassWaitCnt[i] = 0;
+  }
+  pthread_mutex_init(&m_threadVectorMutex, NULL);
+  pthread_mutex_init(&m_quotaMutex, NULL);
+}
 
 /*
  * @ Description: 析构函数
  */
-CThreadPool::~CThreadPool() { clearMsgRecvQueue(); }
+CThreadPool::~CThreadPool() {
+  clearMsgRecvQueue();
+  pthread_mutex_destroy(&m_threadVectorMutex);
+  pthread_mutex_destroy(&m_quotaMutex);
+}
 
 /*
  * @ Description: 创建线程池中的线程
@@ -40,11 +125,60 @@ bool CThreadPool::Create(int threadnums) {
   ThreadItem* pNew;
   int err;
 
+  CConfig* p_config = CConfig::GetInstance();
+
+  m_iSchedMode =
+      p_config->GetIntDefault("ProcMsgRecvSchedMode", NGX_SCHED_SHARED);
+  if (m_iSchedMode != NGX_SCHED_STEAL && m_iSchedMode != NGX_SCHED_AFFINE)
+    m_iSchedMode = NGX_SCHED_SHARED;
+
+  /* 线程数上下限，不配置就是固定 threadnums 个 */
+  m_iThreadMin = p_config->GetIntDefault("ProcMsgRecvWorkThreadMin", threadnums);
+  m_iThreadMax = p_config->GetIntDefault("ProcMsgRecvWorkThreadMax", threadnums);
+  if (m_iThreadMin < 1) m_iThreadMin = 1;
+  if (m_iThreadMax < m_iThreadMin) m_iThreadMax = m_iThreadMin;
+  if (threadnums < m_iThreadMin) threadnums = m_iThreadMin;
+  if (threadnums > m_iThreadMax) threadnums = m_iThreadMax;
+  m_iWaitTargetUs = p_config->GetIntDefault("ProcMsgRecvWaitTargetUs", 2000);
+  m_iIdleExitSec = p_config->GetIntDefault("ProcMsgRecvIdleExitSec", 30);
+  if (m_iIdleExitSec < 1) m_iIdleExitSec = 1;
+  m_iAdjustIntervalUs =
+      (uint64_t)p_config->GetIntDefault("ProcMsgRecvAdjustMs", 100) * 1000;
+  if (m_iAdjustIntervalUs < 1000) m_iAdjustIntervalUs = 1000;
+
   m_iThreadNUm = threadnums;
 
-  for (int i = 0; i < m_iThreadNUm; ++i) { /* 创建线程 */
+  /* 每次最多取几条，取不到时自旋几次再睡 */
+  m_iBatchNum = p_config->GetIntDefault("ProcMsgRecvBatch", 1);
+  if (m_iBatchNum < 1) m_iBatchNum = 1;
+  if (m_iBatchNum > NGX_RECV_BATCH_MAX) m_iBatchNum = NGX_RECV_BATCH_MAX;
+  m_iSpinNum = p_config->GetIntDefault("ProcMsgRecvSpin", 0);
+  if (m_iSpinNum < 0) m_iSpinNum = 0;
+
+  /* 队列容量，满了拒绝入队由调用者丢包
+     shared 模式每个类别一个环形队列，steal/affine 模式各线程平分 */
+  int iQueueSize = p_config->GetIntDefault("ProcMsgRecvQueueSize", 65536);
+  if (iQueueSize < 64) iQueueSize = 64;
+  m_iQueueCap = iQueueSize / m_iThreadNUm;
+  if (m_iQueueCap < 64) m_iQueueCap = 64;
+  if (m_iSchedMode == NGX_SCHED_SHARED) {
+    for (int i = 0; i < NGX_RECV_CLASS_N; ++i)
+      m_MsgRecvRing[i].Init(iQueueSize);
+  }
+  initRecvClass();
+
+  /* 先把容器建好再起线程，偷取时要遍历容器 */
+  for (int i = 0; i < m_iThreadNUm; ++i) {
+    pNew = new ThreadItem(this, m_iNextIndex++);
+    if (m_iSchedMode == NGX_SCHED_STEAL) {
+      pNew->_inbox.Init(m_iQueueCap);
+      pNew->_deque.Init(NGX_STEAL_REFILL);
+    }
+    m_threadVector.push_back(pNew);
+  }
 
-    m_threadVector.push_back(pNew = new ThreadItem(this));
+  for (int i = 0; i < m_iThreadNUm; ++i) { /* 创建线程 */
+    pNew = m_threadVector[i];
 
     err = pthread_create(&pNew->_Handle, NULL, ThreadFunc, pNew);
     if (err != 0) {
@@ -64,7 +198,24 @@ lblfor:
       goto lblfor;
     }
   }
-  // ngx_log_error_core(NGX_LOG_DEBUG, 0, "CThreadpool::Create() successful");
+
+  /* 扩容在单独的线程里做，不占 epoll 线程 */
+  if (ifAdaptive()) {
+    err = pthread_create(&m_adjustHandle, NULL, AdjustThreadFunc, this);
+    if (err != 0) {
+      ngx_log_error_core(NGX_LOG_ERR, err,
+                         "CThreadPool::Create()->pthread_create() adjust "
+                         "thread failed");
+      return false;
+    }
+    m_bAdjustStarted = true;
+  }
+
+  ngx_log_error_core(NGX_LOG_NOTICE, 0,
+                     "CThreadPool::Create() %d threads [%d, %d], sched mode = "
+                     "%d",
+                     (int)m_iThreadNUm, m_iThreadMin, m_iThreadMax,
+                     m_iSchedMode);
   return true;
 }
 
@@ -79,50 +230,141 @@ void* CThreadPool::ThreadFunc(void* threadData) {
   CThreadPool* pThreadPoolObj = pthread->_pThis;
 
   CMemory* p_memory = CMemory::GetInstance();
-  int err;
+
+  ngx_affinity_bind_thread(NGX_THREAD_LOGIC);
 
   pthread_t tid = pthread_self();
   if (tid != pthread->_Handle) {
     // ngx_log_error_core(NGX_LOG_DEBUG, 0, "[thread = %d]tid != _Handle", tid);
   }
 
+  char* jobs[NGX_RECV_BATCH_MAX]; /* 一次取出的一批消息 */
+  bool bExit = false;             /* 空闲太久要退出 */
+
   while (true) {
-    err = pthread_mutex_lock(&m_pthreadMutex);
-    if (err != 0)
-      ngx_log_error_core(
-          NGX_LOG_ERR, err,
-          "CThreadPool::Threadfunc()->pthread_mutex_lock() failed");
+    /* 先把等着恢复的协程跑掉 */
+    int iTask = pThreadPoolObj->runTasks(pthread);
+
+    /* 无锁批量取，取不到自旋一会儿，还取不到再加锁等 */
+    int n = pThreadPoolObj->outMsgRecvBatch(pthread, jobs);
+    for (int i = 0; n == 0 && iTask == 0 && i < pThreadPoolObj->m_iSpinNum;
+         ++i) {
+      ngx_cpu_pause();
+      n = pThreadPoolObj->outMsgRecvBatch(pthread, jobs);
+    }
 
-    while ((pThreadPoolObj->m_MsgRecvQueue.size() == 0) &&
-           m_shutdown == false) { /* 用while防止虚假唤醒 */
-      if (pthread->ifrunning == false) pthread->ifrunning = true;
-/*       ngx_log_error_core(NGX_LOG_DEBUG, 0,
-                         "CThreadPool [tid = %d] pthread wait()", tid); */
-      pthread_cond_wait(&m_pthreadCond, &m_pthreadMutex);
+    char* jobbuf = nullptr;
+    if (n == 0 && iTask > 0) {
+      /* 刚跑过任务，可能又投来了新任务，回去再看一遍，不睡 */
+    } else if (n == 0 && pThreadPoolObj->m_iSchedMode == NGX_SCHED_AFFINE) {
+      /* 只有本线程会取自己的队列，在自己的条件变量上等 */
+      pthread_mutex_lock(&pthread->_queueMutex);
+      while (pthread->_queue.empty() && pthread->_tasks.empty() &&
+             m_shutdown == false) {
+        if (pthread->ifrunning == false) pthread->ifrunning = true;
+        pthread->_bWaiting = true; /* 生产者看到才发信号 */
+        pthread_cond_wait(&pthread->_queueCond, &pthread->_queueMutex);
+        pthread->_bWaiting = false;
+      }
+      if (!pthread->_queue.empty()) {
+        jobbuf = pthread->_queue.front();
+        pthread->_queue.pop_front();
+        --pthread->_iQueueSize;
+        --pThreadPoolObj->m_iRecvMsgQueueCount;
+      }
+      pthread_mutex_unlock(&pthread->_queueMutex);
+    }
+    bool bTimeout = false;
+    while (n == 0 && jobbuf == nullptr && iTask == 0 &&
+           pThreadPoolObj->m_iSchedMode != NGX_SCHED_AFFINE &&
+           pThreadPoolObj->m_iTaskQueueSize == 0 && m_shutdown == false) {
+      /* 先记下唤醒序号，再登记等待、再取一次，和 wakeOne() 里先入队再看等待数
+         配对，两边中间都有全屏障：生产者要么看到有人等去改序号，要么这里能取到；
+         序号在取之后被改了 futex 不会睡，信号不会丢，两边都不用锁
+         steal 模式消息可能投在别的线程，睡前要把所有线程看一遍 */
+      int iSeq = m_iWakeSeq.load();
+      ++pThreadPoolObj->m_iWaitingThreadNum;
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      jobbuf = pThreadPoolObj->outMsgRecvQueue(pthread, true);
+      if (jobbuf == nullptr && pThreadPoolObj->m_iTaskQueueSize == 0 &&
+          m_shutdown == false) {
+        if (pthread->ifrunning == false) pthread->ifrunning = true;
+        /* 动态线程数：空闲超过 m_iIdleExitSec 且高于下限就退出 */
+        if (bTimeout && pThreadPoolObj->shrinkOne())
+          bExit = true;
+        else
+          bTimeout = !ngx_futex_wait(&m_iWakeSeq, iSeq,
+                                     pThreadPoolObj->ifAdaptive()
+                                         ? pThreadPoolObj->m_iIdleExitSec
+                                         : 0);
+      }
+      --pThreadPoolObj->m_iWaitingThreadNum;
+      if (bExit) break;
     }
+    if (bExit) break;
+    if (jobbuf != nullptr) jobs[n++] = jobbuf;
 
     if (m_shutdown) {
-      pthread_mutex_unlock(&m_pthreadMutex);
+      for (int i = 0; i < n; ++i) p_memory->FreeMemory(jobs[i]);
       break;
     }
 
-    char* jobbuf = pThreadPoolObj->m_MsgRecvQueue.front();
-    pThreadPoolObj->m_MsgRecvQueue.pop_front();
-    --pThreadPoolObj->m_iRecvMsgQueueCount;
-    pthread_mutex_unlock(&m_pthreadMutex);
-
     ++pThreadPoolObj->m_iRunningThreadNUm;
 
-    g_socket.threadRecvProcFunc(jobbuf);
-
-    // 释放消息资源
-    p_memory->FreeMemory(jobbuf);
+    for (int i = 0; i < n; ++i) {
+      char* job = jobs[i];
+      bool bHeld = false; /* 推迟后带出来的消息已经占好名额了 */
+      while (job != nullptr) {
+        /* 有并发上限的消息码，满了先推迟，等别的线程处理完带出来 */
+        int iCode = ngx_recv_msgcode(job);
+        bool bQuota = pThreadPoolObj->m_iSchedMode == NGX_SCHED_SHARED &&
+                      pThreadPoolObj->m_iMsgQuota[iCode] > 0;
+        if (bQuota && !bHeld && !pThreadPoolObj->acquireQuota(iCode, job))
+          break;
+
+        /* 统计排队时间 */
+        uint64_t iWait =
+            ngx_time_us() - ((LPSTRUC_MSG_HEADER)job)->iEnqueueTime;
+        int iClass = pThreadPoolObj->m_iMsgClass[iCode];
+        pThreadPoolObj->m_iRecvWaitSum += iWait;
+        ++pThreadPoolObj->m_iRecvWaitCnt;
+        pThreadPoolObj->m_iClassWaitSum[iClass] += iWait;
+        ++pThreadPoolObj->m_iClassWaitCnt[iClass];
+
+        g_socket.threadRecvProcFunc(job);
+        g_socket.recvMsgDone(job); /* 连接排队数减一，必要时恢复读 */
+
+        // 释放消息资源
+        p_memory->FreeMemory(job);
+        job = bQuota ? pThreadPoolObj->releaseQuota(iCode) : nullptr;
+        bHeld = true;
+      }
+    }
     --pThreadPoolObj->m_iRunningThreadNUm;
   }
+  if (bExit) pThreadPoolObj->detachSelf(pthread); /* 之后 pthread 不能再用 */
   // ngx_log_error_core(NGX_LOG_DEBUG, 0, "CThreadPool::ThreadFunc() success");
   return static_cast<void*>(0);
 }
 
+/*
+ * @ Description: 动态调整线程数的线程入口 每 m_iAdjustIntervalUs 看一次
+ * @ Parameter: void*(线程池指针)
+ * @ Return: void*
+ */
+void* CThreadPool::AdjustThreadFunc(void* threadData) {
+  CThreadPool* pThreadPoolObj = static_cast<CThreadPool*>(threadData);
+
+  ngx_affinity_bind_thread(NGX_THREAD_TIMER);
+
+  while (m_shutdown == false) {
+    usleep(pThreadPoolObj->m_iAdjustIntervalUs);
+    if (m_shutdown) break;
+    pThreadPoolObj->adjustThreadNum();
+  }
+  return static_cast<void*>(0);
+}
+
 /*
  * @ Description: 停止所有线程
  * @ Paramater: void
@@ -132,30 +374,44 @@ void CThreadPool::StopAll() {
   // shutdown 已经关了
   if (m_shutdown == true) return;
 
+  /* 在锁内置位，之后空闲退出的线程不再自己摘出容器，留给下面 join */
+  pthread_mutex_lock(&m_threadVectorMutex);
   m_shutdown = true;
+  pthread_mutex_unlock(&m_threadVectorMutex);
+
+  // 先停扩容，之后容器不会再变
+  if (m_bAdjustStarted) pthread_join(m_adjustHandle, NULL);
 
   // 唤醒所有让子线程自己退出
-  int err = pthread_cond_broadcast(&m_pthreadCond);
-  if (err != 0) {
-    ngx_log_error_core(
-        NGX_LOG_ALERT, err,
-        "CThreadPool::StopAll()->pthread_cond_broadcast() failed");
-    return;
+  ++m_iWakeSeq;
+  ngx_futex_wake(&m_iWakeSeq, INT_MAX);
+
+  // affine 模式线程在自己的条件变量上等
+  std::vector<ThreadItem*>::iterator iter;
+  for (iter = m_threadVector.begin(); iter != m_threadVector.end(); ++iter) {
+    pthread_mutex_lock(&(*iter)->_queueMutex);
+    pthread_cond_broadcast(&(*iter)->_queueCond);
+    pthread_mutex_unlock(&(*iter)->_queueMutex);
   }
 
   // 回收
-  std::vector<ThreadItem*>::iterator iter;
   for (iter = m_threadVector.begin(); iter != m_threadVector.end(); ++iter) {
     pthread_join((*iter)->_Handle, NULL);
   }
 
-  // 所有线程池中的线程都返回了
-  pthread_mutex_destroy(&m_pthreadMutex);
-  pthread_cond_destroy(&m_pthreadCond);
-
-  // 释放线程资源
+  // 释放线程资源，steal/affine 模式下线程队列里可能还有没处理的消息
+  CMemory* p_memory = CMemory::GetInstance();
+  char* buf;
   for (iter = m_threadVector.begin(); iter != m_threadVector.end(); ++iter) {
-    if (*iter) delete *iter;
+    if (*iter == nullptr) continue;
+    while (!(*iter)->_queue.empty()) {
+      p_memory->FreeMemory((*iter)->_queue.front());
+      (*iter)->_queue.pop_front();
+    }
+    while ((*iter)->_deque.Pop(buf)) p_memory->FreeMemory(buf);
+    while ((*iter)->_inbox.Capacity() > 1 && (*iter)->_inbox.Pop(buf))
+      p_memory->FreeMemory(buf);
+    delete *iter;
   }
 
   m_threadVector.clear();
@@ -170,12 +426,10 @@ void CThreadPool::StopAll() {
  * @ Return: void
  */
 void CThreadPool::Call() {
-  int err = pthread_cond_signal(&m_pthreadCond);
-  if (err != 0)
-    ngx_log_error_core(NGX_LOG_ALERT, err,
-                       "CThreadPool::Call()->pthread_cond_signal() failed");
+  wakeOne();
 
-  if (m_iThreadNUm == m_iRunningThreadNUm) { /* 不够用了 */
+  if (m_iThreadNUm == m_iRunningThreadNUm &&
+      m_iThreadNUm >= m_iThreadMax) { /* 不够用了，也不能再扩了 */
     time_t currTime = time(NULL);
     if (currTime - m_iLastEmgTime > 10) {
       m_iLastEmgTime = currTime; /* 更新时间 */
@@ -189,34 +443,483 @@ void CThreadPool::Call() {
 }
 
 /*
- * @ Description: 入消息队列，触发条件变量
- * @ Paramater: char *buf(消息队列地址)
+ * @ Description: 投递一个任务给业务线程执行，协程等的事情完成后从这里恢复
+ *   affine 模式投到 iSlot 对应的线程，同一连接的处理仍然在一个线程上
+ *   其他模式进公共任务队列，任何线程都可以取
+ * @ Paramater: ngx_pool_task_pt pHandler, void *pArg,
+ *   int iSlot(连接在连接池中的下标 -1 不指定)
+ * @ Return: void
+ */
+void CThreadPool::postTask(ngx_pool_task_pt pHandler, void* pArg, int iSlot) {
+  ngx_pool_task_t task = {pHandler, pArg};
+
+  if (m_iSchedMode == NGX_SCHED_AFFINE) {
+    unsigned int idx = (iSlot >= 0) ? (unsigned int)iSlot : m_iNextThread++;
+    ThreadItem* pItem = m_threadVector[idx % m_iThreadNUm];
+    pthread_mutex_lock(&pItem->_queueMutex);
+    pItem->_tasks.push_back(task);
+    ++pItem->_iTaskSize;
+    if (pItem->_bWaiting) {
+      pthread_cond_signal(&pItem->_queueCond);
+      ++m_iSignalCount;
+    }
+    pthread_mutex_unlock(&pItem->_queueMutex);
+    return;
+  }
+
+  pthread_mutex_lock(&m_pthreadMutex);
+  m_TaskQueue.push_back(task);
+  ++m_iTaskQueueSize;
+  pthread_mutex_unlock(&m_pthreadMutex);
+
+  wakeOne(); /* 等待的线程登记后会看 m_iTaskQueueSize */
+  return;
+}
+
+/*
+ * @ Description: 执行投递给本线程和公共队列的任务，一次最多 m_iBatchNum 个
+ * @ Paramater: ThreadItem *pItem(当前线程)
+ * @ Return: int 执行的任务数
+ */
+int CThreadPool::runTasks(ThreadItem* pItem) {
+  ngx_pool_task_t tasks[NGX_RECV_BATCH_MAX];
+  int n = 0;
+
+  if (pItem->_iTaskSize > 0) {
+    pthread_mutex_lock(&pItem->_queueMutex);
+    while (n < m_iBatchNum && !pItem->_tasks.empty()) {
+      tasks[n++] = pItem->_tasks.front();
+      pItem->_tasks.pop_front();
+    }
+    pItem->_iTaskSize -= n;
+    pthread_mutex_unlock(&pItem->_queueMutex);
+  }
+  if (n < m_iBatchNum && m_iTaskQueueSize > 0) {
+    int iOld = n;
+    pthread_mutex_lock(&m_pthreadMutex);
+    while (n < m_iBatchNum && !m_TaskQueue.empty()) {
+      tasks[n++] = m_TaskQueue.front();
+      m_TaskQueue.pop_front();
+    }
+    m_iTaskQueueSize -= n - iOld;
+    pthread_mutex_unlock(&m_pthreadMutex);
+  }
+  if (n == 0) return 0;
+
+  ++m_iRunningThreadNUm;
+  for (int i = 0; i < n; ++i) tasks[i].pHandler(tasks[i].pArg);
+  --m_iRunningThreadNUm;
+  m_iTaskCount += n;
+  return n;
+}
+
+/*
+ * @ Description: 唤醒一个等待的线程
+ *   没有线程在等就不唤醒，都醒着的线程自己会来取
+ *   有人等时改唤醒序号再 futex 唤醒一个，不拿锁：
+ *   消费者登记等待前记下了序号，序号变了它就不会睡下去
+ * @ Paramater: void
  * @ Return: void
  */
+void CThreadPool::wakeOne() {
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (m_iWaitingThreadNum > 0) {
+    ++m_iWakeSeq;
+    ngx_futex_wake(&m_iWakeSeq, 1);
+    ++m_iSignalCount;
+  }
+  return;
+}
 
-void CThreadPool::inMsgRecvQueueAndSingal(char* buf) {
-  // mutex
-  int err = pthread_mutex_lock(&m_pthreadMutex);
-  if (err != 0) {
-    ngx_log_error_core(
-        NGX_LOG_ERR, err,
-        "CThreadPool::inMsgRecvQueueAndSingal()->pthread_mutex_lock() failed");
+/*
+ * @ Description: 入消息队列，唤醒业务线程
+ *   队列有界，满了不入队，调用者丢包并释放消息
+ * @ Paramater: char *buf(消息队列地址)
+ * @ Return: bool 入队成功返回 true，队列满返回 false
+ */
+bool CThreadPool::inMsgRecvQueueAndSingal(char* buf) {
+  ((LPSTRUC_MSG_HEADER)buf)->iEnqueueTime = ngx_time_us();
+
+  if (m_iSchedMode == NGX_SCHED_AFFINE) { /* 同一连接固定一个线程 */
+    lpngx_connection_t pConn = ((LPSTRUC_MSG_HEADER)buf)->pConn;
+    ThreadItem* pItem = m_threadVector[pConn->iSlot % m_iThreadNUm];
+    pthread_mutex_lock(&pItem->_queueMutex);
+    if ((int)pItem->_queue.size() >= m_iQueueCap) {
+      pthread_mutex_unlock(&pItem->_queueMutex);
+      ++m_iRecvMsgFullCount;
+      return false;
+    }
+    pItem->_queue.push_back(buf);
+    ++pItem->_iQueueSize;
+    ++m_iRecvMsgQueueCount;
+    if (pItem->_bWaiting) { /* 线程醒着就不用发信号 */
+      pthread_cond_signal(&pItem->_queueCond);
+      ++m_iSignalCount;
+    }
+    pthread_mutex_unlock(&pItem->_queueMutex);
+    return true;
   }
 
-  m_MsgRecvQueue.push_back(buf); /* 入消息队列 */
+  bool bOk;
+  if (m_iSchedMode == NGX_SCHED_STEAL) { /* 轮询放到各线程的收件箱 */
+    bOk = m_threadVector[m_iNextThread++ % m_iThreadNUm]->_inbox.Push(buf);
+  } else { /* 无锁入消息码所属类别的环形队列 */
+    bOk = m_MsgRecvRing[m_iMsgClass[ngx_recv_msgcode(buf)]].Push(buf);
+  }
+  if (!bOk) {
+    ++m_iRecvMsgFullCount;
+    return false;
+  }
   ++m_iRecvMsgQueueCount;
 
-  // unlock
-  err = pthread_mutex_unlock(&m_pthreadMutex);
-  if (err != 0) {
-    ngx_log_error_core(NGX_LOG_ERR, err,
-                       "CThreadPool::inMsgRecvQueueAndSingal()->pthread_mutex_"
-                       "unlock() failed");
+  Call(); /* 有线程在等才唤醒 */
+  return true;
+}
+
+/*
+ * @ Description: 取一条消息
+ *   shared 模式按类别权重从各环形队列取
+ *   steal 模式 先取自己的双端队列，再偷别的线程
+ *   affine 模式 只取自己队列
+ * @ Paramater: ThreadItem *pItem(当前线程),
+ *   bool bFullScan(准备睡之前，偷的时候要把所有线程看一遍)
+ * @ Return: char* 没有消息返回 nullptr
+ */
+char* CThreadPool::outMsgRecvQueue(ThreadItem* pItem, bool bFullScan) {
+  char* buf = nullptr;
+
+  if (m_iSchedMode == NGX_SCHED_STEAL) { /* 先取自己的，没有再去偷 */
+    if (outOwnDeque(pItem, &buf, 1) == 0)
+      buf = stealMsgRecvQueue(pItem, bFullScan);
+    if (buf != nullptr) --m_iRecvMsgQueueCount;
+    return buf;
+  }
+  if (m_iSchedMode == NGX_SCHED_AFFINE) {
+    outThreadQueue(pItem, &buf, 1);
+    if (buf != nullptr) --m_iRecvMsgQueueCount;
+    return buf;
+  }
+
+  if (popRecvRing(&buf, 1) == 1) {
+    --m_iRecvMsgQueueCount;
+    return buf;
+  }
+  return nullptr;
+}
+
+/*
+ * @ Description: steal 模式从自己的双端队列底部取最多 iMax 条，空了从收件箱搬一批
+ *   自己后进先出，别人从顶部偷走的是等得最久的；
+ *   长任务卡住的线程，双端队列和收件箱里排着的消息都会被别人拿走 全程不加锁
+ * @ Paramater: ThreadItem *pItem(当前线程), char **ppJobs, int iMax
+ * @ Return: int 取到的条数
+ */
+int CThreadPool::outOwnDeque(ThreadItem* pItem, char** ppJobs, int iMax) {
+  int n = 0;
+  while (n < iMax && pItem->_deque.Pop(ppJobs[n])) ++n;
+  if (n == iMax) return n;
+
+  /* 只搬双端队列放得下的条数，别人只会偷走不会放进来，算出来的只会偏少 */
+  int iRoom = (int)(pItem->_deque.Capacity() - pItem->_deque.Size());
+  if (iRoom > NGX_STEAL_REFILL) iRoom = NGX_STEAL_REFILL;
+  char* buf;
+  for (int i = 0; i < iRoom && pItem->_inbox.Pop(buf); ++i) {
+    if (pItem->_deque.Push(buf)) continue;
+    /* 放不下就放回收件箱，收件箱刚好又被投满了就自己先处理，这时 n < iMax */
+    if (!pItem->_inbox.Push(buf)) ppJobs[n++] = buf;
+    break;
+  }
+  while (n < iMax && pItem->_deque.Pop(ppJobs[n])) ++n;
+  return n;
+}
+
+/*
+ * @ Description: 动态调整线程数 在 AdjustThreadFunc() 里定时调用
+ *   看上个周期的平均排队时间，超过目标就扩容
+ *   缩容由空闲线程自己在 shrinkOne() 里决定，退出时自己 detachSelf()
+ * @ Paramater: void
+ * @ Return: void
+ */
+void CThreadPool::adjustThreadNum() {
+  uint64_t cnt = m_iRecvWaitCnt.exchange(0);
+  uint64_t sum = m_iRecvWaitSum.exchange(0);
+  if (cnt == 0) return;
+  m_iLastRecvWaitUs = sum / cnt;
+  if (m_iLastRecvWaitUs <= (uint64_t)m_iWaitTargetUs) return;
+
+  int inum = m_iThreadNUm;
+  if (inum >= m_iThreadMax) return;
+
+  /* 每次扩四分之一，至少一个 */
+  int igrow = inum / 4;
+  if (igrow < 1) igrow = 1;
+  if (inum + igrow > m_iThreadMax) igrow = m_iThreadMax - inum;
+
+  int i;
+  CLock lock(&m_threadVectorMutex); /* 退出的线程会从容器里摘掉自己 */
+  for (i = 0; i < igrow; ++i) {
+    ThreadItem* pNew = new ThreadItem(this, m_iNextIndex++);
+    int err = pthread_create(&pNew->_Handle, NULL, ThreadFunc, pNew);
+    if (err != 0) {
+      ngx_log_error_core(NGX_LOG_ERR, err,
+                         "CThreadPool::adjustThreadNum()->pthread_create() "
+                         "failed");
+      delete pNew;
+      break;
+    }
+    m_threadVector.push_back(pNew);
+    ++m_iThreadNUm;
   }
 
-  Call(); /* 唤醒进程 */
-  // ngx_log_error_core(NGX_LOG_DEBUG, 0,
-  //                    "CThreadPool::inMsgRecvQueueAndSingal() success");
+  if (i > 0) {
+    ++m_iGrowCount;
+    ngx_log_error_core(NGX_LOG_NOTICE, 0,
+                       "CThreadPool::adjustThreadNum() wait = %d us, "
+                       "threads %d -> %d",
+                       (int)m_iLastRecvWaitUs, inum, inum + i);
+  }
+  return;
+}
+
+/*
+ * @ Description: 空闲线程申请退出，保证线程数不低于下限
+ * @ Paramater: void
+ * @ Return: bool 可以退出返回 true
+ */
+bool CThreadPool::shrinkOne() {
+  int inum = m_iThreadNUm;
+  while (inum > m_iThreadMin) {
+    if (m_iThreadNUm.compare_exchange_weak(inum, inum - 1)) {
+      ++m_iShrinkCount;
+      return true;
+    }
+  }
+  return false;
+}
+
+/*
+ * @ Description: 空闲退出的线程把自己从容器里摘掉，分离后释放，不用等谁来 join
+ *   线程池已经在停了就什么都不做，由 StopAll() join 和释放
+ * @ Paramater: ThreadItem *pItem(当前线程，返回后不能再用)
+ * @ Return: void
+ */
+void CThreadPool::detachSelf(ThreadItem* pItem) {
+  pthread_mutex_lock(&m_threadVectorMutex);
+  if (m_shutdown) {
+    pthread_mutex_unlock(&m_threadVectorMutex);
+    return;
+  }
+  std::vector<ThreadItem*>::iterator iter =
+      std::find(m_threadVector.begin(), m_threadVector.end(), pItem);
+  if (iter != m_threadVector.end()) m_threadVector.erase(iter);
+  pthread_detach(pItem->_Handle);
+  pthread_mutex_unlock(&m_threadVectorMutex);
+  delete pItem;
+  return;
+}
+
+/*
+ * @ Description: affine 模式从自己的队列头部取最多 iMax 条，一次加锁
+ * @ Paramater: ThreadItem *pItem, char **ppJobs, int iMax
+ * @ Return: int 取到的条数
+ */
+int CThreadPool::outThreadQueue(ThreadItem* pItem, char** ppJobs, int iMax) {
+  if (pItem->_iQueueSize == 0) return 0; /* 空的就不加锁了 */
+
+  int n = 0;
+  pthread_mutex_lock(&pItem->_queueMutex);
+  while (n < iMax && !pItem->_queue.empty()) {
+    ppJobs[n++] = pItem->_queue.front();
+    pItem->_queue.pop_front();
+  }
+  pItem->_iQueueSize -= n;
+  pthread_mutex_unlock(&pItem->_queueMutex);
+  return n;
+}
+
+/*
+ * @ Description: 批量取消息
+ *   shared 模式一次 CAS 从某个类别的环形队列拿一批
+ *   steal 模式不加锁从自己双端队列拿一批，没有再去偷一条
+ *   affine 模式一次加锁从自己队列拿一批
+ * @ Paramater: ThreadItem *pItem, char **ppJobs(至少 m_iBatchNum 个)
+ * @ Return: int 取到的条数
+ */
+int CThreadPool::outMsgRecvBatch(ThreadItem* pItem, char** ppJobs) {
+  int n = 0;
+
+  if (m_iSchedMode == NGX_SCHED_SHARED) {
+    n = popRecvRing(ppJobs, m_iBatchNum);
+  } else if (m_iSchedMode == NGX_SCHED_STEAL) {
+    n = outOwnDeque(pItem, ppJobs, m_iBatchNum);
+  } else {
+    n = outThreadQueue(pItem, ppJobs, m_iBatchNum);
+  }
+
+  if (n > 0) {
+    m_iRecvMsgQueueCount -= n;
+    return n;
+  }
+  if (m_iSchedMode != NGX_SCHED_STEAL) return 0;
+
+  char* buf = stealMsgRecvQueue(pItem, false);
+  if (buf == nullptr) return 0;
+  --m_iRecvMsgQueueCount;
+  ppJobs[0] = buf;
+  return 1;
+}
+
+/*
+ * @ Description: 偷别的线程的消息
+ *   平时只随机探测 NGX_STEAL_PROBE 个线程
+ *   准备睡之前要把所有线程看一遍，否则可能漏掉消息一直睡
+ *   m_threadVector 起线程前就建好，StopAll 等所有线程退出后才清；
+ *   动态增减线程只在 shared 模式(ifAdaptive())，steal 模式中间大小不变，
+ *   所以这里不加锁直接按下标取，改成 steal 模式也能增减线程时这里要加锁
+ * @ Paramater: ThreadItem *pItem(当前线程), bool bFullScan
+ * @ Return: char* 没有消息返回 nullptr
+ */
+char* CThreadPool::stealMsgRecvQueue(ThreadItem* pItem, bool bFullScan) {
+  char* buf = nullptr;
+  int iThreadNum = m_iThreadNUm;
+  int iProbe = bFullScan ? iThreadNum : NGX_STEAL_PROBE;
+  if (iProbe > iThreadNum) iProbe = iThreadNum;
+
+  /* 全量扫描从当前线程下一个开始，随机探测则每次随机选 */
+  int iStart = pItem->_index + 1;
+  for (int i = 0; i < iProbe && buf == nullptr; ++i) {
+    int iVictim = bFullScan ? (iStart + i) % iThreadNum
+                            : rand_r(&pItem->_seed) % iThreadNum;
+    if (iVictim == pItem->_index) continue;
+    /* 先偷双端队列顶部，再取收件箱，都是无锁的 */
+    ThreadItem* pVictim = m_threadVector[iVictim];
+    if (!pVictim->_deque.Steal(buf) && !pVictim->_inbox.Pop(buf))
+      buf = nullptr;
+  }
+
+  if (buf != nullptr) ++m_iStealCount;
+  return buf;
+}
+
+/*
+ * @ Description: 读取各消息码的类别和并发上限，生成类别加权轮转表
+ *   默认值来自 g_socket 的处理表，可以用 ProcMsgRecvClass5 = 2、
+ *   ProcMsgRecvQuota5 = 4 这样按消息码覆盖
+ * @ Paramater: void
+ * @ Return: void
+ */
+void CThreadPool::initRecvClass() {
+  CConfig* p_config = CConfig::GetInstance();
+  char strinfo[100];
+
+  for (int i = 0; i < NGX_MAX_MSGCODE; ++i) {
+    sprintf(strinfo, "ProcMsgRecvClass%d", i);
+    m_iMsgClass[i] = p_config->GetIntDefault(strinfo, g_socket.getRecvClass(i));
+    if (m_iMsgClass[i] < 0 || m_iMsgClass[i] >= NGX_RECV_CLASS_N)
+      m_iMsgClass[i] = NGX_RECV_CLASS_NORMAL;
+    sprintf(strinfo, "ProcMsgRecvQuota%d", i);
+    m_iMsgQuota[i] = p_config->GetIntDefault(strinfo, g_socket.getRecvQuota(i));
+  }
+
+  /* 平滑加权轮转：每步所有类别加上权重，选最大的，选中的减去总权重 */
+  static const int iDefWeight[NGX_RECV_CLASS_N] = {8, 4, 1};
+  int iWeight[NGX_RECV_CLASS_N], iCurrent[NGX_RECV_CLASS_N] = {0};
+  int iTotal = 0;
+  for (int i = 0; i < NGX_RECV_CLASS_N; ++i) {
+    sprintf(strinfo, "ProcMsgRecvClassWeight%d", i);
+    iWeight[i] = p_config->GetIntDefault(strinfo, iDefWeight[i]);
+    if (iWeight[i] < 1) iWeight[i] = 1;
+    if (iWeight[i] > NGX_RECV_SCHED_MAX / NGX_RECV_CLASS_N)
+      iWeight[i] = NGX_RECV_SCHED_MAX / NGX_RECV_CLASS_N;
+    iTotal += iWeight[i];
+  }
+  for (m_iClassSchedLen = 0; m_iClassSchedLen < iTotal; ++m_iClassSchedLen) {
+    int iBest = 0;
+    for (int i = 0; i < NGX_RECV_CLASS_N; ++i) {
+      iCurrent[i] += iWeight[i];
+      if (iCurrent[i] > iCurrent[iBest]) iBest = i;
+    }
+    iCurrent[iBest] -= iTotal;
+    m_iClassSched[m_iClassSchedLen] = iBest;
+  }
+  return;
+}
+
+/*
+ * @ Description: 按加权轮转表选一个类别先取，取不到再按优先级取其他类别
+ *   空闲时不会因为权重让线程白等
+ * @ Paramater: char **ppJobs, int iMax
+ * @ Return: int 取到的条数
+ */
+int CThreadPool::popRecvRing(char** ppJobs, int iMax) {
+  int iFirst = m_iClassSched[m_iClassTick++ % m_iClassSchedLen];
+  int n = m_MsgRecvRing[iFirst].PopBatch(ppJobs, iMax);
+  for (int i = 0; n == 0 && i < NGX_RECV_CLASS_N; ++i) {
+    if (i != iFirst) n = m_MsgRecvRing[i].PopBatch(ppJobs, iMax);
+  }
+  return n;
+}
+
+/*
+ * @ Description: 占一个消息码的并发名额，已满就把消息放进推迟链表
+ *   推迟的消息重新计入收消息队列大小，带出来处理时再减
+ * @ Paramater: int iCode, char *buf
+ * @ Return: bool 占到返回 true，推迟返回 false
+ */
+bool CThreadPool::acquireQuota(int iCode, char* buf) {
+  CLock lock(&m_quotaMutex);
+  if (m_iMsgRunning[iCode] < m_iMsgQuota[iCode]) {
+    ++m_iMsgRunning[iCode];
+    return true;
+  }
+  m_QuotaDefer[iCode].push_back(buf);
+  ++m_iQuotaDeferCount;
+  ++m_iRecvMsgQueueCount; /* 推迟的还算在队列里，不然过载判断少算 */
+  return false;
+}
+
+/*
+ * @ Description: 还一个消息码的并发名额，有推迟的消息就直接占上名额带回去处理
+ *   和 acquireQuota 在同一把锁里，推迟的消息不会没人管
+ * @ Paramater: int iCode
+ * @ Return: char* 推迟的消息，没有返回 nullptr
+ */
+char* CThreadPool::releaseQuota(int iCode) {
+  CLock lock(&m_quotaMutex);
+  --m_iMsgRunning[iCode];
+  if (m_QuotaDefer[iCode].empty() || m_iMsgRunning[iCode] >= m_iMsgQuota[iCode])
+    return nullptr;
+
+  char* buf = m_QuotaDefer[iCode].front();
+  m_QuotaDefer[iCode].pop_front();
+  --m_iRecvMsgQueueCount;
+  ++m_iMsgRunning[iCode];
+  return buf;
+}
+
+/*
+ * @ Description: 类别队列长度和本统计周期的平均排队时间，只读不清零
+ * @ Paramater: int iClass, int &iDepth, int &iWaitUs
+ * @ Return: void
+ */
+void CThreadPool::getRecvClassStat(int iClass, int& iDepth, int& iWaitUs) {
+  iDepth = (int)m_MsgRecvRing[iClass].Size();
+  uint64_t cnt = m_iClassWaitCnt[iClass];
+  uint64_t sum = m_iClassWaitSum[iClass];
+  iWaitUs = cnt ? (int)(sum / cnt) : 0;
+  return;
+}
+
+/*
+ * @ Description: 清零各类别的排队时间统计，由打印统计信息的地方在打印后调用
+ * @ Paramater: void
+ * @ Return: void
+ */
+void CThreadPool::resetRecvClassStat() {
+  for (int i = 0; i < NGX_RECV_CLASS_N; ++i) {
+    m_iClassWaitCnt[i] = 0;
+    m_iClassWaitSum[i] = 0;
+  }
   return;
 }
 
@@ -230,9 +933,16 @@ void CThreadPool::clearMsgRecvQueue() {
   CMemory* p_memory = CMemory::GetInstance();
 
   // 应该不需要互斥了
-  while (!m_MsgRecvQueue.empty()) {
-    sTmpMempoint = m_MsgRecvQueue.front();
-    m_MsgRecvQueue.pop_front();
-    p_memory->FreeMemory(sTmpMempoint);
+  for (int i = 0; i < NGX_RECV_CLASS_N; ++i) {
+    while (m_MsgRecvRing[i].Capacity() > 1 &&
+           m_MsgRecvRing[i].Pop(sTmpMempoint)) {
+      p_memory->FreeMemory(sTmpMempoint);
+    }
+  }
+  for (int i = 0; i < NGX_MAX_MSGCODE; ++i) {
+    while (!m_QuotaDefer[i].empty()) {
+      p_memory->FreeMemory(m_QuotaDefer[i].front());
+      m_QuotaDefer[i].pop_front();
+    }
   }
 }
\ No newline at end of file
@@ -0,0 +1,306 @@
+/*
+ * @Author: agent
+ * @Date: 2026-10-19 15:40:56
+ * @Last Modified by: agent
+ * @Last Modified time: 2026-10-19 15:47:25
+ * @Description: 用户表
+ */
+
+#include "ngx_c_userregistry.h"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/random.h>
+
+#include "ngx_c_crc32.h"
+#include "ngx_c_sha256.h"
+#include "ngx_func.h"
+#include "ngx_macro.h"
+
+/* 跨进程用的原子量必须是无锁的 */
+static_assert(std::atomic<uint32_t>::is_always_lock_free &&
+                  std::atomic<int>::is_always_lock_free,
+              "user registry needs lock-free 32-bit atomics");
+
+CUserRegistry *CUserRegistry::m_instance = nullptr;
+
+/*
+ * @ Description: 构造函数
+ */
+CUserRegistry::CUserRegistry()
+    : m_pShm(nullptr),
+      m_pShards(nullptr),
+      m_iShardNum(0),
+      m_iShardBits(0),
+      m_iCapacity(0),
+      m_iHashRounds(0),
+      m_iMemLen(0) {}
+
+/*
+ * @ Description: 析构函数 每个进程解除自己的映射
+ *   分片锁在共享内存里，别的进程可能还在用，不销毁
+ */
+CUserRegistry::~CUserRegistry() {
+  if (m_pShm != nullptr) {
+    munmap(m_pShm, m_iMemLen);
+    m_pShm = nullptr;
+    m_pShards = nullptr;
+  }
+}
+
+/*
+ * @ Description: master 创建共享内存，要在 fork worker 之前调用
+ *   头、分片、槽位一次 mmap，没用到的页不占物理内存
+ * @ Parameter: int iCapacity(最多多少用户), int iShardNum(分片数),
+ *   int iHashRounds(新注册用户的 PBKDF2 轮数)
+ * @ Return: bool
+ */
+bool CUserRegistry::Create(int iCapacity, int iShardNum, int iHashRounds) {
+  if (iCapacity < 1024) iCapacity = 1024;
+  if (iShardNum < 1) iShardNum = 1;
+  if (iHashRounds < 1000) iHashRounds = 1000;
+  m_iHashRounds = iHashRounds;
+
+  /* 分片数取2的幂，每片槽位数取2的幂，留两成空位让探测保持很短 */
+  m_iShardBits = 0;
+  while ((1 << m_iShardBits) < iShardNum && m_iShardBits < 16) ++m_iShardBits;
+  m_iShardNum = 1 << m_iShardBits;
+  uint32_t iSlots = 1;
+  while (iSlots < (uint32_t)(iCapacity / m_iShardNum) * 5 / 4) iSlots <<= 1;
+  m_iCapacity = (int)(iSlots * m_iShardNum);
+
+  m_iMemLen = sizeof(ngx_user_shm_t) +
+              (size_t)m_iShardNum * sizeof(ngx_user_shard_t) +
+              (size_t)m_iCapacity * sizeof(ngx_user_slot_t);
+  void *p = mmap(NULL, m_iMemLen, PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (p == MAP_FAILED) {
+    ngx_log_error_core(NGX_LOG_ERR, errno,
+                       "CUserRegistry::Create()->mmap(%d) failed", m_iCapacity);
+    return false;
+  }
+
+  /* 匿名映射本来就是全0，全0的槽位就是空槽 */
+  m_pShm = (lpngx_user_shm_t)p;
+  m_pShm->iNextUserId = 1;
+  m_pShm->iCount = 0;
+  m_pShards = (lpngx_user_shard_t)(m_pShm + 1);
+  lpngx_user_slot_t pSlots = (lpngx_user_slot_t)(m_pShards + m_iShardNum);
+
+  pthread_rwlockattr_t attr;
+  pthread_rwlockattr_init(&attr);
+  pthread_rwlockattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+  for (int i = 0; i < m_iShardNum; ++i) {
+    pthread_rwlock_init(&m_pShards[i].lock, &attr);
+    m_pShards[i].pSlots = pSlots + (size_t)i * iSlots; /* fork 后地址不变 */
+    m_pShards[i].iMask = iSlots - 1;
+    m_pShards[i].iCount = 0;
+    m_pShards[i].iLimit = iSlots / 10 * 9;
+  }
+  pthread_rwlockattr_destroy(&attr);
+
+  ngx_log_error_core(NGX_LOG_NOTICE, 0,
+                     "CUserRegistry::Create() %d shards * %d slots, %d MB, "
+                     "%d hash rounds",
+                     m_iShardNum, (int)iSlots, (int)(m_iMemLen >> 20),
+                     m_iHashRounds);
+  return true;
+}
+
+/*
+ * @ Description: 用户名哈希 CRC32C 再打散一下，结果不为0
+ * @ Parameter: const char *username, size_t *pLen(返回用户名长度)
+ * @ Return: uint32_t
+ */
+uint32_t CUserRegistry::Hash(const char *username, size_t *pLen) {
+  *pLen = strnlen(username, NGX_USER_NAME_LEN - 1);
+  uint32_t h = CCRC32::GetInstance()->Update_CRC32C(
+      0, (const unsigned char *)username, *pLen);
+  h ^= h >> 16;
+  h *= 0x85ebca6b;
+  h ^= h >> 13;
+  h *= 0xc2b2ae35;
+  h ^= h >> 16;
+  return (h != 0) ? h : 1;
+}
+
+/*
+ * @ Description: 分片内线性探测 调用者持有分片锁
+ * @ Parameter: lpngx_user_shard_t pShard, uint32_t iHash,
+ *   const char *username, size_t iLen, bool *pEmpty(返回的是不是空槽)
+ * @ Return: lpngx_user_slot_t 找到的槽位或者第一个空槽
+ */
+lpngx_user_slot_t CUserRegistry::Find(lpngx_user_shard_t pShard,
+                                      uint32_t iHash, const char *username,
+                                      size_t iLen, bool *pEmpty) {
+  uint32_t i = (iHash >> m_iShardBits) & pShard->iMask;
+  for (;;) {
+    lpngx_user_slot_t pSlot = &pShard->pSlots[i];
+    if (pSlot->iHash == 0) {
+      *pEmpty = true;
+      return pSlot;
+    }
+    if (pSlot->iHash == iHash && memcmp(pSlot->username, username, iLen) == 0 &&
+        pSlot->username[iLen] == 0) {
+      *pEmpty = false;
+      return pSlot;
+    }
+    i = (i + 1) & pShard->iMask; /* 装载上限保证一定有空槽 */
+  }
+}
+
+/*
+ * @ Description: 用凭据里的盐和轮数算密码摘要
+ *   明文最多用前 NGX_USER_PASS_LEN-1 字节
+ * @ Parameter: const char *password, const ngx_user_cred_t &cred,
+ *   unsigned char *pHash(NGX_USER_HASH_LEN 字节)
+ * @ Return: void
+ */
+static void ngx_user_hash(const char *password, const ngx_user_cred_t &cred,
+                          unsigned char *pHash) {
+  CSHA256::Pbkdf2(password, strnlen(password, NGX_USER_PASS_LEN - 1),
+                  cred.salt, NGX_USER_SALT_LEN, cred.iRounds, pHash,
+                  NGX_USER_HASH_LEN);
+}
+
+/*
+ * @ Description: 注册 摘要在加锁之前算好，锁里只做插入
+ * @ Parameter: const char *username, const char *password, int iType,
+ *   uint32_t *pUserId(返回用户编号), lpngx_user_cred_t pCred(返回凭据)
+ * @ Return: int NGX_USER_*
+ */
+int CUserRegistry::Register(const char *username, const char *password,
+                            int iType, uint32_t *pUserId,
+                            lpngx_user_cred_t pCred) {
+  pCred->iRounds = (uint32_t)m_iHashRounds;
+  if (getrandom(pCred->salt, NGX_USER_SALT_LEN, 0) != NGX_USER_SALT_LEN) {
+    ngx_log_error_core(NGX_LOG_ERR, errno,
+                       "CUserRegistry::Register()->getrandom() failed");
+    return NGX_USER_IOERR;
+  }
+  ngx_user_hash(password, *pCred, pCred->hash);
+  return Insert(username, *pCred, iType, 0, pUserId);
+}
+
+/*
+ * @ Description: 恢复注册日志里的用户 保留原来的编号，之后新分配的编号比它大
+ *   同一个用户名出现多次留编号小的，和恢复线程谁先谁后无关
+ * @ Parameter: const char *username, const ngx_user_cred_t &cred, int iType,
+ *   uint32_t iUserId
+ * @ Return: int NGX_USER_*
+ */
+int CUserRegistry::Restore(const char *username, const ngx_user_cred_t &cred,
+                           int iType, uint32_t iUserId) {
+  uint32_t iNext = m_pShm->iNextUserId.load(std::memory_order_relaxed);
+  while (iNext <= iUserId &&
+         !m_pShm->iNextUserId.compare_exchange_weak(iNext, iUserId + 1)) {
+  }
+  uint32_t iDummy;
+  return Insert(username, cred, iType, iUserId, &iDummy);
+}
+
+/*
+ * @ Description: 插入 恢复时(iUserId 非0)用户名已存在且编号更大就覆盖
+ * @ Parameter: const char *username, const ngx_user_cred_t &cred, int iType,
+ *   uint32_t iUserId(为0时新分配), uint32_t *pUserId(返回用户编号)
+ * @ Return: int NGX_USER_*
+ */
+int CUserRegistry::Insert(const char *username, const ngx_user_cred_t &cred,
+                          int iType, uint32_t iUserId, uint32_t *pUserId) {
+  size_t iLen;
+  uint32_t iHash = Hash(username, &iLen);
+  lpngx_user_shard_t pShard = &m_pShards[iHash & (m_iShardNum - 1)];
+
+  pthread_rwlock_wrlock(&pShard->lock);
+  bool bEmpty;
+  lpngx_user_slot_t pSlot = Find(pShard, iHash, username, iLen, &bEmpty);
+  if (!bEmpty && pSlot->iUserId != 0) {
+    if (iUserId != 0 && iUserId < pSlot->iUserId) {
+      pSlot->cred = cred;
+      pSlot->iType = iType;
+      pSlot->iUserId = iUserId;
+    }
+    pthread_rwlock_unlock(&pShard->lock);
+    return NGX_USER_EXIST;
+  }
+  if (bEmpty && pShard->iCount >= pShard->iLimit) {
+    pthread_rwlock_unlock(&pShard->lock);
+    return NGX_USER_FULL;
+  }
+
+  /* 不是空槽就是同名被撤销的槽位，用户名和哈希已经在了 */
+  pSlot->cred = cred;
+  pSlot->iType = iType;
+  pSlot->iUserId = (iUserId != 0) ? iUserId : m_pShm->iNextUserId++;
+  if (bEmpty) {
+    memcpy(pSlot->username, username, iLen);
+    memset(pSlot->username + iLen, 0, NGX_USER_NAME_LEN - iLen);
+    pSlot->iHash = iHash; /* 最后填哈希，槽位才算占用 */
+    ++pShard->iCount;
+  }
+  *pUserId = pSlot->iUserId;
+  pthread_rwlock_unlock(&pShard->lock);
+
+  ++m_pShm->iCount;
+  return NGX_USER_OK;
+}
+
+/*
+ * @ Description: 校验用户名密码 读锁里只拷凭据，摘要在锁外算
+ *   比较摘要不提前退出，比较时间和错在哪一位无关
+ * @ Parameter: const char *username, const char *password,
+ *   uint32_t *pUserId(返回用户编号)
+ * @ Return: int NGX_USER_*
+ */
+int CUserRegistry::Login(const char *username, const char *password,
+                         uint32_t *pUserId) {
+  size_t iLen;
+  uint32_t iHash = Hash(username, &iLen);
+  lpngx_user_shard_t pShard = &m_pShards[iHash & (m_iShardNum - 1)];
+
+  ngx_user_cred_t cred;
+  uint32_t iUserId = 0;
+  pthread_rwlock_rdlock(&pShard->lock);
+  bool bEmpty;
+  lpngx_user_slot_t pSlot = Find(pShard, iHash, username, iLen, &bEmpty);
+  if (!bEmpty) {
+    cred = pSlot->cred;
+    iUserId = pSlot->iUserId;
+  }
+  pthread_rwlock_unlock(&pShard->lock);
+  if (iUserId == 0) return NGX_USER_NOTFOUND;
+
+  unsigned char hash[NGX_USER_HASH_LEN];
+  ngx_user_hash(password, cred, hash);
+  unsigned char iDiff = 0;
+  for (int i = 0; i < NGX_USER_HASH_LEN; ++i) iDiff |= hash[i] ^ cred.hash[i];
+  if (iDiff != 0) return NGX_USER_BADPASS;
+
+  *pUserId = iUserId;
+  return NGX_USER_OK;
+}
+
+/*
+ * @ Description: 撤销注册 注册日志没写成功时调用，重启后这个用户本来也不在
+ *   开放寻址不能把槽位清空(会截断后面用户名的探测链)，只把编号清0
+ * @ Parameter: const char *username, uint32_t iUserId(注册时分到的编号)
+ * @ Return: void
+ */
+void CUserRegistry::Unregister(const char *username, uint32_t iUserId) {
+  size_t iLen;
+  uint32_t iHash = Hash(username, &iLen);
+  lpngx_user_shard_t pShard = &m_pShards[iHash & (m_iShardNum - 1)];
+
+  pthread_rwlock_wrlock(&pShard->lock);
+  bool bEmpty;
+  lpngx_user_slot_t pSlot = Find(pShard, iHash, username, iLen, &bEmpty);
+  bool bFound = (!bEmpty && pSlot->iUserId == iUserId);
+  if (bFound) {
+    pSlot->iUserId = 0;
+    explicit_bzero(&pSlot->cred, sizeof(pSlot->cred));
+  }
+  pthread_rwlock_unlock(&pShard->lock);
+
+  if (bFound) --m_pShm->iCount;
+}
@@ -0,0 +1,139 @@
+/*
+ * @Author: agent
+ * @Date: 2026-10-19 15:32:35
+ * @Last Modified by: agent
+ * @Last Modified time: 2026-10-19 15:38:20
+ * @Description: 回包构造
+ */
+
+#include "ngx_c_msgbuilder.h"
+
+#include <arpa/inet.h>
+#include <string.h>
+
+#include "ngx_c_crc32.h"
+#include "ngx_c_memory.h"
+
+/*
+ * @ Description: 构造函数 一次分配消息头+包头+最大包体
+ *   校验方式取连接当前协商好的
+ * @ Parameter: LPSTRUC_MSG_HEADER pMsgHeader(收到的消息头，回包发给谁),
+ *   unsigned short iMsgCode(本机序), int iBodyMax
+ */
+CMsgBuilder::CMsgBuilder(LPSTRUC_MSG_HEADER pMsgHeader, unsigned short iMsgCode,
+                         int iBodyMax)
+    : m_iBodyMax(iBodyMax),
+      m_iBodyLen(0),
+      m_iCrcLen(0),
+      m_iCrc(0),
+      m_iCsumMode(pMsgHeader->pConn->iCsumMode) {
+  m_pBuf = (char *)CMemory::GetInstance()->AllocMemory(
+      sizeof(STRUC_MSG_HEADER) + sizeof(COMM_PKG_HEADER) + iBodyMax, false);
+  memcpy(m_pBuf, pMsgHeader, sizeof(STRUC_MSG_HEADER));
+
+  LPCOMM_PKG_HEADER pPkgHeader =
+      (LPCOMM_PKG_HEADER)(m_pBuf + sizeof(STRUC_MSG_HEADER));
+  pPkgHeader->msgCode = htons(iMsgCode);
+  m_pBody = (char *)pPkgHeader + sizeof(COMM_PKG_HEADER);
+}
+
+/*
+ * @ Description: 析构函数 没交出去的缓冲区释放掉
+ */
+CMsgBuilder::~CMsgBuilder() {
+  if (m_pBuf != nullptr) CMemory::GetInstance()->FreeMemory(m_pBuf);
+}
+
+/*
+ * @ Description: 把 Reserve 出去还没算的部分算进CRC
+ * @ Parameter: void
+ * @ Return: void
+ */
+void CMsgBuilder::catchUp() {
+  if (m_iCrcLen == m_iBodyLen) return;
+  m_iCrc = CCRC32::GetInstance()->Update_Csum(
+      m_iCsumMode, m_iCrc, (unsigned char *)m_pBody + m_iCrcLen,
+      m_iBodyLen - m_iCrcLen);
+  m_iCrcLen = m_iBodyLen;
+}
+
+/*
+ * @ Description: 预留一段包体给调用者直接写，写好之前不能再调别的写函数
+ * @ Parameter: int iLen
+ * @ Return: char*(空间不够返回空)
+ */
+char *CMsgBuilder::Reserve(int iLen) {
+  if (iLen < 0 || m_iBodyLen + iLen > m_iBodyMax) return nullptr;
+  catchUp();
+  char *p = m_pBody + m_iBodyLen;
+  m_iBodyLen += iLen;
+  return p;
+}
+
+/*
+ * @ Description: 拷贝进包体，拷贝时顺便算CRC
+ * @ Parameter: const void *pData, int iLen
+ * @ Return: bool(空间不够返回false)
+ */
+bool CMsgBuilder::Append(const void *pData, int iLen) {
+  if (iLen < 0 || m_iBodyLen + iLen > m_iBodyMax) return false;
+  catchUp();
+  m_iCrc = CCRC32::GetInstance()->Copy_CRC(
+      m_iCrc, (unsigned char *)m_pBody + m_iBodyLen,
+      (const unsigned char *)pData, iLen, m_iCsumMode);
+  m_iBodyLen += iLen;
+  m_iCrcLen = m_iBodyLen;
+  return true;
+}
+
+bool CMsgBuilder::PutInt16(unsigned short iValue) {
+  iValue = htons(iValue);
+  return Append(&iValue, sizeof(iValue));
+}
+
+bool CMsgBuilder::PutInt32(unsigned int iValue) {
+  iValue = htonl(iValue);
+  return Append(&iValue, sizeof(iValue));
+}
+
+/*
+ * @ Description: 写定长字符串字段，超长截断并保证以0结尾，不足补0
+ * @ Parameter: const char *pStr, int iFieldLen
+ * @ Return: bool
+ */
+bool CMsgBuilder::PutString(const char *pStr, int iFieldLen) {
+  if (iFieldLen <= 0 || m_iBodyLen + iFieldLen > m_iBodyMax) return false;
+  int iLen = (int)strnlen(pStr, iFieldLen - 1);
+  Append(pStr, iLen);
+  return PutZero(iFieldLen - iLen);
+}
+
+/*
+ * @ Description: 补0
+ * @ Parameter: int iLen
+ * @ Return: bool
+ */
+bool CMsgBuilder::PutZero(int iLen) {
+  char *p = Reserve(iLen);
+  if (p == nullptr) return false;
+  memset(p, 0, iLen);
+  return true;
+}
+
+/*
+ * @ Description: 填包长和CRC，之后缓冲区归调用者(一般直接交给 msgSend)
+ *   没有包体时CRC是0，和收包的约定一致
+ * @ Parameter: void
+ * @ Return: char*(消息头+包头+包体)
+ */
+char *CMsgBuilder::Finish() {
+  catchUp();
+  LPCOMM_PKG_HEADER pPkgHeader =
+      (LPCOMM_PKG_HEADER)(m_pBuf + sizeof(STRUC_MSG_HEADER));
+  pPkgHeader->pkgLen = htons(sizeof(COMM_PKG_HEADER) + m_iBodyLen);
+  pPkgHeader->crc32 = htonl(m_iCrc);
+
+  char *pBuf = m_pBuf;
+  m_pBuf = nullptr;
+  return pBuf;
+}
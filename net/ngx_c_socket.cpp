@@ -11,11 +11,11 @@
 #include <errno.h>
 #include <netinet/in.h>
 #include <pthread.h>
-#include <semaphore.h>
 #include <stdio.h>
 #include <string.h>
 #include <stropts.h>
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <sys/ioctl.h>
 #include <sys/socket.h>
 #include <sys/time.h>
@@ -23,6 +23,8 @@
 #include <unistd.h>
 
 #include "ngx_c_conf.h"
+#include "ngx_c_coroutine.h"
+#include "ngx_c_crc32.h"
 #include "ngx_c_lockmutex.h"
 #include "ngx_c_threadpool.h"
 #include "ngx_func.h"
@@ -40,6 +42,8 @@ CSocket::CSocket()
       m_worker_connections(0),
       m_epollhandle(-1),
       m_connection_n(0),
+      m_sendEventFd(-1),
+      m_iSendWakeState(0),
       m_total_connection_n(0),
       m_free_connection_n(0),
       m_pconnections(nullptr),
@@ -50,10 +54,34 @@ CSocket::CSocket()
       m_cur_size_(0),
       m_timer_value_(0),
       m_iSendMsgQueueCount(0),
+      m_iSendHighPrioBurst(16),
       m_onlineUserCount(0),
       m_floodAkEnable(0),
       m_floodTimeInterval(0),
-      m_floodKickCount(0) {}
+      m_floodKickCount(0),
+      m_iRecvQueueMax(0),
+      m_iRecvOverloadPolicy(NGX_RECV_OVERLOAD_DROP),
+      m_iRecvPauseMin(8),
+      m_iRecvResumeCount(0),
+      m_iRecvInlineCount(0),
+      m_iRecvCrcInline(0),
+      m_iRecvChunkSize(16384),
+      m_iRecvStreamMax(16 << 20),
+      m_iRecvStreamCount(0),
+      m_iRecvChunkCount(0),
+      m_iBroadcastCount(0),
+      m_iBroadcastSkipCount(0) {
+  for (int i = 0; i < NGX_SEND_PRIO_LANES; ++i) m_iSendLaneCount[i] = 0;
+  for (int i = 0; i < NGX_MAX_MSGCODE; ++i) m_iSendExpiredCount[i] = 0;
+  for (int i = 0; i < NGX_SEND_LAT_BUCKETS; ++i) m_iSendLatency[i] = 0;
+  for (int i = 0; i < NGX_RECV_OVERLOAD_N; ++i) m_iRecvOverloadCount[i] = 0;
+  for (int i = 0; i < NGX_MAX_MSGCODE; ++i) {
+    m_iRecvCallCount[i] = 0;
+    m_iRecvErrCount[i] = 0;
+    m_iRecvLatencyUs[i] = 0;
+  }
+  memset(m_iSendDeadlineMs, 0, sizeof(m_iSendDeadlineMs));
+}
 
 /*
  * @ Description: 析构函数
@@ -76,13 +104,16 @@ CSocket::~CSocket() {
  */
 void CSocket::clearMsgSendQueue() {
   char *sTmpMsgBuf;
-  CMemory *p_memory = CMemory::GetInstance();
 
   // 临界问题先不考虑了
-  while (!m_MsgSendQueue.empty()) {
-    sTmpMsgBuf = m_MsgSendQueue.front();
-    m_MsgSendQueue.pop_front();
-    p_memory->FreeMemory(sTmpMsgBuf);
+  drainEpollSend();
+  for (int i = 0; i < NGX_SEND_PRIO_LANES; ++i) {
+    while (!m_MsgSendQueue[i].empty()) {
+      sTmpMsgBuf = m_MsgSendQueue[i].front();
+      m_MsgSendQueue[i].pop_front();
+      --m_iSendLaneCount[i];
+      freeSendMsg(sTmpMsgBuf);
+    }
   }
 }
 
@@ -109,6 +140,21 @@ void CSocket::ReadConf() {
   m_ifTimeOutKick =
       p_config->GetIntDefault("Sock_TimeOutKick", m_ifTimeOutKick);
 
+  m_iRecvCrcInline =
+      p_config->GetIntDefault("Sock_RecvCrcInline", m_iRecvCrcInline);
+
+  /* 分块接收 一块要能装进一个 v1 包 */
+  int iChunkSize =
+      p_config->GetIntDefault("Sock_RecvChunkSize", (int)m_iRecvChunkSize);
+  int iChunkMax = _PKG_MAX_LENGTH - 1000 - (int)sizeof(COMM_PKG_HEADER);
+  if (iChunkSize < 1024) iChunkSize = 1024;
+  if (iChunkSize > iChunkMax) iChunkSize = iChunkMax;
+  m_iRecvChunkSize = (unsigned int)iChunkSize;
+  int iStreamMax =
+      p_config->GetIntDefault("Sock_RecvStreamMax", (int)m_iRecvStreamMax);
+  m_iRecvStreamMax = (iStreamMax > iChunkSize) ? (unsigned int)iStreamMax
+                                               : m_iRecvChunkSize;
+
   m_floodAkEnable =
       p_config->GetIntDefault("Sock_FloodAttackKickEnable", m_floodAkEnable);
   m_floodTimeInterval =
@@ -116,6 +162,31 @@ void CSocket::ReadConf() {
   m_floodKickCount =
       p_config->GetIntDefault("Sock_FloodKickCounter", m_ifkickTimeCount);
 
+  m_iSendHighPrioBurst =
+      p_config->GetIntDefault("Send_HighPrioBurst", m_iSendHighPrioBurst);
+  /* 至少连续发一条高优先级 */
+  m_iSendHighPrioBurst = (m_iSendHighPrioBurst > 1) ? m_iSendHighPrioBurst : 1;
+
+  /* 收消息队列上限和过载策略 */
+  m_iRecvQueueMax =
+      p_config->GetIntDefault("ProcMsgRecvQueueMax", m_iRecvQueueMax);
+  if (m_iRecvQueueMax < 0) m_iRecvQueueMax = 0;
+  m_iRecvOverloadPolicy = p_config->GetIntDefault("ProcMsgRecvOverloadPolicy",
+                                                  m_iRecvOverloadPolicy);
+  if (m_iRecvOverloadPolicy < 0 || m_iRecvOverloadPolicy >= NGX_RECV_OVERLOAD_N)
+    m_iRecvOverloadPolicy = NGX_RECV_OVERLOAD_DROP;
+  m_iRecvPauseMin =
+      p_config->GetIntDefault("ProcMsgRecvPauseMin", m_iRecvPauseMin);
+  m_iRecvPauseMin = (m_iRecvPauseMin > 1) ? m_iRecvPauseMin : 1;
+
+  /* 各消息码默认发送期限，没单独配置的用 Send_DeadlineMs */
+  char strinfo[100];
+  int iDeadlineMs = p_config->GetIntDefault("Send_DeadlineMs", 0);
+  for (int i = 0; i < NGX_MAX_MSGCODE; ++i) {
+    sprintf(strinfo, "Send_DeadlineMs%d", i);
+    m_iSendDeadlineMs[i] = p_config->GetIntDefault(strinfo, iDeadlineMs);
+  }
+
   return;
 }
 
@@ -134,10 +205,7 @@ bool CSocket::Initialize() {
  * @ Description: 回收线程
  */
 void CSocket::Shutdown_subproc() {
-  if (sem_post(&m_semEventSendQueue) == -1) {
-    ngx_log_error_core(NGX_LOG_ERR, errno,
-                       "CSocket::Shutown_subproc()->sem_post() failed");
-  }
+  wakeSendThread(); /* 发送线程醒来看到 g_stopEvent 退出 */
   /* 通过 shutdown 开关 */
   std::vector<ThreadItem *>::iterator iter;
   for (iter = m_threadVector.begin(); iter != m_threadVector.end(); iter++) {
@@ -160,7 +228,9 @@ void CSocket::Shutdown_subproc() {
   pthread_mutex_destroy(&m_sendMessageQueueMutex);  //发消息互斥量释放
   pthread_mutex_destroy(&m_recyconnqueueMutex);  //连接回收队列相关的互斥量释放
   pthread_mutex_destroy(&m_timequeueMutex);  //时间处理队列相关的互斥量释放
-  sem_destroy(&m_semEventSendQueue);  //发消息相关线程信号量释放
+  pthread_mutex_destroy(&m_epollEventMutex);  // epoll事件修改互斥量释放
+  close(m_sendEventFd);  //发消息线程唤醒用的eventfd
+  m_sendEventFd = -1;
 }
 
 /*
@@ -177,6 +247,11 @@ bool CSocket::ngx_open_listening_sockets() {
   struct sockaddr_in serv_addr; /* 服务器配置结构体 */
   int iport;                    /* port */
   char strinfo[100];            /* 临时字符串 */
+  ngx_tcp_profile_t profile;    /* 端口 tcp 参数 */
+  int iadmin;                   /* 管理端口 */
+  int icsum, icsumAllow;        /* 端口校验方式 */
+  int iframingV2;               /* 端口允许 v2 包头 */
+  int istreamMax;               /* 端口分块接收的包体上限 */
 
   // 初始化
   memset(&serv_addr, 0, sizeof(serv_addr));
@@ -221,6 +296,26 @@ bool CSocket::ngx_open_listening_sockets() {
     iport = p_config->GetIntDefault(strinfo, 100000);
     serv_addr.sin_port = htons((in_port_t)iport);
 
+    /* 端口 tcp 参数，缓冲区和 fastopen 需要在 listen() 之前设置 */
+    ngx_read_tcp_profile(i, &profile);
+    ngx_set_listen_profile(isock, &profile);
+    sprintf(strinfo, "ListenPort%dAdmin", i);
+    iadmin = p_config->GetIntDefault(strinfo, 0);
+
+    /* 端口的校验方式，默认 CRC-32，允许协商成 CRC-32/CRC32C */
+    sprintf(strinfo, "ListenPort%dChecksum", i);
+    icsum = p_config->GetIntDefault(strinfo, NGX_CSUM_CRC32);
+    if (icsum < 0 || icsum >= NGX_CSUM_N) icsum = NGX_CSUM_CRC32;
+    sprintf(strinfo, "ListenPort%dChecksumAllow", i);
+    icsumAllow = p_config->GetIntDefault(
+        strinfo, (1 << NGX_CSUM_CRC32) | (1 << NGX_CSUM_CRC32C));
+    icsumAllow |= (1 << icsum); /* 默认方式总是可以协商回来 */
+    sprintf(strinfo, "ListenPort%dFramingV2", i);
+    iframingV2 = p_config->GetIntDefault(strinfo, 0); /* 默认不开 */
+    sprintf(strinfo, "ListenPort%dStreamMax", i);
+    istreamMax = p_config->GetIntDefault(strinfo, (int)m_iRecvStreamMax);
+    if (istreamMax < (int)m_iRecvChunkSize) istreamMax = (int)m_iRecvChunkSize;
+
     if (bind(isock, (struct sockaddr *)&serv_addr, sizeof(serv_addr)) == -1) {
       ngx_log_error_core(NGX_LOG_ERR, errno,
                          "CSocket::Initialize()->bind() failed port = %d",
@@ -242,6 +337,12 @@ bool CSocket::ngx_open_listening_sockets() {
     memset(p_listensocketitem, 0, sizeof(ngx_listening_t));
     p_listensocketitem->port = iport;
     p_listensocketitem->fd = isock;
+    p_listensocketitem->profile = profile;
+    p_listensocketitem->admin = iadmin;
+    p_listensocketitem->csum = icsum;
+    p_listensocketitem->csumAllow = icsumAllow;
+    p_listensocketitem->framingV2 = iframingV2;
+    p_listensocketitem->streamMax = (unsigned int)istreamMax;
     ngx_log_error_core(NGX_LOG_INFO, 0, "listen port %d success", iport);
     m_ListenSocketList.push_back(p_listensocketitem);
   }
@@ -284,6 +385,7 @@ void CSocket::ngx_close_listening_sockets() {
  */
 int CSocket::ngx_epoll_init() {
   ngx_log_error_core(NGX_LOG_INFO, 0, "begin ngx_epoll_init()");
+  m_epollThread = pthread_self(); /* 之后在这个线程里跑 epoll 循环 */
   // epoll_creat
   m_epollhandle = epoll_create(m_worker_connections);
   if (m_epollhandle == -1) {
@@ -354,20 +456,25 @@ bool CSocket::Initialize_subproc() {
                        "timequeueMutex) failed");
     return false;
   }
+  //修改连接epoll事件的互斥量初始化
+  if (pthread_mutex_init(&m_epollEventMutex, NULL) != 0) {
+    ngx_log_error_core(NGX_LOG_ERR, errno,
+                       "CSocket::Initialize_subproc()中->pthread_mutex_init(&m_"
+                       "epollEventMutex) failed");
+    return false;
+  }
 
-  //初始化发消息相关信号量，信号量用于进程/线程 之间的同步，虽然
-  //互斥量[pthread_mutex_lock]和
-  //条件变量[pthread_cond_wait]都是线程之间的同步手段，但 这里用信号量实现 则
-  //更容易理解，更容易简化问题，使用书写的代码短小且清晰；
-  //第二个参数=0，表示信号量在线程之间共享，确实如此
-  //，如果非0，表示在进程之间共享
-  //第三个参数=0，表示信号量的初始值，为0时，调用sem_wait()就会卡在那里卡着
-  if (sem_init(&m_semEventSendQueue, 0, 0) == -1) {
-    ngx_log_error_core(
-        NGX_LOG_ERR, errno,
-        "CSocket::Initialize()->sem_init(&m_semEventSendQueue,0,0) failed");
+  //发送线程唤醒用的eventfd，只有发送线程真的睡着了才写，
+  //不用每条消息都 sem_post/sem_wait 一次
+  m_sendEventFd = eventfd(0, EFD_CLOEXEC);
+  if (m_sendEventFd == -1) {
+    ngx_log_error_core(NGX_LOG_ERR, errno,
+                       "CSocket::Initialize_subproc()->eventfd() failed");
     return false;
   }
+  m_iSendWakeState = 0;
+  for (int i = 0; i < NGX_SEND_PRIO_LANES; ++i)
+    m_EpollSendRing[i].Init(NGX_SEND_EPOLL_RING);
 
   //创建发送队列管理线程
   int err;
@@ -423,6 +530,10 @@ int CSocket::ngx_epoll_oper_event(int fd, uint32_t eventtype, uint32_t flag,
   struct epoll_event ev;
   memset(&ev, 0, sizeof(ev));
 
+  //发送线程改EPOLLOUT、业务线程恢复EPOLLIN可能同时修改同一个连接，
+  //pConn->events 记录当前真实的事件，加锁读改写，互相不覆盖
+  CLock lock((eventtype == EPOLL_CTL_MOD) ? &m_epollEventMutex : nullptr);
+
   if (eventtype == EPOLL_CTL_ADD) {
     //红黑树从无到有增加节点
     ev.events = flag;
@@ -452,6 +563,7 @@ int CSocket::ngx_epoll_oper_event(int fd, uint32_t eventtype, uint32_t flag,
         eventtype, flag, bcaction);
     return -1;
   }
+  if (eventtype == EPOLL_CTL_MOD) pConn->events = ev.events;
   // ngx_log_error_core(NGX_LOG_DEBUG, 0, "ngx_epoll_ctl() success");
   return 1;
 }
@@ -511,19 +623,148 @@ int CSocket::ngx_epoll_process_events(int timer) {
   return 1;
 }
 
+/*
+ * @ Description: 消息码对应的发送优先级 父类都是普通优先级 子类决定
+ * @ Parameter: unsigned short iMsgCode(本机序)
+ * @ Return: int
+ */
+int CSocket::getSendPrio(unsigned short) { return NGX_SEND_PRIO_BULK; }
+
+/*
+ * @ Description: 消息码在业务线程池中的调度类别 父类都是普通类别 子类决定
+ * @ Parameter: unsigned short iMsgCode(本机序)
+ * @ Return: int NGX_RECV_CLASS_*
+ */
+int CSocket::getRecvClass(unsigned short) {
+  return NGX_RECV_CLASS_NORMAL;
+}
+
+/*
+ * @ Description: 消息码最多同时被几个业务线程处理 父类都不限制
+ * @ Parameter: unsigned short iMsgCode(本机序)
+ * @ Return: int 0 不限
+ */
+int CSocket::getRecvQuota(unsigned short) { return 0; }
+
+/*
+ * @ Description: 消息码是否不进业务线程池，在epoll线程里直接处理
+ *   父类都进线程池 子类决定
+ * @ Parameter: unsigned short iMsgCode(本机序)
+ * @ Return: bool
+ */
+bool CSocket::getRecvInline(unsigned short) { return false; }
+
+/*
+ * @ Description: 消息码的包体是否分块交付 父类都整包交付 子类决定
+ * @ Parameter: unsigned short iMsgCode(本机序)
+ * @ Return: bool
+ */
+bool CSocket::getRecvChunked(unsigned short) { return false; }
+
+/*
+ * @ Description: 收消息队列过载时回复服务器忙 父类没有忙消息码，什么也不发
+ * @ Parameter: LPSTRUC_MSG_HEADER pMsgHeader(收到的包的消息头)
+ * @ Return: void
+ */
+void CSocket::sendServerBusy(LPSTRUC_MSG_HEADER) { return; }
+
+/*
+ * @ Description: 填写入队时间和发送期限
+ * @ Parameter: LPSTRUC_MSG_HEADER pMsgHeader, unsigned short iMsgCode(本机序),
+ *   int iDeadlineMs(-1 用消息码默认值 0 不限)
+ * @ Return: void
+ */
+void CSocket::setSendDeadline(LPSTRUC_MSG_HEADER pMsgHeader,
+                              unsigned short iMsgCode, int iDeadlineMs) {
+  if (iDeadlineMs < 0) {
+    iDeadlineMs = m_iSendDeadlineMs[ngx_min(iMsgCode, NGX_MAX_MSGCODE - 1)];
+  }
+  pMsgHeader->iEnqueueTime = ngx_time_us();
+  pMsgHeader->iDeadline =
+      (iDeadlineMs > 0)
+          ? pMsgHeader->iEnqueueTime + (uint64_t)iDeadlineMs * 1000
+          : 0;
+  return;
+}
+
+/*
+ * @ Description: 记录入队到发送的延迟 只在发送线程持锁时调用
+ * @ Parameter: uint64_t iEnqueueTime(入队时间 微秒)
+ * @ Return: void
+ */
+void CSocket::addSendLatency(uint64_t iEnqueueTime) {
+  uint64_t iLatency = ngx_time_us() - iEnqueueTime;
+  int i = 0;
+  while ((iLatency >>= 1) != 0 && i < NGX_SEND_LAT_BUCKETS - 1) ++i;
+  ++m_iSendLatency[i];
+  return;
+}
+
+/*
+ * @ Description: 记录消息码处理结果和耗时 多个业务线程同时调用
+ * @ Parameter: unsigned short iMsgCode, int iResult(0 成功),
+ *   uint64_t iUs(处理耗时 微秒)
+ * @ Return: void
+ */
+void CSocket::addRecvStat(unsigned short iMsgCode, int iResult, uint64_t iUs) {
+  int i = ngx_min(iMsgCode, NGX_MAX_MSGCODE - 1);
+  m_iRecvCallCount[i].fetch_add(1, std::memory_order_relaxed);
+  if (iResult != 0) m_iRecvErrCount[i].fetch_add(1, std::memory_order_relaxed);
+  m_iRecvLatencyUs[i].fetch_add(iUs, std::memory_order_relaxed);
+  return;
+}
+
 /*
  * @ Description: 将数据发送到发送队列中
+ * @ Parameter: char *pSendbuf(消息头+包头+包体), int iPrio(发送优先级),
+ *   int iDeadlineMs(发送期限 -1 用消息码默认值 0 不限)
+ * @ Return: void
  */
-void CSocket::msgSend(char *pSendbuf) {
-  CMemory *p_memory = CMemory::GetInstance();
+void CSocket::msgSend(char *pSendbuf, int iPrio, int iDeadlineMs) {
+  if (collectBatchReply(pSendbuf)) return; /* 批量包的子回包先攒着 */
+
+  /* 发送线程扫描队列时一直拿着锁，epoll 线程(就地处理的心跳等)等锁会卡住收包
+     它的回包放无锁环形队列，发送线程拿锁后自己挪过去 */
+  bool bEpoll = pthread_equal(pthread_self(), m_epollThread);
+  if (bEpoll) {
+    if (admitSend(pSendbuf, iPrio, iDeadlineMs) == false) return;
+    if (m_EpollSendRing[iPrio].Push(pSendbuf)) {
+      ++m_iSendMsgQueueCount;
+      wakeSendThread();
+      return;
+    }
+    /* 环形队列满了说明发送线程跟不上，只好拿锁排队 */
+  }
 
   CLock lock(&m_sendMessageQueueMutex);  //互斥量
+  if (bEpoll) {
+    drainEpollSend(); /* 先把环形队列里的排上，同一连接的回包不乱序 */
+  } else if (admitSend(pSendbuf, iPrio, iDeadlineMs) == false) {
+    return;
+  }
+
+  m_MsgSendQueue[iPrio].push_back(pSendbuf);
+  ++m_iSendMsgQueueCount;  //原子操作
+  ++m_iSendLaneCount[iPrio];
 
+  //让ServerSendQueueThread()流程走下来干活
+  wakeSendThread();
+  ngx_log_error_core(NGX_LOG_DEBUG, 0, "CSocket::ngx_msgSend() success");
+  return;
+}
+
+/*
+ * @ Description: 发送前检查总积压和连接积压，定下优先级和发送期限
+ *   通过了连接的待发数加一，没通过消息已经释放
+ * @ Parameter: char *pSendbuf, int &iPrio(带回实际优先级), int iDeadlineMs
+ * @ Return: bool 可以入队返回 true
+ */
+bool CSocket::admitSend(char *pSendbuf, int &iPrio, int iDeadlineMs) {
   //发送消息队列过大也可能给服务器带来风险
   if (m_iSendMsgQueueCount > 50000) {
     m_iDiscardSendPkgCount++;
-    p_memory->FreeMemory(pSendbuf);
-    return;
+    freeSendMsg(pSendbuf);
+    return false;
   }
 
   //总体数据并无风险，不会导致服务器崩溃，要看看个体数据，找一下恶意者了
@@ -537,35 +778,130 @@ void CSocket::msgSend(char *pSendbuf) {
         "CSocket::msgSend()-> [client = %d] send to many pkg and close client",
         p_Conn->fd);
     m_iDiscardSendPkgCount++;
-    p_memory->FreeMemory(pSendbuf);
+    freeSendMsg(pSendbuf);
     zdClosesocketProc(p_Conn);  //直接关闭
-    return;
+    return false;
+  }
+
+  unsigned short iMsgCode = ntohs(getSendPkgHeader(pSendbuf)->msgCode);
+  if (iPrio < 0 || iPrio >= NGX_SEND_PRIO_LANES) { /* 按消息码决定 */
+    iPrio = getSendPrio(iMsgCode);
   }
+  setSendDeadline(pMsgHeader, iMsgCode, iDeadlineMs);
 
   ++p_Conn->iSendCount;  //发送队列中有的数据条目数+1；
-  m_MsgSendQueue.push_back(pSendbuf);
-  ++m_iSendMsgQueueCount;  //原子操作
+  return true;
+}
+
+/*
+ * @ Description: epoll 线程放进环形队列的回包挪到发送队列末尾
+ *   拿着发送队列锁时调用，计数在入环形队列时已经加过
+ * @ Parameter: void
+ * @ Return: void
+ */
+void CSocket::drainEpollSend() {
+  char *pSendbuf;
+  for (int i = 0; i < NGX_SEND_PRIO_LANES; ++i) {
+    while (m_EpollSendRing[i].Pop(pSendbuf)) {
+      m_MsgSendQueue[i].push_back(pSendbuf);
+      ++m_iSendLaneCount[i];
+    }
+  }
+  return;
+}
 
-  //将信号量的值+1,这样其他卡在sem_wait的就可以走下去
-  if (sem_post(&m_semEventSendQueue) == -1) {
-    //让ServerSendQueueThread()流程走下来干活
+/*
+ * @ Description: 协程里发送，co_await 返回时消息已经写进套接字或者被丢弃
+ * @ Parameter: char *pSendbuf(消息头+包头+包体), int iPrio(发送优先级)
+ * @ Return: CCoSendAwaiter
+ */
+CCoSendAwaiter CSocket::coSend(char *pSendbuf, int iPrio) {
+  CCoSendAwaiter awaiter;
+  awaiter.pSocket = this;
+  awaiter.pSendbuf = pSendbuf;
+  awaiter.iPrio = iPrio;
+  return awaiter;
+}
 
-    ngx_log_error_core(
-        NGX_LOG_INFO, 0,
-        "CSocket::msgSend()->sem_post(&m_semEventSendQueue) failed");
+/*
+ * @ Description: 释放发送消息，广播消息只在最后一个引用释放时释放整块内存
+ * @ Parameter: char *pMsgBuf(消息头地址)
+ * @ Return: void
+ */
+void CSocket::freeSendMsg(char *pMsgBuf) {
+  CMemory *p_memory = CMemory::GetInstance();
+  LPSTRUC_SHARED_PKG pShared = ((LPSTRUC_MSG_HEADER)pMsgBuf)->pSharedPkg;
+  void *pSendWaiter = ((LPSTRUC_MSG_HEADER)pMsgBuf)->pSendWaiter;
+  if (pSendWaiter != nullptr) /* 协程在等这条消息，发完丢掉都让它继续 */
+    CCoScheduler::Resume(CCoTask::handle_t::from_address(pSendWaiter));
+
+  if (pShared == nullptr) {
+    p_memory->FreeMemory(pMsgBuf);
+    return;
+  }
+
+  /* 广播的消息头在共享内存块里，不能单独释放 */
+  if (--pShared->iRefCount == 0) {
+    pShared->~STRUC_SHARED_PKG();
+    p_memory->FreeMemory(pShared);
   }
-  ngx_log_error_core(NGX_LOG_DEBUG, 0, "CSocket::ngx_msgSend() success");
   return;
 }
 
+/*
+ * @ Description: 通知发送线程有活干
+ *   只有第一个看到发送线程在睡的生产者才写eventfd，其余的只置位
+ * @ Parameter: void
+ * @ Return: void
+ */
+void CSocket::wakeSendThread() {
+  int old = m_iSendWakeState.fetch_or(NGX_SEND_WAKE_PENDING);
+  if ((old & NGX_SEND_WAKE_PARKED) && !(old & NGX_SEND_WAKE_PENDING)) {
+    uint64_t one = 1;
+    if (write(m_sendEventFd, &one, sizeof(one)) != sizeof(one)) {
+      ngx_log_error_core(NGX_LOG_ERR, errno,
+                         "CSocket::wakeSendThread()->write() failed");
+    }
+  }
+  return;
+}
+
+/*
+ * @ Description: 发送线程没有新活就睡在eventfd上，有活就清掉标志去干活
+ *   清标志在扫描队列之前，扫描期间来的新活会让下一轮再扫一次
+ * @ Parameter: void
+ * @ Return: bool true 有活干 false 被唤醒需要再判断一次
+ */
+bool CSocket::parkSendThread() {
+  int state = m_iSendWakeState.load();
+  if (state & NGX_SEND_WAKE_PENDING) {
+    m_iSendWakeState.store(0);
+    return true;
+  }
+
+  if (!m_iSendWakeState.compare_exchange_strong(
+          state, state | NGX_SEND_WAKE_PARKED)) {
+    return false; /* 这期间有人置位了，回去重新判断 */
+  }
+
+  uint64_t cnt;
+  if (read(m_sendEventFd, &cnt, sizeof(cnt)) == -1 && errno != EINTR) {
+    ngx_log_error_core(NGX_LOG_ERR, errno,
+                       "CSocket::parkSendThread()->read() failed");
+  }
+  return false;
+}
+
 /*
  * @ Description: 发送消息队列 单独线程
+ *   高优先级队列先发，连续发 m_iSendHighPrioBurst 条之后
+ *   普通队列至少发一条，防止普通消息饿死
  */
 void *CSocket::ServerSendQueueThread(void *threadData) {
   ThreadItem *pThread = static_cast<ThreadItem *>(threadData);
   CSocket *pSocketObj = pThread->_pThis;
   int err;
-  std::list<char *>::iterator pos, pos2, posend;
+  std::list<char *>::iterator pos[NGX_SEND_PRIO_LANES], pos2;
 
   char *pMsgBuf;
   LPSTRUC_MSG_HEADER pMsgHeader;
@@ -573,18 +909,14 @@ void *CSocket::ServerSendQueueThread(void *threadData) {
   lpngx_connection_t p_Conn;
   unsigned short itmp;
   ssize_t sendsize;
+  int iLane;       /* 本次处理哪个优先级队列 */
+  int iHighBurst;  /* 连续发出了多少条高优先级 */
 
-  CMemory *p_memory = CMemory::GetInstance();
+  ngx_affinity_bind_thread(NGX_THREAD_SENDER);
 
   while (g_stopEvent == 0)  //不退出
   {
-    if (sem_wait(&pSocketObj->m_semEventSendQueue) == -1) {
-      if (errno != EINTR)
-        ngx_log_error_core(
-            NGX_LOG_ERR, errno,
-            "CSocket::ServerSendQueueThread()->sem_wait(&pSocketObj-"
-            ">m_semEventSendQueue) failed.");
-    }
+    if (pSocketObj->parkSendThread() == false) continue; /* 没有新活 */
 
     if (g_stopEvent != 0) /* 要求整个进程退出 */
       break;
@@ -596,41 +928,78 @@ void *CSocket::ServerSendQueueThread(void *threadData) {
             NGX_LOG_ERR, err,
             "CSocket::ServerSendQueueThread()中pthread_mutex_lock() failed");
 
-      pos = pSocketObj->m_MsgSendQueue.begin();
-      posend = pSocketObj->m_MsgSendQueue.end();
-
-      while (pos != posend) {
-        pMsgBuf = (*pos);
+      pSocketObj->drainEpollSend(); /* epoll 线程的回包排到后面 */
+      for (int i = 0; i < NGX_SEND_PRIO_LANES; ++i)
+        pos[i] = pSocketObj->m_MsgSendQueue[i].begin();
+      iHighBurst = 0;
+
+      while (true) {
+        /* 选队列 */
+        bool highLeft = (pos[NGX_SEND_PRIO_HIGH] !=
+                         pSocketObj->m_MsgSendQueue[NGX_SEND_PRIO_HIGH].end());
+        bool bulkLeft = (pos[NGX_SEND_PRIO_BULK] !=
+                         pSocketObj->m_MsgSendQueue[NGX_SEND_PRIO_BULK].end());
+        if (!highLeft && !bulkLeft) break;
+
+        if (highLeft &&
+            (iHighBurst < pSocketObj->m_iSendHighPrioBurst || !bulkLeft))
+          iLane = NGX_SEND_PRIO_HIGH;
+        else
+          iLane = NGX_SEND_PRIO_BULK;
+        std::list<char *> &sendQueue = pSocketObj->m_MsgSendQueue[iLane];
+        std::list<char *>::iterator &it = pos[iLane];
+
+        pMsgBuf = (*it);
         pMsgHeader = (LPSTRUC_MSG_HEADER)pMsgBuf; /* 消息头 */
-        pPkgHeader = (LPCOMM_PKG_HEADER)(
-            pMsgBuf + pSocketObj->m_iLenMsgHeader); /* 包头 */
+        pPkgHeader = pSocketObj->getSendPkgHeader(pMsgBuf); /* 包头 */
         p_Conn = pMsgHeader->pConn;
 
         if (p_Conn->iCurrsequence !=
             pMsgHeader->iCurrsequence) { /* 判断客户端断开 */
           // 注意迭代器失效
-          pos2 = pos;
-          pos++;
-          pSocketObj->m_MsgSendQueue.erase(pos2);
+          pos2 = it;
+          it++;
+          sendQueue.erase(pos2);
+          --pSocketObj->m_iSendMsgQueueCount;
+          --pSocketObj->m_iSendLaneCount[iLane];
+          freeSendMsg(pMsgBuf);
+          continue;
+        }
+
+        if (pMsgHeader->iDeadline != 0 &&
+            ngx_time_us() > pMsgHeader->iDeadline) { /* 过期的回包没用了 */
+          itmp = ntohs(pPkgHeader->msgCode);
+          ++pSocketObj->m_iSendExpiredCount[ngx_min(itmp, NGX_MAX_MSGCODE - 1)];
+          --p_Conn->iSendCount;
+          pos2 = it;
+          it++;
+          sendQueue.erase(pos2);
           --pSocketObj->m_iSendMsgQueueCount;
-          p_memory->FreeMemory(pMsgBuf);
+          freeSendMsg(pMsgBuf);
           continue;
         }
 
         if (p_Conn->iThrowsendCount > 0) {
           //靠系统驱动来发送消息，所以这里不能再发送
-          pos++;
+          it++;
           continue;
         }
         --p_Conn->iSendCount;
+        pSocketObj->addSendLatency(pMsgHeader->iEnqueueTime);
 
         //走到这里，可以发送消息
+        /* 只有真正发出去的才算连发，跳过的不占普通消息的机会 */
+        if (iLane == NGX_SEND_PRIO_HIGH)
+          ++iHighBurst;
+        else
+          iHighBurst = 0;
         p_Conn->psendMemPointer = pMsgBuf;
         //发送后释放用的，因为这段内存是new出来的
-        pos2 = pos;
-        pos++;
-        pSocketObj->m_MsgSendQueue.erase(pos2);
+        pos2 = it;
+        it++;
+        sendQueue.erase(pos2);
         --pSocketObj->m_iSendMsgQueueCount;
+        --pSocketObj->m_iSendLaneCount[iLane];
 
         p_Conn->psendbuf = (char *)pPkgHeader;
         //要发送的数据的缓冲区指针，因为发送数据不一定全部都能发送出去，我们要记录数据发送到了哪里，需要知道下次数据从哪里开始发送
@@ -647,7 +1016,7 @@ void *CSocket::ServerSendQueueThread(void *threadData) {
         if (sendsize > 0) {
           if (sendsize == p_Conn->isendlen) {
             //成功发送的和要求发送的数据相等，说明全部发送成功了
-            p_memory->FreeMemory(p_Conn->psendMemPointer); /* 释放内存 */
+            freeSendMsg(p_Conn->psendMemPointer); /* 释放内存 */
             /* 初始化 */
             p_Conn->psendMemPointer = NULL;
             p_Conn->iThrowsendCount = 0;
@@ -686,7 +1055,7 @@ void *CSocket::ServerSendQueueThread(void *threadData) {
           ngx_log_error_core(
               NGX_LOG_INFO, errno,
               "CSocket::ServerSendQueueThread()->sendproc() return0");
-          p_memory->FreeMemory(p_Conn->psendMemPointer);  //释放内存
+          freeSendMsg(p_Conn->psendMemPointer);  //释放内存
           p_Conn->psendMemPointer = NULL;
           p_Conn->iThrowsendCount = 0;
           continue;
@@ -706,7 +1075,7 @@ void *CSocket::ServerSendQueueThread(void *threadData) {
         }
 
         else { /* 对端断开 */
-          p_memory->FreeMemory(p_Conn->psendMemPointer);
+          freeSendMsg(p_Conn->psendMemPointer);
           p_Conn->psendMemPointer = NULL;
           p_Conn->iThrowsendCount = 0;
           continue;
@@ -130,6 +130,12 @@ void CSocket::ngx_event_accept(lpngx_connection_t oldc) {
     }
 
     newc->listening = oldc->listening; /* 连接对象 */
+    newc->iCsumMode = newc->listening->csum; /* 端口默认校验方式 */
+    newc->iStreamMax = newc->listening->streamMax;
+
+    /* 按监听端口的模板设置连接套接字 */
+    ngx_set_accept_profile(s, &newc->listening->profile);
+    newc->iQuickAck = newc->listening->profile.quickack;
 
     newc->rhandler =
         &CSocket::ngx_read_request_handler; /* 设置数据来时的读处理函数 */
@@ -147,6 +153,7 @@ void CSocket::ngx_event_accept(lpngx_connection_t oldc) {
     if (m_ifkickTimeCount == 1) AddToTimerQueue(newc);
 
     ++m_onlineUserCount;
+    newc->ifOnline = true;
 
     break;  //一般就是循环一次就跳出去
   } while (1);
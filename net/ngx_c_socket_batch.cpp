@@ -0,0 +1,110 @@
+/*
+ * @Author: agent
+ * @Date: 2026-10-19 15:49:30
+ * @Last Modified by: agent
+ * @Last Modified time: 2026-10-19 15:49:30
+ * @Description: 批量包的回包合并
+ */
+
+#include <arpa/inet.h>
+
+#include <cstring>
+#include <optional>
+
+#include "ngx_c_memory.h"
+#include "ngx_c_msgbuilder.h"
+#include "ngx_c_socket.h"
+#include "ngx_comm.h"
+
+/* 合并后的包体上限 和收包的上限一致 */
+#define NGX_BATCH_REPLY_MAX \
+  (_PKG_MAX_LENGTH - 1000 - (int)sizeof(COMM_PKG_HEADER))
+
+/* 本线程正在攒的回包 一个线程同时只处理一个批量包 */
+struct ngx_batch_reply_s {
+  STRUC_MSG_HEADER msgHeader;         /* 批量包的消息头 回给谁 */
+  unsigned short iMsgCode;            /* 合并包的消息码 */
+  std::optional<CMsgBuilder> builder; /* 第一个子回包来了才分配 */
+};
+
+static thread_local ngx_batch_reply_s t_batchReply;
+static thread_local ngx_batch_reply_s *t_pBatchReply = nullptr; /* 没在攒为空 */
+
+/*
+ * @ Description: 开始攒回包，之后本线程发给同一连接的回包都合进一个包
+ *   处理函数里 msgSend 的用法不用改
+ * @ Parameter: LPSTRUC_MSG_HEADER pMsgHeader(收到的批量包消息头),
+ *   unsigned short iMsgCode(合并包的消息码)
+ * @ Return: void
+ */
+void CSocket::beginBatchReply(LPSTRUC_MSG_HEADER pMsgHeader,
+                              unsigned short iMsgCode) {
+  ngx_batch_reply_s *pBatch = &t_batchReply;
+  memcpy(&pBatch->msgHeader, pMsgHeader, sizeof(STRUC_MSG_HEADER));
+  pBatch->iMsgCode = iMsgCode;
+  t_pBatchReply = pBatch;
+}
+
+/*
+ * @ Description: 攒下的回包发出去，一个都没有就不发
+ * @ Parameter: void
+ * @ Return: void
+ */
+void CSocket::endBatchReply() {
+  ngx_batch_reply_s *pBatch = t_pBatchReply;
+  if (pBatch == nullptr) return;
+  flushBatchReply();
+  t_pBatchReply = nullptr;
+}
+
+/*
+ * @ Description: 把攒的合并包交给发送队列
+ *   先摘掉本线程的攒包状态，不然 msgSend 又把它攒回来
+ * @ Parameter: void
+ * @ Return: void
+ */
+void CSocket::flushBatchReply() {
+  ngx_batch_reply_s *pBatch = t_pBatchReply;
+  if (!pBatch->builder) return;
+
+  t_pBatchReply = nullptr;
+  msgSend(pBatch->builder->Finish());
+  pBatch->builder.reset();
+  t_pBatchReply = pBatch;
+}
+
+/*
+ * @ Description: msgSend 入口处调用 是本批的子回包就拆下包头合进合并包
+ *   广播、协程等发送完成的、发给别的连接的都照常发
+ * @ Parameter: char *pSendbuf(消息头+包头+包体)
+ * @ Return: bool(攒了返回true，pSendbuf 已经释放)
+ */
+bool CSocket::collectBatchReply(char *pSendbuf) {
+  ngx_batch_reply_s *pBatch = t_pBatchReply;
+  if (pBatch == nullptr) return false;
+
+  LPSTRUC_MSG_HEADER pMsgHeader = (LPSTRUC_MSG_HEADER)pSendbuf;
+  if (pMsgHeader->pSharedPkg != nullptr || pMsgHeader->pSendWaiter != nullptr ||
+      pMsgHeader->pConn != pBatch->msgHeader.pConn ||
+      pMsgHeader->iCurrsequence != pBatch->msgHeader.iCurrsequence)
+    return false;
+
+  LPCOMM_PKG_HEADER pPkgHeader = (LPCOMM_PKG_HEADER)(pSendbuf + m_iLenMsgHeader);
+  int iBodyLen = ntohs(pPkgHeader->pkgLen) - (int)m_iLenPkgHeader;
+  int iItemLen = (int)sizeof(COMM_BATCH_ITEM) + iBodyLen;
+  if (iItemLen > NGX_BATCH_REPLY_MAX) return false; /* 单个就放不下 */
+
+  if (pBatch->builder && pBatch->builder->getBodyLen() + iItemLen >
+                             NGX_BATCH_REPLY_MAX)
+    flushBatchReply(); /* 满了先发一个 */
+  if (!pBatch->builder)
+    pBatch->builder.emplace(&pBatch->msgHeader, pBatch->iMsgCode,
+                            NGX_BATCH_REPLY_MAX);
+
+  CMsgBuilder &builder = *pBatch->builder;
+  builder.PutInt16((unsigned short)iBodyLen);
+  builder.Append(&pPkgHeader->msgCode, sizeof(pPkgHeader->msgCode)); /* 已是网络序 */
+  builder.Append((char *)pPkgHeader + m_iLenPkgHeader, iBodyLen);
+  CMemory::GetInstance()->FreeMemory(pSendbuf);
+  return true;
+}
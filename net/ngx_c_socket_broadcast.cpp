@@ -0,0 +1,168 @@
+/*
+ * @Author: agent
+ * @Date: 2026-10-19 14:57:37
+ * @Last Modified by: agent
+ * @Last Modified time: 2026-10-19 15:38:20
+ * @Description: 广播消息
+ */
+
+#include <arpa/inet.h>
+
+#include <cstring>
+#include <new>
+
+#include "ngx_c_crc32.h"
+#include "ngx_c_lockmutex.h"
+#include "ngx_c_memory.h"
+#include "ngx_c_socket.h"
+#include "ngx_func.h"
+#include "ngx_macro.h"
+
+/*
+ * @ Description: 广播给所有在线连接
+ * @ Parameter: LPCOMM_PKG_HEADER pPkgHeader(包头+包体 网络序),
+ *   lpngx_connection_t pExclude(不发的连接 一般是发起广播的 可以为空),
+ *   int iPrio
+ * @ Return: int 进入发送队列的连接数
+ */
+int CSocket::msgBroadcast(LPCOMM_PKG_HEADER pPkgHeader,
+                          lpngx_connection_t pExclude, int iPrio) {
+  std::vector<STRUC_MSG_HEADER> targets;
+  STRUC_MSG_HEADER target;
+  target.pSharedPkg = nullptr;
+
+  {
+    /* 只在收集连接时锁连接池 */
+    CLock lock(&m_connectionMutex);
+    targets.reserve(m_connectionList.size());
+    std::list<lpngx_connection_t>::iterator pos;
+    for (pos = m_connectionList.begin(); pos != m_connectionList.end(); ++pos) {
+      if ((*pos)->ifOnline == false || (*pos) == pExclude) continue;
+      target.pConn = (*pos);
+      target.iCurrsequence = (*pos)->iCurrsequence;
+      targets.push_back(target);
+    }
+  }
+
+  return msgBroadcast(pPkgHeader, targets, iPrio);
+}
+
+/*
+ * @ Description: 广播给指定连接
+ *   包头 crc32 字段由这里按各连接协商的校验方式填，调用者不用算
+ *   校验方式相同的连接共用一份包，一般只有一种
+ * @ Parameter: LPCOMM_PKG_HEADER pPkgHeader(包头+包体 网络序),
+ *   const std::vector<STRUC_MSG_HEADER> &targets(连接和序号), int iPrio
+ * @ Return: int 进入发送队列的连接数
+ */
+int CSocket::msgBroadcast(LPCOMM_PKG_HEADER pPkgHeader,
+                          const std::vector<STRUC_MSG_HEADER> &targets,
+                          int iPrio) {
+  ++m_iBroadcastCount;
+  if (targets.empty()) return 0;
+
+  int iMode = targets[0].pConn->iCsumMode;
+  size_t i = 1;
+  while (i < targets.size() && targets[i].pConn->iCsumMode == iMode) ++i;
+  if (i == targets.size())
+    return msgBroadcastGroup(pPkgHeader, targets, iMode, iPrio);
+
+  /* 有不同校验方式的连接，按方式分组 */
+  std::vector<STRUC_MSG_HEADER> group[NGX_CSUM_N];
+  for (i = 0; i < targets.size(); ++i) {
+    iMode = targets[i].pConn->iCsumMode;
+    if (iMode < 0 || iMode >= NGX_CSUM_N) iMode = NGX_CSUM_CRC32;
+    group[iMode].push_back(targets[i]);
+  }
+  int iQueued = 0;
+  for (iMode = 0; iMode < NGX_CSUM_N; ++iMode) {
+    if (!group[iMode].empty())
+      iQueued += msgBroadcastGroup(pPkgHeader, group[iMode], iMode, iPrio);
+  }
+  return iQueued;
+}
+
+/*
+ * @ Description: 广播给校验方式相同的一组连接
+ *   所有连接共用一块内存[STRUC_SHARED_PKG][n个消息头][包头+包体]
+ *   只分配一次拷贝一次，加锁一次全部进入发送队列
+ * @ Parameter: LPCOMM_PKG_HEADER pPkgHeader(包头+包体 网络序),
+ *   const std::vector<STRUC_MSG_HEADER> &targets(连接和序号),
+ *   int iCsumMode(NGX_CSUM_*), int iPrio
+ * @ Return: int 进入发送队列的连接数
+ */
+int CSocket::msgBroadcastGroup(LPCOMM_PKG_HEADER pPkgHeader,
+                               const std::vector<STRUC_MSG_HEADER> &targets,
+                               int iCsumMode, int iPrio) {
+  if (targets.empty()) return 0;
+
+  CMemory *p_memory = CMemory::GetInstance();
+  size_t iCount = targets.size();
+  unsigned short iPkgLen = ntohs(pPkgHeader->pkgLen);
+
+  char *pBlock = (char *)p_memory->AllocMemory(
+      sizeof(STRUC_SHARED_PKG) + iCount * m_iLenMsgHeader + iPkgLen, false);
+  LPSTRUC_SHARED_PKG pShared = new (pBlock) STRUC_SHARED_PKG();
+  char *pMsgBuf = pBlock + sizeof(STRUC_SHARED_PKG); /* 第一个消息头 */
+  pShared->pPkg = pMsgBuf + iCount * m_iLenMsgHeader;
+  memcpy(pShared->pPkg, pPkgHeader, iPkgLen);
+  ((LPCOMM_PKG_HEADER)pShared->pPkg)->crc32 =
+      htonl(CCRC32::GetInstance()->Update_Csum(
+          iCsumMode, 0, (unsigned char *)pShared->pPkg + m_iLenPkgHeader,
+          iPkgLen - m_iLenPkgHeader));
+
+  unsigned short iMsgCode = ntohs(pPkgHeader->msgCode);
+  if (iPrio < 0 || iPrio >= NGX_SEND_PRIO_LANES) { /* 按消息码决定 */
+    iPrio = getSendPrio(iMsgCode);
+  }
+  STRUC_MSG_HEADER deadline; /* 所有连接同一个入队时间和期限 */
+  setSendDeadline(&deadline, iMsgCode, -1);
+
+  int iQueued = 0;
+  LPSTRUC_MSG_HEADER pMsgHeader;
+  lpngx_connection_t p_Conn;
+
+  CLock lock(&m_sendMessageQueueMutex);
+
+  /* 发送线程拿不到锁，引用计数在放锁前设置好即可 */
+  for (size_t i = 0; i < iCount; ++i) {
+    p_Conn = targets[i].pConn;
+    if (p_Conn->iCurrsequence != targets[i].iCurrsequence) continue; /* 断了 */
+
+    if (p_Conn->iSendCount > 400) {
+      //收消息太慢的连接这条广播就不发了，踢人交给msgSend()
+      ++m_iBroadcastSkipCount;
+      continue;
+    }
+
+    pMsgHeader = (LPSTRUC_MSG_HEADER)(pMsgBuf + iQueued * m_iLenMsgHeader);
+    pMsgHeader->pConn = p_Conn;
+    pMsgHeader->iCurrsequence = targets[i].iCurrsequence;
+    pMsgHeader->pSharedPkg = pShared;
+    pMsgHeader->iEnqueueTime = deadline.iEnqueueTime;
+    pMsgHeader->iDeadline = deadline.iDeadline;
+    pMsgHeader->pSendWaiter = nullptr;
+    pMsgHeader->bCrcChecked = false;
+
+    ++p_Conn->iSendCount;
+    m_MsgSendQueue[iPrio].push_back((char *)pMsgHeader);
+    ++iQueued;
+  }
+
+  if (iQueued == 0) {
+    pShared->~STRUC_SHARED_PKG();
+    p_memory->FreeMemory(pBlock);
+    return 0;
+  }
+
+  pShared->iRefCount = iQueued;
+  m_iSendMsgQueueCount += iQueued;
+  m_iSendLaneCount[iPrio] += iQueued;
+
+  //整批只唤醒一次发送线程
+  wakeSendThread();
+  ngx_log_error_core(NGX_LOG_DEBUG, 0,
+                     "CSocket::msgBroadcast() [%d/%d] success", iQueued,
+                     iCount);
+  return iQueued;
+}
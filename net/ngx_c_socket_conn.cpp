@@ -11,6 +11,7 @@
 #include <cerrno>
 #include <cstring>
 
+#include "ngx_c_crc32.h"
 #include "ngx_c_lockmutex.h"
 #include "ngx_c_memory.h"
 #include "ngx_c_socket.h"
@@ -22,7 +23,7 @@
 /*
  * Description: 构造函数
  */
-ngx_connection_s::ngx_connection_s() : iCurrsequence(0) {
+ngx_connection_s::ngx_connection_s() : iCurrsequence(0), iSlot(0) {
   pthread_mutex_init(&logicPorcMutex, NULL);
 }
 /*
@@ -51,6 +52,13 @@ void ngx_connection_s::GetOneToUse() {
   FloodkickLastTime = 0;
   FloodAttackCount = 0;
   iSendCount = 0;
+  ifOnline = false;
+  iRecvQueued = 0;
+  bRecvPaused = false;
+  iCsumMode = NGX_CSUM_CRC32;
+  iFraming = NGX_FRAMING_V1;
+  iStreamTotal = 0;
+  iStreamOffset = 0;
 }
 
 /*
@@ -63,11 +71,12 @@ void ngx_connection_s::PutOneToFree() {
     precvMemPointer = NULL;
   }
   if (psendMemPointer != NULL) {
-    CMemory::GetInstance()->FreeMemory(psendMemPointer);
+    CSocket::freeSendMsg(psendMemPointer);
     psendMemPointer = NULL;
   }
 
   iThrowsendCount = 0;
+  ifOnline = false;
 }
 
 /*
@@ -84,6 +93,7 @@ void CSocket::initConnection() {
     p_Conn = (lpngx_connection_t)p_memory->AllocMemory(ilenconnpool, true);
 
     p_Conn = new (p_Conn) ngx_connection_t(); /* 定位new */
+    p_Conn->iSlot = i;
     p_Conn->GetOneToUse();
     m_connectionList.push_back(p_Conn);
     m_freeconnectionList.push_back(p_Conn);
@@ -132,6 +142,7 @@ lpngx_connection_t CSocket::ngx_get_connection(int isock) {
   lpngx_connection_t p_Conn =
       (lpngx_connection_t)p_memory->AllocMemory(sizeof(ngx_connection_t), true);
   p_Conn = new (p_Conn) ngx_connection_t();
+  p_Conn->iSlot = m_total_connection_n;
   p_Conn->GetOneToUse();
   m_connectionList.push_back(p_Conn);
   ++m_total_connection_n;
@@ -211,6 +222,7 @@ void CSocket::inRecyConnectQueue(lpngx_connection_t pConn) {
   /* 等待ServerRecyConnectionThread线程自会处理 */
   ++m_total_recyconnection_n; /* 待释放连接队列大小+1 */
   --m_onlineUserCount;
+  pConn->ifOnline = false;
   return;
 }
 
@@ -223,6 +235,8 @@ void *CSocket::ServerRecyConnectionThread(void *threadData) {
   ThreadItem *pThread = static_cast<ThreadItem *>(threadData);
   CSocket *pSocketObj = pThread->_pThis;
 
+  ngx_affinity_bind_thread(NGX_THREAD_TIMER);
+
   time_t currtime;
   int err;
   std::list<lpngx_connection_t>::iterator pos, posend;
@@ -6,6 +6,8 @@
  * @Description: 打印信息
  */
 
+#include "ngx_c_coroutine.h"
+#include "ngx_c_journal.h"
 #include "ngx_c_socket.h"
 #include "ngx_func.h"
 #include "ngx_global.h"
@@ -30,7 +32,101 @@ void CSocket::printTDInfo() {
     ngx_log_stderr(0,
                    "当前收消息队列/发消息队列大小分别为(%d/"
                    "%d)，丢弃的待发送数据包数量为%d。",
-                   tmprmqc, tmpsmqc, m_iDiscardSendPkgCount);
+                   tmprmqc, tmpsmqc, m_iDiscardSendPkgCount.load());
+    if (m_iBroadcastCount > 0) {
+      ngx_log_stderr(0, "广播%d次，跳过发送积压的连接%d次。",
+                     m_iBroadcastCount.load(), m_iBroadcastSkipCount.load());
+    }
+    ngx_log_stderr(0,
+                   "业务线程 当前/最小/最大(%d/%d/%d)，扩容%d次，退出%d个，"
+                   "平均排队%d微秒。",
+                   g_threadpool.getThreadNum(), g_threadpool.getThreadMin(),
+                   g_threadpool.getThreadMax(), g_threadpool.getGrowCount(),
+                   g_threadpool.getShrinkCount(), g_threadpool.getRecvWaitUs());
+    ngx_log_stderr(0,
+                   "唤醒业务线程的信号数为%d，epoll线程直接处理的消息数为%d。",
+                   g_threadpool.getSignalCount(), m_iRecvInlineCount);
+    ngx_log_stderr(0, "收消息队列满拒绝入队的次数为%d。",
+                   g_threadpool.getRecvMsgFullCount());
+    if (m_iRecvChunkCount > 0) {
+      ngx_log_stderr(0, "分块接收 完成的消息/交付的块(%d/%d)，每块%d字节。",
+                     m_iRecvStreamCount, m_iRecvChunkCount,
+                     (int)m_iRecvChunkSize);
+    }
+    if (g_threadpool.getSchedMode() == NGX_SCHED_SHARED) {
+      int iDepth[NGX_RECV_CLASS_N], iWaitUs[NGX_RECV_CLASS_N];
+      for (int i = 0; i < NGX_RECV_CLASS_N; ++i)
+        g_threadpool.getRecvClassStat(i, iDepth[i], iWaitUs[i]);
+      g_threadpool.resetRecvClassStat(); /* 下次打印的是这段时间的平均值 */
+      ngx_log_stderr(0,
+                     "收消息队列 高/普通/重 长度(%d/%d/%d) 平均排队微秒"
+                     "(%d/%d/%d)，超出并发上限推迟的消息数为%d。",
+                     iDepth[NGX_RECV_CLASS_HIGH], iDepth[NGX_RECV_CLASS_NORMAL],
+                     iDepth[NGX_RECV_CLASS_BULK], iWaitUs[NGX_RECV_CLASS_HIGH],
+                     iWaitUs[NGX_RECV_CLASS_NORMAL],
+                     iWaitUs[NGX_RECV_CLASS_BULK],
+                     g_threadpool.getQuotaDeferCount());
+    }
+    if (g_threadpool.getSchedMode() == NGX_SCHED_STEAL) {
+      ngx_log_stderr(0, "业务线程偷到的消息数为%d。",
+                     g_threadpool.getStealCount());
+    }
+    CCoScheduler *p_co = CCoScheduler::GetInstance();
+    ngx_log_stderr(0, "协程 等定时器/等IO(%d/%d)，线程池恢复协程%d次。",
+                   p_co->getTimerCount(), p_co->getIoCount(),
+                   g_threadpool.getTaskCount());
+    CUserJournal *p_journal = CUserJournal::GetInstance();
+    if (p_journal->isEnabled()) {
+      ngx_log_stderr(0, "注册日志 暂存/write/fdatasync/记录(%d/%d/%d/%d)。",
+                     p_journal->getQueueCount(), p_journal->getWriteCount(),
+                     p_journal->getSyncCount(), p_journal->getRecordCount());
+    }
+    if (m_iRecvQueueMax > 0) {
+      ngx_log_stderr(0,
+                     "收消息队列上限%d，过载 丢弃/暂停读/回忙 次数(%d/%d/%d)，"
+                     "恢复读%d次。",
+                     m_iRecvQueueMax,
+                     m_iRecvOverloadCount[NGX_RECV_OVERLOAD_DROP].load(),
+                     m_iRecvOverloadCount[NGX_RECV_OVERLOAD_PAUSE].load(),
+                     m_iRecvOverloadCount[NGX_RECV_OVERLOAD_BUSY].load(),
+                     m_iRecvResumeCount.load());
+    }
+    ngx_log_stderr(0, "发消息队列 高优先级/普通(%d/%d)。",
+                   m_iSendLaneCount[NGX_SEND_PRIO_HIGH].load(),
+                   m_iSendLaneCount[NGX_SEND_PRIO_BULK].load());
+
+    /* 发送延迟直方图和过期丢弃，只打印有数据的格子 */
+    char strinfo[512];
+    /* 留一个字节放结尾的0，ngx_slprintf 写满时返回 last */
+    u_char *p = (u_char *)strinfo,
+           *last = (u_char *)strinfo + sizeof(strinfo) - 1;
+    for (int i = 0; i < NGX_SEND_LAT_BUCKETS; ++i) {
+      if (m_iSendLatency[i] == 0) continue;
+      p = ngx_slprintf(p, last, " [<%dus]%d", 2 << i,
+                       m_iSendLatency[i].load());
+    }
+    *p = 0;
+    ngx_log_stderr(0, "入队到发送延迟分布:%s", strinfo);
+    p = (u_char *)strinfo;
+    for (int i = 0; i < NGX_MAX_MSGCODE; ++i) {
+      if (m_iSendExpiredCount[i] == 0) continue;
+      p = ngx_slprintf(p, last, " [code %d]%d", i,
+                       m_iSendExpiredCount[i].load());
+    }
+    *p = 0;
+    if (p != (u_char *)strinfo) ngx_log_stderr(0, "过期丢弃的回包:%s", strinfo);
+    p = (u_char *)strinfo;
+    for (int i = 0; i < NGX_MAX_MSGCODE; ++i) {
+      int iCalls = m_iRecvCallCount[i];
+      if (iCalls == 0) continue;
+      p = ngx_slprintf(p, last, " [code %d]%d/%d/%dus", i, iCalls,
+                       (int)m_iRecvErrCount[i],
+                       (int)(m_iRecvLatencyUs[i] / iCalls));
+    }
+    *p = 0;
+    if (p != (u_char *)strinfo)
+      ngx_log_stderr(0, "消息码处理 次数/失败/平均耗时:%s", strinfo);
+
     if (tmprmqc > 100000) {
       //接收队列过大，报一下，这个属于应该 引起警觉的，考虑限速等等手段
       ngx_log_stderr(0,
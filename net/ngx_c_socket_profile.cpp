@@ -0,0 +1,140 @@
+/*
+ * @Author: agent
+ * @Date: 2026-10-19 14:54:08
+ * @Last Modified by: agent
+ * @Last Modified time: 2026-10-19 14:54:08
+ * @Description: 监听端口 tcp 参数模板
+ */
+
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include "ngx_c_conf.h"
+#include "ngx_c_socket.h"
+#include "ngx_func.h"
+#include "ngx_macro.h"
+
+/*
+ * @ Description: 读取端口对应的 tcp 参数模板
+ * @ Parameter: int iport(监听端口下标), lpngx_tcp_profile_t profile
+ * @ Return: void
+ */
+void CSocket::ngx_read_tcp_profile(int iport, lpngx_tcp_profile_t profile) {
+  CConfig *p_config = CConfig::GetInstance();
+  char strinfo[100];
+
+  memset(profile, 0, sizeof(ngx_tcp_profile_t));
+
+  sprintf(strinfo, "ListenPort%dProfile", iport);
+  int iprofile = p_config->GetIntDefault(strinfo, -1);
+  if (iprofile < 0) return; /* 没配置模板就全部用系统默认值 */
+
+  if (iprofile >= p_config->GetIntDefault("TcpProfileCount", 0)) {
+    ngx_log_error_core(NGX_LOG_WARN, 0,
+                       "CSocket::ngx_read_tcp_profile() ListenPort%d "
+                       "Profile = %d not exist",
+                       iport, iprofile);
+    return;
+  }
+
+  sprintf(strinfo, "TcpProfile%d_NoDelay", iprofile);
+  profile->nodelay = p_config->GetIntDefault(strinfo, 0);
+  sprintf(strinfo, "TcpProfile%d_QuickAck", iprofile);
+  profile->quickack = p_config->GetIntDefault(strinfo, 0);
+  sprintf(strinfo, "TcpProfile%d_NotSentLowat", iprofile);
+  profile->notsentlowat = p_config->GetIntDefault(strinfo, 0);
+  sprintf(strinfo, "TcpProfile%d_SndBuf", iprofile);
+  profile->sndbuf = p_config->GetIntDefault(strinfo, 0);
+  sprintf(strinfo, "TcpProfile%d_RcvBuf", iprofile);
+  profile->rcvbuf = p_config->GetIntDefault(strinfo, 0);
+  sprintf(strinfo, "TcpProfile%d_FastOpen", iprofile);
+  profile->fastopen = p_config->GetIntDefault(strinfo, 0);
+  sprintf(strinfo, "TcpProfile%d_UserTimeout", iprofile);
+  profile->usertimeout = p_config->GetIntDefault(strinfo, 0);
+
+  ngx_log_error_core(NGX_LOG_INFO, 0,
+                     "ListenPort%d use TcpProfile%d [nodelay = %d quickack = "
+                     "%d notsentlowat = %d sndbuf = %d rcvbuf = %d fastopen = "
+                     "%d usertimeout = %d]",
+                     iport, iprofile, profile->nodelay, profile->quickack,
+                     profile->notsentlowat, profile->sndbuf, profile->rcvbuf,
+                     profile->fastopen, profile->usertimeout);
+  return;
+}
+
+/*
+ * @ Description: listen() 之前设置监听套接字
+ *   缓冲区大小在 listen 前设置，accept 出来的套接字会继承
+ * @ Parameter: int fd, lpngx_tcp_profile_t profile
+ * @ Return: void
+ */
+void CSocket::ngx_set_listen_profile(int fd, lpngx_tcp_profile_t profile) {
+  if (profile->sndbuf > 0 &&
+      setsockopt(fd, SOL_SOCKET, SO_SNDBUF, (const void *)&profile->sndbuf,
+                 sizeof(profile->sndbuf)) == -1) {
+    ngx_log_error_core(NGX_LOG_ERR, errno,
+                       "CSocket::ngx_set_listen_profile()->SO_SNDBUF failed");
+  }
+
+  if (profile->rcvbuf > 0 &&
+      setsockopt(fd, SOL_SOCKET, SO_RCVBUF, (const void *)&profile->rcvbuf,
+                 sizeof(profile->rcvbuf)) == -1) {
+    ngx_log_error_core(NGX_LOG_ERR, errno,
+                       "CSocket::ngx_set_listen_profile()->SO_RCVBUF failed");
+  }
+
+  /* fastopen 只对监听套接字有意义，值为队列长度 */
+  if (profile->fastopen > 0 &&
+      setsockopt(fd, IPPROTO_TCP, TCP_FASTOPEN,
+                 (const void *)&profile->fastopen,
+                 sizeof(profile->fastopen)) == -1) {
+    ngx_log_error_core(NGX_LOG_ERR, errno,
+                       "CSocket::ngx_set_listen_profile()->TCP_FASTOPEN failed");
+  }
+  return;
+}
+
+/*
+ * @ Description: accept() 之后设置连接套接字
+ * @ Parameter: int fd, lpngx_tcp_profile_t profile
+ * @ Return: void
+ */
+void CSocket::ngx_set_accept_profile(int fd, lpngx_tcp_profile_t profile) {
+  if (profile->nodelay > 0 &&
+      setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, (const void *)&profile->nodelay,
+                 sizeof(profile->nodelay)) == -1) {
+    ngx_log_error_core(NGX_LOG_ERR, errno,
+                       "CSocket::ngx_set_accept_profile()->TCP_NODELAY failed");
+  }
+
+  if (profile->quickack > 0 &&
+      setsockopt(fd, IPPROTO_TCP, TCP_QUICKACK,
+                 (const void *)&profile->quickack,
+                 sizeof(profile->quickack)) == -1) {
+    ngx_log_error_core(NGX_LOG_ERR, errno,
+                       "CSocket::ngx_set_accept_profile()->TCP_QUICKACK failed");
+  }
+
+  if (profile->notsentlowat > 0 &&
+      setsockopt(fd, IPPROTO_TCP, TCP_NOTSENT_LOWAT,
+                 (const void *)&profile->notsentlowat,
+                 sizeof(profile->notsentlowat)) == -1) {
+    ngx_log_error_core(
+        NGX_LOG_ERR, errno,
+        "CSocket::ngx_set_accept_profile()->TCP_NOTSENT_LOWAT failed");
+  }
+
+  if (profile->usertimeout > 0 &&
+      setsockopt(fd, IPPROTO_TCP, TCP_USER_TIMEOUT,
+                 (const void *)&profile->usertimeout,
+                 sizeof(profile->usertimeout)) == -1) {
+    ngx_log_error_core(
+        NGX_LOG_ERR, errno,
+        "CSocket::ngx_set_accept_profile()->TCP_USER_TIMEOUT failed");
+  }
+  return;
+}
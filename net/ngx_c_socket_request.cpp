@@ -7,11 +7,14 @@
  */
 
 #include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <unistd.h>
 
 #include <cerrno>
 #include <cstring>
 
+#include "ngx_c_crc32.h"
 #include "ngx_c_lockmutex.h"
 #include "ngx_c_memory.h"
 #include "ngx_c_socket.h"
@@ -29,11 +32,26 @@ void CSocket::ngx_read_request_handler(lpngx_connection_t c) {
   ssize_t reco = recvproc(c, c->precvbuf, c->irecvlen);
   if (reco <= 0) return;
 
+  /* 包体边收边算CRC，刚收到的数据还在这个核的缓存里 */
+  /* 分块接收的包体没有整包可算，总是边收边算，最后一块收完再比较 */
+  if (c->curStat == _PKG_BD_INIT || c->curStat == _PKG_BD_RECVING) {
+    LPSTRUC_MSG_HEADER pMsgHeader = (LPSTRUC_MSG_HEADER)c->precvMemPointer;
+    if (c->iStreamTotal > 0) {
+      c->iStreamCrc = CCRC32::GetInstance()->Update_Csum(
+          pMsgHeader->iCsumMode, c->iStreamCrc, (unsigned char *)c->precvbuf,
+          reco);
+    } else if (m_iRecvCrcInline) {
+      c->iRecvCrc = CCRC32::GetInstance()->Update_Csum(
+          pMsgHeader->iCsumMode, c->iRecvCrc, (unsigned char *)c->precvbuf,
+          reco);
+    }
+  }
+
   //走到这里，说明成功收到了一些字节（>0）就要开始判断收到了多少数据了
   if (c->curStat == _PKG_HD_INIT) {
     /* 连接建立起来时肯定是这个状态 */
     /* 因为在ngx_get_connection()中已经把curStat成员赋值成_PKG_HD_INIT */
-    if (reco == (ssize_t)m_iLenPkgHeader) { /* 正好收到完整包头，这里拆解包头 */
+    if (reco == (ssize_t)c->irecvlen) { /* 正好收到完整包头，这里拆解包头 */
       /* 那就调用专门针对包头处理 */
       ngx_read_request_handler_proc_p1(c, isflood);
     } else { /* 收到包头不完整 */
@@ -54,12 +72,15 @@ void CSocket::ngx_read_request_handler(lpngx_connection_t c) {
     }
   } else if (c->curStat == _PKG_BD_INIT) { /* 刚好收完包头 */
     if (reco == c->irecvlen) {
-      if (m_floodAkEnable == 1) {
-        // Flood攻击检测是否开启
+      if (m_floodAkEnable == 1 && c->iStreamOffset == 0) {
+        // Flood攻击检测是否开启 分块接收的只在第一块算一次
         isflood = TestFlood(c);
       }
       /* 收到的宽度等于要收的宽度，包体也收完整了 */
-      ngx_read_request_handler_proc_plast(c, isflood);
+      if (c->iStreamTotal > 0)
+        ngx_read_request_handler_proc_chunk(c, isflood);
+      else
+        ngx_read_request_handler_proc_plast(c, isflood);
     } else { /* 收到宽度小于提供宽度 */
       c->curStat = _PKG_BD_RECVING;
       c->precvbuf = c->precvbuf + reco;
@@ -67,11 +88,14 @@ void CSocket::ngx_read_request_handler(lpngx_connection_t c) {
     }
   } else if (c->curStat == _PKG_BD_RECVING) { /* 包体不完整 */
     if (c->irecvlen == reco) {
-      if (m_floodAkEnable == 1) {
+      if (m_floodAkEnable == 1 && c->iStreamOffset == 0) {
         // Flood攻击检测是否开启
         isflood = TestFlood(c);
       }
-      ngx_read_request_handler_proc_plast(c, isflood);
+      if (c->iStreamTotal > 0)
+        ngx_read_request_handler_proc_chunk(c, isflood);
+      else
+        ngx_read_request_handler_proc_plast(c, isflood);
     } else {
       c->precvbuf = c->precvbuf + reco;
       c->irecvlen = c->irecvlen - reco;
@@ -156,25 +180,50 @@ ssize_t CSocket::recvproc(lpngx_connection_t c, char *buff, ssize_t buflen) {
 
   /* 能走到这里的，就认为收到了有效数据 */
 
+  /*
+   * quickack 不是持久选项，内核随时可能退回延迟确认，收包后重新打开
+   *   每次收包多一次系统调用，只有模板打开了 quickack 的端口才做
+   */
+  if (c->iQuickAck > 0 &&
+      setsockopt(c->fd, IPPROTO_TCP, TCP_QUICKACK, (const void *)&c->iQuickAck,
+                 sizeof(c->iQuickAck)) == -1) {
+    ngx_log_error_core(NGX_LOG_ERR, errno,
+                       "CSocket::recvproc()->TCP_QUICKACK failed");
+    c->iQuickAck = 0; /* 失败一次就不再每次收包都试 */
+  }
+
   // ngx_log_error_core(NGX_LOG_DEBUG, 0, "ngx_recvpro() success [data %d]", n);
   return n; /* 返回收到的字节数 */
 }
 
 /*
  * @ Description: 收到包头后续处理加入消息头更改状态等
+ *   v2 包头在这里换成 v1 包头，后面的流程和业务线程都只认 v1
+ *   分块交付的消息码包体超过一块时按块分配内存，不整包缓存，上限按连接算
+ *   其他消息码用 v2 包头也是整包缓存，包体还是不能超过 _PKG_MAX_LENGTH-1000
  * @ Parameter: lpngx_connection_t c
  * @ Return: void
  */
 void CSocket::ngx_read_request_handler_proc_p1(lpngx_connection_t c,
                                                bool &isflood) {
-  CMemory *p_memory = CMemory::GetInstance();
-
-  LPCOMM_PKG_HEADER pPkgHeader;
-  pPkgHeader = (LPCOMM_PKG_HEADER)c->dataHeadInfo;
   /* 正好收到包头时，包头信息肯定是在dataHeadInfo里 */
-
-  unsigned short e_pkgLen;
-  e_pkgLen = ntohs(pPkgHeader->pkgLen);
+  unsigned int iHeaderLen = getRecvHeaderLen(c);
+  unsigned int e_pkgLen;
+  unsigned short iMsgCode;
+  int iCrc32; /* 网络序 原样放进 v1 包头 */
+  bool bBad = false;
+  if (c->iFraming == NGX_FRAMING_V2) {
+    LPCOMM_PKG_HEADER_V2 pPkgHeader = (LPCOMM_PKG_HEADER_V2)c->dataHeadInfo;
+    e_pkgLen = ntohl(pPkgHeader->pkgLen);
+    iMsgCode = ntohs(pPkgHeader->msgCode);
+    iCrc32 = pPkgHeader->crc32;
+    bBad = (pPkgHeader->flags != 0); /* 保留位，将来加的功能老服务器不认 */
+  } else {
+    LPCOMM_PKG_HEADER pPkgHeader = (LPCOMM_PKG_HEADER)c->dataHeadInfo;
+    e_pkgLen = ntohs(pPkgHeader->pkgLen);
+    iMsgCode = ntohs(pPkgHeader->msgCode);
+    iCrc32 = pPkgHeader->crc32;
+  }
   /* 注意这里网络序转本机序，所有传输到网络上的2字节数据 */
   /* 都要用htons()转成网络序，所有从网络上收到的2字节数据 */
   /* 都要用ntohs()转成本机序 */
@@ -182,59 +231,118 @@ void CSocket::ngx_read_request_handler_proc_p1(lpngx_connection_t c,
   /* 不管客户端/服务器是什么操作系统，发送的数字是多少，收到的就是多少 */
 
   //恶意包或者错误包的判断
-  if (e_pkgLen < m_iLenPkgHeader) { /* 包长怎么可能比包头还小 */
-    /* 整个包长是包头+包体，就算包体为0字节 */
-    /* 那么至少e_pkgLen  == m_iLenPkgHeader */
+  if (e_pkgLen < iHeaderLen) bBad = true; /* 包长怎么可能比包头还小 */
+  unsigned int iBodyLen = bBad ? 0 : e_pkgLen - iHeaderLen;
+  bool bChunked = getRecvChunked(iMsgCode);
+  bool bStream = (bChunked && c->iFraming == NGX_FRAMING_V2 &&
+                  iBodyLen > m_iRecvChunkSize);
+  if (bStream ? iBodyLen > c->iStreamMax
+              : m_iLenPkgHeader + iBodyLen > _PKG_MAX_LENGTH - 1000)
+    bBad = true; /* 太大 客户端说包长度 > 29000? 肯定是恶意包 */
+
+  if (bBad) {
     /* 状态和接收位置都复原 */
     /* 因为有可能在其他状态比如_PKG_HD_RECVING状态调用这个函数 */
-    c->curStat = _PKG_HD_INIT;
-    c->precvbuf = c->dataHeadInfo;
-    c->irecvlen = m_iLenPkgHeader;
-  } else if (e_pkgLen > (_PKG_MAX_LENGTH - 1000)) { /* 太大 */
-    /* 客户端发来包居然说包长度 > 29000?肯定是恶意包 */
-    c->curStat = _PKG_HD_INIT;
-    c->precvbuf = c->dataHeadInfo;
-    c->irecvlen = m_iLenPkgHeader;
-  } else { /* 合法包头 */
-    /* 分配内存收包体因为包体长度并不固定 */
-    char *pTmpBuffer =
-        (char *)p_memory->AllocMemory(m_iLenMsgHeader + e_pkgLen, false);
-    /* 分配内存【长度是 消息头长度  + 包头长度 + */
-    /* 包体长度】，最后参数先给false，表示内存不需要memset */
-    /* 标记我们new了内存，将来在ngx_free_connection()要回收的 */
-    c->precvMemPointer = pTmpBuffer;  //数据内存开始指针
-
-    // a)先填写消息头内容
-    LPSTRUC_MSG_HEADER ptmpMsgHeader = (LPSTRUC_MSG_HEADER)pTmpBuffer;
-    ptmpMsgHeader->pConn = c;
-    ptmpMsgHeader->iCurrsequence = c->iCurrsequence;
-    /* 收到包时的连接池中连接序号记录到消息头里来，以备将来用 */
-
-    // b)再填写包头内容
-    pTmpBuffer += m_iLenMsgHeader; /* 往后跳，跳过消息头，指向包头 */
-    memcpy(pTmpBuffer, pPkgHeader, m_iLenPkgHeader);
-    /* 直接把收到的包头拷贝进来 */
-    if (e_pkgLen == m_iLenPkgHeader) { /* 该报文只有包头无包体 */
-      if (m_floodAkEnable == 1) {
-        // Flood攻击检测是否开启
-        isflood = TestFlood(c);
-      }
-      ngx_read_request_handler_proc_plast(c, isflood);
-    } else { /* 收包体 */
-      c->curStat = _PKG_BD_INIT;
-      /* 当前状态发生改变，包头刚好收完，准备接收包体 */
-      c->precvbuf = pTmpBuffer + m_iLenPkgHeader;
-      /*  pTmpBuffer指向包头，这里 +m_iLenPkgHeader后指向包体位置 */
-      c->irecvlen = e_pkgLen - m_iLenPkgHeader;
-      /* e_pkgLen是整个包【包头+包体】大小，-m_iLenPkgHeader【包头】= 包体 */
+    resetRecvHeader(c);
+    return;
+  }
+
+  /* 合法包头 分配内存收包体因为包体长度并不固定 */
+  char *pTmpBuffer;
+  if (bStream) {
+    c->iStreamTotal = iBodyLen;
+    c->iStreamOffset = 0;
+    c->iStreamCrc = 0;
+    c->iStreamCrcWant = ntohl(iCrc32);
+    pTmpBuffer = allocRecvChunk(c, iMsgCode);
+  } else {
+    pTmpBuffer = allocRecvMsg(c, iMsgCode, iBodyLen, iCrc32);
+    if (bChunked) { /* 一块就装得下，整包作为唯一一块交付 */
+      LPSTRUC_MSG_HEADER ptmpMsgHeader = (LPSTRUC_MSG_HEADER)pTmpBuffer;
+      ptmpMsgHeader->iChunkFlags = NGX_CHUNK_STREAM | NGX_CHUNK_LAST;
+      ptmpMsgHeader->iChunkTotal = iBodyLen;
     }
   }
+  /* 标记我们new了内存，将来在ngx_free_connection()要回收的 */
+  c->precvMemPointer = pTmpBuffer; //数据内存开始指针
+  c->iRecvCrc = 0;
+
+  LPCOMM_PKG_HEADER pPkgHeader =
+      (LPCOMM_PKG_HEADER)(pTmpBuffer + m_iLenMsgHeader);
+  unsigned int iRecvLen = ntohs(pPkgHeader->pkgLen) - m_iLenPkgHeader;
+  if (iRecvLen == 0) { /* 该报文只有包头无包体 */
+    if (m_floodAkEnable == 1) {
+      // Flood攻击检测是否开启
+      isflood = TestFlood(c);
+    }
+    ngx_read_request_handler_proc_plast(c, isflood);
+  } else { /* 收包体 */
+    c->curStat = _PKG_BD_INIT;
+    /* 当前状态发生改变，包头刚好收完，准备接收包体 */
+    c->precvbuf = (char *)pPkgHeader + m_iLenPkgHeader;
+    /* 跳过包头指向包体位置 分块接收时只收这一块 */
+    c->irecvlen = iRecvLen;
+  }
 
   // ngx_log_error_core(NGX_LOG_DEBUG, 0,
   //                    "ngx_wait_request_handle_proc_p1() success");
   return;
 }
 
+/*
+ * @ Description: 分配收包内存 [消息头][v1包头][包体]，填好消息头和包头
+ * @ Parameter: lpngx_connection_t c, unsigned short iMsgCode(本机序),
+ *   unsigned int iBodyLen(不超过一个v1包), int iCrc32(网络序)
+ * @ Return: char *
+ */
+char *CSocket::allocRecvMsg(lpngx_connection_t c, unsigned short iMsgCode,
+                            unsigned int iBodyLen, int iCrc32) {
+  /* 最后参数先给false，表示内存不需要memset */
+  char *pTmpBuffer = (char *)CMemory::GetInstance()->AllocMemory(
+      m_iLenMsgHeader + m_iLenPkgHeader + iBodyLen, false);
+
+  // a)先填写消息头内容
+  LPSTRUC_MSG_HEADER ptmpMsgHeader = (LPSTRUC_MSG_HEADER)pTmpBuffer;
+  ptmpMsgHeader->pConn = c;
+  ptmpMsgHeader->iCurrsequence = c->iCurrsequence;
+  /* 收到包时的连接池中连接序号记录到消息头里来，以备将来用 */
+  ptmpMsgHeader->pSharedPkg = nullptr;
+  ptmpMsgHeader->pSendWaiter = nullptr;
+  ptmpMsgHeader->bCrcChecked = false;
+  ptmpMsgHeader->iCsumMode = c->iCsumMode;
+  ptmpMsgHeader->iChunkFlags = 0;
+  ptmpMsgHeader->iChunkOffset = 0;
+  ptmpMsgHeader->iChunkTotal = 0;
+
+  // b)再填写包头内容 收到的是哪种包头这里都是 v1
+  LPCOMM_PKG_HEADER pPkgHeader =
+      (LPCOMM_PKG_HEADER)(pTmpBuffer + m_iLenMsgHeader);
+  pPkgHeader->pkgLen = htons((unsigned short)(m_iLenPkgHeader + iBodyLen));
+  pPkgHeader->msgCode = htons(iMsgCode);
+  pPkgHeader->crc32 = iCrc32;
+  return pTmpBuffer;
+}
+
+/*
+ * @ Description: 分块接收 按连接上的进度分配下一块
+ *   整个包体的校验在收的时候算，每一块都标记为已校验
+ * @ Parameter: lpngx_connection_t c, unsigned short iMsgCode(本机序)
+ * @ Return: char *
+ */
+char *CSocket::allocRecvChunk(lpngx_connection_t c, unsigned short iMsgCode) {
+  unsigned int iLeft = c->iStreamTotal - c->iStreamOffset;
+  unsigned int iChunkLen =
+      (iLeft > m_iRecvChunkSize) ? m_iRecvChunkSize : iLeft;
+  char *pTmpBuffer = allocRecvMsg(c, iMsgCode, iChunkLen, 0);
+
+  LPSTRUC_MSG_HEADER ptmpMsgHeader = (LPSTRUC_MSG_HEADER)pTmpBuffer;
+  ptmpMsgHeader->bCrcChecked = true;
+  ptmpMsgHeader->iChunkFlags = NGX_CHUNK_STREAM;
+  ptmpMsgHeader->iChunkOffset = c->iStreamOffset;
+  ptmpMsgHeader->iChunkTotal = c->iStreamTotal;
+  return pTmpBuffer;
+}
+
 /*
  * @ Description: 收包体
  * @ Parameter: lpngx_connect_t c
@@ -242,10 +350,49 @@ void CSocket::ngx_read_request_handler_proc_p1(lpngx_connection_t c,
  */
 void CSocket::ngx_read_request_handler_proc_plast(lpngx_connection_t p_Conn,
                                                   bool &isflood) {
-  if (isflood == false) {
-    g_threadpool.inMsgRecvQueueAndSingal(
-        p_Conn->precvMemPointer); /* 整个数据包地址传入 */
-  } else {
+  bool bAdmit = (isflood == false);
+  LPCOMM_PKG_HEADER pPkgHeader =
+      (LPCOMM_PKG_HEADER)(p_Conn->precvMemPointer + m_iLenMsgHeader);
+  LPSTRUC_MSG_HEADER pMsgHeader = (LPSTRUC_MSG_HEADER)p_Conn->precvMemPointer;
+  if (bAdmit && pMsgHeader->iCsumMode == NGX_CSUM_NONE) {
+    pMsgHeader->bCrcChecked = true; /* 不校验的连接 crc32 字段不看 */
+  } else if (bAdmit && m_iRecvCrcInline) {
+    /* 没有包体时 iRecvCrc 是0，和只有包头的crc值给0的约定一致 */
+    if ((unsigned int)ntohl(pPkgHeader->crc32) != p_Conn->iRecvCrc) {
+      ngx_log_stderr(0,
+                     "CSocket::ngx_read_request_handler_proc_plast()中CRC错误，"
+                     "丢弃数据!");
+      addRecvStat(ntohs(pPkgHeader->msgCode), NGX_MSG_ERR_CRC, 0);
+      bAdmit = false; /* crc错，不进线程池直接丢弃 */
+    } else {
+      pMsgHeader->bCrcChecked = true;
+    }
+  }
+  if (bAdmit && m_iRecvQueueMax > 0 &&
+      g_threadpool.getRecvMsgQueueCount() >= m_iRecvQueueMax)
+    bAdmit = recvOverload(p_Conn); /* 队列满了，按策略决定收不收 */
+
+  if (bAdmit && getRecvInline(ntohs(pPkgHeader->msgCode))) {
+    /* 心跳这种轻量消息就地处理，不进线程池；过载策略照样管，排队数照样记 */
+    ++p_Conn->iRecvQueued;
+    threadRecvProcFunc(p_Conn->precvMemPointer);
+    recvMsgDone(p_Conn->precvMemPointer);
+    ++m_iRecvInlineCount;
+    bAdmit = false; /* 下面释放内存 */
+  }
+
+  if (bAdmit) {
+    ++p_Conn->iRecvQueued; /* 先计数再入队，业务线程处理完会减 */
+    if (!g_threadpool.inMsgRecvQueueAndSingal(
+            p_Conn->precvMemPointer)) { /* 整个数据包地址传入 */
+      /* 队列满了不管什么策略都只能丢，BUSY 策略照样回忙 */
+      recvMsgDone(p_Conn->precvMemPointer); /* 计数减回去，必要时恢复读 */
+      if (m_iRecvOverloadPolicy == NGX_RECV_OVERLOAD_BUSY)
+        sendServerBusy((LPSTRUC_MSG_HEADER)p_Conn->precvMemPointer);
+      bAdmit = false;
+    }
+  }
+  if (bAdmit == false) {
     //对于有攻击倾向的恶人，先把他的包丢掉
     CMemory *p_memory = CMemory::GetInstance();
     p_memory->FreeMemory(p_Conn->precvMemPointer);
@@ -255,14 +402,148 @@ void CSocket::ngx_read_request_handler_proc_plast(lpngx_connection_t p_Conn,
   /* 内存不再需要释放，收完整了包，由inMsgRecvQueue()移入消息队列 */
   /* 那么释放内存就属于业务逻辑去干，不需要回收连接到连接池中干了 */
   p_Conn->precvMemPointer = NULL;
-  p_Conn->curStat = _PKG_HD_INIT;
-  p_Conn->precvbuf = p_Conn->dataHeadInfo; /* 设置好收包的位置 */
-  p_Conn->irecvlen = m_iLenPkgHeader; /* 设置好要接收数据的大小 */
+  /* 设置好收包的位置和大小 就地处理的 _CMD_FRAMING 刚改了包头格式也在这生效 */
+  resetRecvHeader(p_Conn);
   // ngx_log_error_core(NGX_LOG_DEBUG, 0,
   //                    "ngx_read_request_handler_proc_plast() success");
   return;
 }
 
+/*
+ * @ Description: 分块接收收完一块 交给业务线程，不是最后一块就接着分配下一块
+ *   一个连接同时最多一块在排队一块在收：交出去之前先停读，
+ *   业务线程处理完 recvMsgDone 恢复，所以上传再大内存也只占两块
+ *   分块不受收消息队列上限限制，限速靠停读
+ * @ Parameter: lpngx_connection_t c
+ * @ Return: void
+ */
+void CSocket::ngx_read_request_handler_proc_chunk(lpngx_connection_t c,
+                                                  bool &isflood) {
+  LPSTRUC_MSG_HEADER pMsgHeader = (LPSTRUC_MSG_HEADER)c->precvMemPointer;
+  LPCOMM_PKG_HEADER pPkgHeader =
+      (LPCOMM_PKG_HEADER)(c->precvMemPointer + m_iLenMsgHeader);
+  unsigned short iMsgCode = ntohs(pPkgHeader->msgCode);
+
+  if (isflood) { /* 连接马上要关，这个包不要了 */
+    CMemory::GetInstance()->FreeMemory(c->precvMemPointer);
+    c->precvMemPointer = NULL;
+    c->iStreamTotal = 0;
+    c->iStreamOffset = 0;
+    resetRecvHeader(c);
+    return;
+  }
+
+  c->iStreamOffset += ntohs(pPkgHeader->pkgLen) - m_iLenPkgHeader;
+  bool bLast = (c->iStreamOffset >= c->iStreamTotal);
+  if (bLast) {
+    pMsgHeader->iChunkFlags |= NGX_CHUNK_LAST;
+    if (pMsgHeader->iCsumMode != NGX_CSUM_NONE &&
+        c->iStreamCrc != c->iStreamCrcWant) {
+      /* 前面的块已经交出去了，最后一块照样交付，处理函数丢掉已收的数据 */
+      ngx_log_stderr(0,
+                     "CSocket::ngx_read_request_handler_proc_chunk()中CRC错误"
+                     "，消息码%d，包体%d字节!",
+                     iMsgCode, (int)c->iStreamTotal);
+      addRecvStat(iMsgCode, NGX_MSG_ERR_CRC, 0);
+      pMsgHeader->iChunkFlags |= NGX_CHUNK_BADCRC;
+    }
+  } else if (c->bRecvPaused == false &&
+             ngx_epoll_oper_event(c->fd, EPOLL_CTL_MOD, EPOLLIN, 1, c) !=
+                 -1) {
+    /* 先停读再入队，不然业务线程可能抢在前面处理完，就没人来恢复了 */
+    c->bRecvPaused = true;
+  }
+
+  ++m_iRecvChunkCount;
+  ++c->iRecvQueued; /* 先计数再入队，业务线程处理完会减 */
+  if (!g_threadpool.inMsgRecvQueueAndSingal(c->precvMemPointer)) {
+    /* 丢掉一块后面的块就接不上了，整个连接关掉 */
+    ngx_log_error_core(NGX_LOG_ERR, 0,
+                       "CSocket::ngx_read_request_handler_proc_chunk() "
+                       "收消息队列满，关闭分块上传的连接");
+    recvMsgDone(c->precvMemPointer);
+    CMemory::GetInstance()->FreeMemory(c->precvMemPointer);
+    c->precvMemPointer = NULL;
+    c->iStreamTotal = 0;
+    c->iStreamOffset = 0;
+    resetRecvHeader(c);
+    isflood = true; /* 调用者关连接 */
+    return;
+  }
+
+  if (!bLast) {
+    c->precvMemPointer = allocRecvChunk(c, iMsgCode); /* 下一块 */
+    pPkgHeader = (LPCOMM_PKG_HEADER)(c->precvMemPointer + m_iLenMsgHeader);
+    c->curStat = _PKG_BD_INIT;
+    c->precvbuf = (char *)pPkgHeader + m_iLenPkgHeader;
+    c->irecvlen = ntohs(pPkgHeader->pkgLen) - m_iLenPkgHeader;
+  } else {
+    ++m_iRecvStreamCount;
+    c->iStreamTotal = 0;
+    c->iStreamOffset = 0;
+    c->precvMemPointer = NULL;
+    resetRecvHeader(c);
+  }
+  return;
+}
+
+/*
+ * @ Description: 收消息队列超过上限时的准入
+ *   DROP  直接丢掉新包
+ *   BUSY  丢掉新包，回一个服务器忙让客户端退避
+ *   PAUSE 排队包数不少于平均值(或达到 ProcMsgRecvPauseMin)的连接
+ *         先把这个包收下，然后停掉它的读事件，等它的包都处理完了再恢复；
+ *         队列到了上限的2倍，有包在排队的连接都停；不丢包
+ * @ Parameter: lpngx_connection_t p_Conn
+ * @ Return: bool true 照常入队 false 丢掉
+ */
+bool CSocket::recvOverload(lpngx_connection_t p_Conn) {
+  int iPolicy = m_iRecvOverloadPolicy;
+  if (iPolicy == NGX_RECV_OVERLOAD_PAUSE) {
+    int iQueued = p_Conn->iRecvQueued;
+    int iTotal = g_threadpool.getRecvMsgQueueCount();
+    /* 没有包在排队的连接停了就没人来恢复，只能照收 */
+    if (iQueued > 0 &&
+        (iQueued >= m_iRecvPauseMin || iQueued * m_onlineUserCount >= iTotal ||
+         iTotal >= m_iRecvQueueMax * 2)) {
+      /* 读事件是水平触发，去掉 EPOLLIN 以后内核缓冲区里的数据先放着 */
+      if (p_Conn->bRecvPaused == false &&
+          ngx_epoll_oper_event(p_Conn->fd, EPOLL_CTL_MOD, EPOLLIN, 1,
+                               p_Conn) != -1) {
+        p_Conn->bRecvPaused = true;
+        ++m_iRecvOverloadCount[NGX_RECV_OVERLOAD_PAUSE];
+      }
+    }
+    return true;
+  }
+
+  ++m_iRecvOverloadCount[iPolicy];
+  if (iPolicy == NGX_RECV_OVERLOAD_BUSY)
+    sendServerBusy((LPSTRUC_MSG_HEADER)p_Conn->precvMemPointer);
+  return false;
+}
+
+/*
+ * @ Description: 业务线程处理完一个收到的包，连接上没有排队的包了
+ *   并且之前被暂停了读，就恢复读事件
+ * @ Parameter: char *pMsgBuf(消息头+包头+包体)
+ * @ Return: void
+ */
+void CSocket::recvMsgDone(char *pMsgBuf) {
+  LPSTRUC_MSG_HEADER pMsgHeader = (LPSTRUC_MSG_HEADER)pMsgBuf;
+  lpngx_connection_t p_Conn = pMsgHeader->pConn;
+  if (p_Conn->iCurrsequence != pMsgHeader->iCurrsequence) return; /* 已回收 */
+  if (--p_Conn->iRecvQueued > 0) return;
+
+  if (p_Conn->bRecvPaused.exchange(false)) {
+    /* 重新加上 EPOLLIN，缓冲区里有数据的话 epoll 马上会报可读 */
+    if (ngx_epoll_oper_event(p_Conn->fd, EPOLL_CTL_MOD, EPOLLIN, 0, p_Conn) !=
+        -1)
+      ++m_iRecvResumeCount;
+  }
+  return;
+}
+
 /*
  * @ Description: 发送数据
  * @ Parameter: lpngx_connection_t c, char *buff, ssize_t size
@@ -315,8 +596,6 @@ ssize_t CSocket::sendproc(lpngx_connection_t c, char *buff, ssize_t size) {
  * @ Return: void
  */
 void CSocket::ngx_write_request_handler(lpngx_connection_t pConn) {
-  CMemory *p_memory = CMemory::GetInstance();
-
   ssize_t sendsize = sendproc(pConn, pConn->psendbuf, pConn->isendlen);
 
   if (sendsize > 0 && sendsize != pConn->isendlen) {
@@ -349,13 +628,10 @@ void CSocket::ngx_write_request_handler(lpngx_connection_t pConn) {
 
   //数据发送完毕，或者把需要发送的数据干掉
   //都说明发送缓冲区可能有地方了，让发送线程往下走判断能否发送新数据
-  p_memory->FreeMemory(pConn->psendMemPointer);  //释放内存
+  freeSendMsg(pConn->psendMemPointer);  //释放内存
   pConn->psendMemPointer = NULL;
   --pConn->iThrowsendCount;  //建议放在最后执行
-  if (sem_post(&m_semEventSendQueue) == -1)
-    ngx_log_error_core(NGX_LOG_ERR, 0,
-                       "CSocket::ngx_write_request_handler()->sem_post(&m_"
-                       "semEventSendQueue) failed");
+  wakeSendThread();
 
   return;
 }
@@ -176,6 +176,8 @@ void *CSocket::ServerTimerQueueMonitorThread(void *threadData) {
   ThreadItem *pThread = static_cast<ThreadItem *>(threadData);
   CSocket *pSocketObj = pThread->_pThis;
 
+  ngx_affinity_bind_thread(NGX_THREAD_TIMER);
+
   time_t absolute_time, cur_time;
   int err;
 
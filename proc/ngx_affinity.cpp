@@ -0,0 +1,331 @@
+/*
+ * @Author: agent
+ * @Date: 2026-10-19 15:09:15
+ * @Last Modified by: agent
+ * @Last Modified time: 2026-10-19 15:47:25
+ * @Description: worker 进程和各类线程的 cpu 绑定，numa 内存策略
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <dirent.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "ngx_c_conf.h"
+#include "ngx_func.h"
+#include "ngx_macro.h"
+
+#define NGX_NUMA_NODE_MAX 64 /* 最多支持的 numa 节点数 */
+#define NGX_MPOL_PREFERRED 1 /* 同 numaif.h 的 MPOL_PREFERRED，避免依赖 libnuma */
+
+typedef struct {
+  int id;         /* 节点号 */
+  cpu_set_t cpus; /* 节点上的 cpu */
+} ngx_numa_node_t;
+
+static bool g_affinity_enable = false;                 /* 是否绑定 */
+static cpu_set_t g_role_cpus[NGX_THREAD_ROLE_N];       /* 各角色的 cpu 集合 */
+static const char *g_role_names[NGX_THREAD_ROLE_N] = { /* 配置项名字 */
+                                                      "Reactor", "Sender",
+                                                      "Timer",   "Logic",
+                                                      "Io",      "Journal"};
+
+/*
+ * @ Description: 解析 "0-3,8,10-11" 形式的 cpu 列表
+ * @ Parameter: const char *str, cpu_set_t *set
+ * @ Return: bool 格式不对返回 false
+ */
+static bool ngx_parse_cpulist(const char *str, cpu_set_t *set) {
+  CPU_ZERO(set);
+  const char *p = str;
+  char *end;
+
+  while (*p) {
+    while (*p == ' ' || *p == ',' || *p == '\n') ++p;
+    if (*p == 0) break;
+
+    long lo = strtol(p, &end, 10);
+    if (end == p || lo < 0) return false;
+    long hi = lo;
+    p = end;
+    if (*p == '-') {
+      ++p;
+      hi = strtol(p, &end, 10);
+      if (end == p || hi < lo) return false;
+      p = end;
+    }
+    for (long i = lo; i <= hi && i < CPU_SETSIZE; ++i) CPU_SET(i, set);
+    if (*p != 0 && *p != ',' && *p != ' ' && *p != '\n') return false;
+  }
+  return CPU_COUNT(set) > 0;
+}
+
+/*
+ * @ Description: cpu 集合转成 "0-3,8" 形式，用于打日志
+ * @ Parameter: cpu_set_t *set, char *buf, size_t len
+ * @ Return: char* buf
+ */
+static char *ngx_format_cpulist(cpu_set_t *set, char *buf, size_t len) {
+  size_t n = 0;
+  buf[0] = 0;
+  for (int i = 0; i < CPU_SETSIZE && n + 16 < len; ++i) {
+    if (!CPU_ISSET(i, set)) continue;
+    int j = i;
+    while (j + 1 < CPU_SETSIZE && CPU_ISSET(j + 1, set)) ++j;
+    n += (j == i) ? snprintf(buf + n, len - n, "%s%d", n ? "," : "", i)
+                  : snprintf(buf + n, len - n, "%s%d-%d", n ? "," : "", i, j);
+    i = j;
+  }
+  return buf;
+}
+
+/*
+ * @ Description: 从 /sys/devices/system/node 读取 numa 拓扑
+ *   没有 sysfs 时当作只有一个节点，包含所有 cpu
+ * @ Parameter: ngx_numa_node_t *nodes, cpu_set_t *allowed(进程允许的 cpu)
+ * @ Return: int 节点数
+ */
+static int ngx_read_numa_nodes(ngx_numa_node_t *nodes, cpu_set_t *allowed) {
+  int n = 0;
+  DIR *dir = opendir("/sys/devices/system/node");
+
+  if (dir != NULL) {
+    struct dirent *ent;
+    while ((ent = readdir(dir)) != NULL && n < NGX_NUMA_NODE_MAX) {
+      int id;
+      if (sscanf(ent->d_name, "node%d", &id) != 1) continue;
+
+      char path[128], line[1024];
+      snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist",
+               id);
+      FILE *fp = fopen(path, "r");
+      if (fp == NULL) continue;
+      bool bOk = (fgets(line, sizeof(line), fp) != NULL);
+      fclose(fp);
+      if (!bOk || !ngx_parse_cpulist(line, &nodes[n].cpus)) continue;
+
+      CPU_AND(&nodes[n].cpus, &nodes[n].cpus, allowed);
+      if (CPU_COUNT(&nodes[n].cpus) == 0) continue; /* 节点上没有能用的 cpu */
+      nodes[n].id = id;
+      ++n;
+    }
+    closedir(dir);
+  }
+
+  if (n == 0) {
+    nodes[0].id = 0;
+    memcpy(&nodes[0].cpus, allowed, sizeof(cpu_set_t));
+    n = 1;
+  }
+
+  /* readdir 不保证顺序，按节点号排一下 */
+  for (int i = 1; i < n; ++i) {
+    for (int j = i; j > 0 && nodes[j].id < nodes[j - 1].id; --j) {
+      ngx_numa_node_t tmp = nodes[j];
+      nodes[j] = nodes[j - 1];
+      nodes[j - 1] = tmp;
+    }
+  }
+  return n;
+}
+
+/*
+ * @ Description: auto 布局 worker 按 inum 轮流分到各 numa 节点，
+ *   同一节点上的 worker 平分节点的 cpu
+ * @ Parameter: int inum, int iworkers, ngx_numa_node_t *nodes, int nnodes,
+ *   cpu_set_t *set
+ * @ Return: void
+ */
+static void ngx_auto_worker_cpus(int inum, int iworkers,
+                                 ngx_numa_node_t *nodes, int nnodes,
+                                 cpu_set_t *set) {
+  ngx_numa_node_t *node = &nodes[inum % nnodes];
+  int ipeer = iworkers / nnodes + ((inum % nnodes) < (iworkers % nnodes));
+  int irank = inum / nnodes;
+
+  int cpus[CPU_SETSIZE];
+  int ncpu = 0;
+  for (int i = 0; i < CPU_SETSIZE; ++i)
+    if (CPU_ISSET(i, &node->cpus)) cpus[ncpu++] = i;
+
+  CPU_ZERO(set);
+  if (ipeer < 1) ipeer = 1;
+  if (ncpu <= ipeer) { /* cpu 不够分，一个 worker 一个核，轮着用 */
+    CPU_SET(cpus[irank % ncpu], set);
+    return;
+  }
+  int ibegin = ncpu * irank / ipeer;
+  int iend = ncpu * (irank + 1) / ipeer;
+  for (int i = ibegin; i < iend; ++i) CPU_SET(cpus[i], set);
+  return;
+}
+
+/*
+ * @ Description: 按 worker 的 cpu 集合拆分各线程角色
+ *   epoll 线程、发送线程各占一个核，业务线程用剩下的核，
+ *   定时、回收、IO 和刷盘线程大部分时间在等，用整个集合；
+ *   核不够 3 个时都用整个集合
+ * @ Parameter: cpu_set_t *worker
+ * @ Return: void
+ */
+static void ngx_auto_role_cpus(cpu_set_t *worker) {
+  for (int r = 0; r < NGX_THREAD_ROLE_N; ++r)
+    memcpy(&g_role_cpus[r], worker, sizeof(cpu_set_t));
+
+  if (CPU_COUNT(worker) < 3) return;
+
+  int ifirst = -1, isecond = -1;
+  for (int i = 0; i < CPU_SETSIZE && isecond < 0; ++i) {
+    if (!CPU_ISSET(i, worker)) continue;
+    if (ifirst < 0)
+      ifirst = i;
+    else
+      isecond = i;
+  }
+
+  CPU_ZERO(&g_role_cpus[NGX_THREAD_REACTOR]);
+  CPU_SET(ifirst, &g_role_cpus[NGX_THREAD_REACTOR]);
+  CPU_ZERO(&g_role_cpus[NGX_THREAD_SENDER]);
+  CPU_SET(isecond, &g_role_cpus[NGX_THREAD_SENDER]);
+  CPU_CLR(ifirst, &g_role_cpus[NGX_THREAD_LOGIC]);
+  CPU_CLR(isecond, &g_role_cpus[NGX_THREAD_LOGIC]);
+  return;
+}
+
+/*
+ * @ Description: 把进程的内存优先分配到 worker cpu 所在的 numa 节点
+ *   只影响之后第一次访问的页，所以要在连接池、线程池分配之前调用
+ * @ Parameter: cpu_set_t *worker, ngx_numa_node_t *nodes, int nnodes
+ * @ Return: void
+ */
+static void ngx_bind_numa_memory(cpu_set_t *worker, ngx_numa_node_t *nodes,
+                                 int nnodes) {
+  int inode = -1;
+  int ibest = 0;
+  for (int i = 0; i < nnodes; ++i) { /* 选 cpu 交集最多的节点 */
+    cpu_set_t tmp;
+    CPU_AND(&tmp, worker, &nodes[i].cpus);
+    if (CPU_COUNT(&tmp) > ibest) {
+      ibest = CPU_COUNT(&tmp);
+      inode = nodes[i].id;
+    }
+  }
+  if (inode < 0 || inode >= NGX_NUMA_NODE_MAX) return;
+
+  unsigned long mask = 1UL << inode;
+  if (syscall(SYS_set_mempolicy, NGX_MPOL_PREFERRED, &mask,
+              sizeof(mask) * 8) == -1) {
+    ngx_log_error_core(NGX_LOG_ERR, errno,
+                       "ngx_bind_numa_memory()->set_mempolicy() node = %d "
+                       "failed",
+                       inode);
+    return;
+  }
+  ngx_log_error_core(NGX_LOG_NOTICE, 0, "memory prefer numa node %d", inode);
+  return;
+}
+
+/*
+ * @ Description: worker 进程初始化时确定各角色的 cpu 集合，
+ *   绑定当前线程(epoll 线程)，按配置设置 numa 内存策略
+ * @ Parameter: int inum(worker 编号)
+ * @ Return: void
+ */
+void ngx_affinity_init(int inum) {
+  CConfig *p_config = CConfig::GetInstance();
+  if (p_config->GetIntDefault("CpuAffinity", 0) != 1) return;
+
+  cpu_set_t allowed;
+  if (sched_getaffinity(0, sizeof(allowed), &allowed) == -1) {
+    ngx_log_error_core(NGX_LOG_ERR, errno,
+                       "ngx_affinity_init()->sched_getaffinity() failed");
+    return;
+  }
+
+  ngx_numa_node_t nodes[NGX_NUMA_NODE_MAX];
+  int nnodes = ngx_read_numa_nodes(nodes, &allowed);
+
+  // worker 的 cpu 集合
+  cpu_set_t worker;
+  char strinfo[100];
+  char *pcpus = p_config->GetString("WorkerCpus");
+  if (pcpus == NULL || strcasecmp(pcpus, "auto") == 0) {
+    ngx_auto_worker_cpus(inum, p_config->GetIntDefault("WorkerProcesses", 1),
+                         nodes, nnodes, &worker);
+  } else {
+    snprintf(strinfo, sizeof(strinfo), "WorkerCpus%d", inum);
+    pcpus = p_config->GetString(strinfo);
+    if (pcpus == NULL || !ngx_parse_cpulist(pcpus, &worker)) {
+      ngx_log_error_core(NGX_LOG_WARN, 0,
+                         "ngx_affinity_init() %s not configured or invalid",
+                         strinfo);
+      return;
+    }
+  }
+
+  // 线程角色，可以用 Worker0LogicCpus = 2-7 这样单独指定
+  if (p_config->GetIntDefault("CpuAffinityRoles", 1) == 1) {
+    ngx_auto_role_cpus(&worker);
+  } else {
+    for (int r = 0; r < NGX_THREAD_ROLE_N; ++r)
+      memcpy(&g_role_cpus[r], &worker, sizeof(cpu_set_t));
+  }
+  for (int r = 0; r < NGX_THREAD_ROLE_N; ++r) {
+    snprintf(strinfo, sizeof(strinfo), "Worker%d%sCpus", inum, g_role_names[r]);
+    pcpus = p_config->GetString(strinfo);
+    if (pcpus != NULL && !ngx_parse_cpulist(pcpus, &g_role_cpus[r])) {
+      ngx_log_error_core(NGX_LOG_WARN, 0,
+                         "ngx_affinity_init() %s = %s invalid", strinfo,
+                         pcpus);
+      memcpy(&g_role_cpus[r], &worker, sizeof(cpu_set_t));
+    }
+  }
+
+  g_affinity_enable = true;
+
+  char buf[NGX_THREAD_ROLE_N][256];
+  for (int r = 0; r < NGX_THREAD_ROLE_N; ++r)
+    ngx_format_cpulist(&g_role_cpus[r], buf[r], sizeof(buf[r]));
+  ngx_log_error_core(NGX_LOG_NOTICE, 0,
+                     "worker %d cpu affinity reactor = [%s] sender = [%s] "
+                     "timer = [%s] logic = [%s] io = [%s] journal = [%s]",
+                     inum, buf[NGX_THREAD_REACTOR], buf[NGX_THREAD_SENDER],
+                     buf[NGX_THREAD_TIMER], buf[NGX_THREAD_LOGIC],
+                     buf[NGX_THREAD_IO], buf[NGX_THREAD_JOURNAL]);
+
+  if (p_config->GetIntDefault("NumaBindMemory", 0) == 1)
+    ngx_bind_numa_memory(&worker, nodes, nnodes);
+
+  ngx_affinity_bind_thread(NGX_THREAD_REACTOR);
+  return;
+}
+
+/*
+ * @ Description: 当前线程绑定到角色对应的 cpu 集合，没开启时什么也不做
+ *   新线程会继承创建者的绑定，所以每个线程入口都要调用一次
+ * @ Parameter: int role(NGX_THREAD_*)
+ * @ Return: void
+ */
+void ngx_affinity_bind_thread(int role) {
+  if (!g_affinity_enable || role < 0 || role >= NGX_THREAD_ROLE_N) return;
+
+  int err = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t),
+                                   &g_role_cpus[role]);
+  if (err != 0) {
+    ngx_log_error_core(NGX_LOG_ERR, err,
+                       "ngx_affinity_bind_thread()->pthread_setaffinity_np() "
+                       "role = %d failed",
+                       role);
+  }
+  return;
+}
@@ -14,6 +14,10 @@
 #include <unistd.h>
 
 #include "ngx_c_conf.h"
+#include "ngx_c_coroutine.h"
+#include "ngx_c_journal.h"
+#include "ngx_c_session.h"
+#include "ngx_c_userregistry.h"
 #include "ngx_func.h"
 #include "ngx_global.h"
 #include "ngx_macro.h"
@@ -65,6 +69,28 @@ void ngx_master_process_cycle() {
 
   CConfig *p_config = CConfig::GetInstance();
   int workprocess = p_config->GetIntDefault("WorkerProcesses", 1);
+
+  /* 会话表所有 worker 共用，必须在 fork 之前映射 */
+  if (CSessionTable::GetInstance()->Create(
+          p_config->GetIntDefault("SessionCapacity", 65536),
+          p_config->GetIntDefault("SessionTimeout", 3600)) == false)
+    exit(-2);
+
+  /* 用户表也是所有 worker 共用，在哪个 worker 注册都能在别的 worker 登录 */
+  if (CUserRegistry::GetInstance()->Create(
+          p_config->GetIntDefault("UserRegistryCapacity", 65536),
+          p_config->GetIntDefault("UserRegistryShards", 64),
+          p_config->GetIntDefault("PasswordHashRounds", 4096)) == false)
+    exit(-2);
+
+  /* 注册日志所有 worker 追加同一个文件，也在 fork 之前打开，顺便恢复用户表 */
+  const char *pJournalFile = p_config->GetString("JournalFile");
+  if (pJournalFile != NULL && pJournalFile[0] != 0 &&
+      CUserJournal::GetInstance()->Open(
+          pJournalFile, p_config->GetIntDefault("JournalRecoverThreads", 4)) ==
+          false)
+    exit(-2);
+
   ngx_start_worker_processes(workprocess);
 
   sigemptyset(&set); /* 结束创建子进程过程 */
@@ -126,6 +152,8 @@ static void ngx_worker_process_cycle(int inum, const char *pprocname) {
         } */
   }
 
+  CUserJournal::GetInstance()->Stop();
+  CCoScheduler::GetInstance()->Stop();
   g_threadpool.StopAll();
   g_socket.Shutdown_subproc();
 
@@ -142,10 +170,23 @@ static void ngx_worker_process_init(int inum) {
                        "ngx_worker_process_init() sigprocmask() filed");
   }
 
+  /* 先绑 cpu 和内存策略，后面的连接池、线程都在绑定之后创建 */
+  ngx_affinity_init(inum);
+
   CConfig *p_config = CConfig::GetInstance();
   int threadnums = p_config->GetIntDefault("ProcMsgRecvWorkThreadCount", 1);
   if (g_threadpool.Create(threadnums) == false) exit(-2);
 
+  /* 协程版业务处理用的定时器线程和IO线程，协程由上面的线程池恢复 */
+  int ionums = p_config->GetIntDefault("ProcCoIoThreadCount", 2);
+  if (CCoScheduler::GetInstance()->Start(ionums) == false) exit(-2);
+
+  /* 用户表 master 已经从注册日志恢复好了，这里只起刷盘线程 */
+  if (CUserJournal::GetInstance()->Start(
+          p_config->GetIntDefault("JournalSync", NGX_JOURNAL_SYNC_DATA),
+          p_config->GetIntDefault("JournalQueueSize", 4096)) == false)
+    exit(-2);
+
   if (g_socket.Initialize_subproc() == false) exit(-2);
 
   g_socket.ngx_epoll_init();